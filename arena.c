@@ -0,0 +1,84 @@
+#include "molecular-simulator.h"
+
+#include <sys/mman.h>
+
+
+static const size_t huge_page_size = 2*1024*1024;
+
+
+/** Creates an arena able to hold size bytes.  If huge_pages is true the
+ * kernel is asked to back the arena with transparent huge pages, and
+ * the arena is rounded up to and aligned on them, as the kernel only
+ * uses huge pages for whole, aligned ones: even a small arena then
+ * takes at least one. */
+struct arena *new_arena(size_t size, bool huge_pages)
+{
+        struct arena *a;
+
+        if (size == 0)
+                return NULL;
+
+        if ((a = malloc(sizeof(struct arena))) == NULL)
+                return NULL;
+
+        const size_t page_size = huge_pages ? huge_page_size
+                                            : (size_t) sysconf(_SC_PAGESIZE);
+
+        a->size = (size + page_size - 1)/page_size*page_size;
+        a->used = 0;
+
+        /* Mappings are only aligned on small pages: map a huge page
+         * more and trim the ends off an aligned arena. */
+        const size_t slack = huge_pages ? huge_page_size : 0;
+        char *base = mmap(NULL, a->size + slack, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+                free(a);
+                return NULL;
+        }
+
+        a->base = base;
+        if (huge_pages) {
+                const size_t head = (huge_page_size - (uintptr_t) base % huge_page_size)
+                        % huge_page_size;
+
+                a->base = base + head;
+                if (head > 0)
+                        munmap(base, head);
+                if (slack - head > 0)
+                        munmap(a->base + a->size, slack - head);
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (huge_pages)
+                madvise(a->base, a->size, MADV_HUGEPAGE);
+#endif
+
+        return a;
+}
+
+void delete_arena(struct arena *self)
+{
+        assert(self != NULL);
+
+        munmap(self->base, self->size);
+        free(self);
+}
+
+/** Hands out a block of size bytes starting at a cache line boundary.
+ * Blocks are padded to whole cache lines so that no two of them share
+ * one.  The memory is zero-filled. */
+void *arena_alloc(struct arena *self, size_t size)
+{
+        assert(self != NULL);
+
+        const size_t n = cache_line_round_up(size);
+
+        if (self->size - self->used < n)
+                return NULL;
+
+        void *ptr = self->base + self->used;
+        self->used += n;
+
+        return ptr;
+}
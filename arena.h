@@ -0,0 +1,19 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/** Memory arena.  A replica allocates all of its state from its own
+ * arena so that it lives in pages of its own, first touched by (and
+ * therefore local to the memory node of) the thread that runs it. */
+struct arena {
+        char *base;             /**< Start of the mapping. */
+        size_t size;            /**< Size of the mapping in bytes. */
+        size_t used;            /**< Number of bytes handed out so far. */
+};
+
+
+extern struct arena *new_arena(size_t size, bool huge_pages);
+extern void delete_arena(struct arena *self);
+
+extern void *arena_alloc(struct arena *self, size_t size);
+
+#endif // !ARENA_H
@@ -0,0 +1,174 @@
+#include "molecular-simulator.h"
+
+
+static const size_t empty = SIZE_MAX;
+
+
+static inline size_t num_buckets(size_t num_atoms)
+{
+        size_t n = 16;
+
+        while (n < 2*num_atoms)
+                n *= 2;
+
+        return n;
+}
+
+/** Bytes needed by the arrays of the index of num_atoms atoms. */
+size_t cell_list_size(size_t num_atoms)
+{
+        return cache_line_round_up(num_buckets(num_atoms)*sizeof(size_t))
+                + 3*cache_line_round_up(num_atoms*sizeof(size_t));
+}
+
+/** Points the index at its arrays, cell_list_size(num_atoms) bytes
+ * starting at base (which must be cache aligned). */
+void cell_list_bind(struct cell_list *self, size_t num_atoms,
+                    double cell_size, char *base)
+{
+        const size_t atoms_size = cache_line_round_up(num_atoms*sizeof(size_t));
+
+        self->num_buckets = num_buckets(num_atoms);
+        self->cell_size = cell_size;
+        self->head = (size_t *) base;
+        base += cache_line_round_up(self->num_buckets*sizeof(size_t));
+        self->next = (size_t *) base;
+        base += atoms_size;
+        self->prev = (size_t *) base;
+        base += atoms_size;
+        self->bucket = (size_t *) base;
+}
+
+
+
+static inline long cell_coordinate(const struct cell_list *self, real x)
+{
+        return (long) floor(x/self->cell_size);
+}
+
+static inline size_t hash(const struct cell_list *self, long i, long j, long k)
+{
+        const unsigned long h = ((unsigned long) i*73856093UL)
+                ^ ((unsigned long) j*19349663UL)
+                ^ ((unsigned long) k*83492791UL);
+
+        return (size_t) h & (self->num_buckets - 1);
+}
+
+static inline size_t bucket_of(const struct cell_list *self, const real x[3])
+{
+        return hash(self, cell_coordinate(self, x[0]),
+                    cell_coordinate(self, x[1]), cell_coordinate(self, x[2]));
+}
+
+static inline void bucket_insert(struct cell_list *self, size_t i, size_t b)
+{
+        self->bucket[i] = b;
+        self->prev[i] = empty;
+        self->next[i] = self->head[b];
+        if (self->head[b] != empty)
+                self->prev[self->head[b]] = i;
+        self->head[b] = i;
+}
+
+static inline void bucket_remove(struct cell_list *self, size_t i)
+{
+        const size_t b = self->bucket[i];
+
+        if (self->prev[i] != empty)
+                self->next[self->prev[i]] = self->next[i];
+        else
+                self->head[b] = self->next[i];
+        if (self->next[i] != empty)
+                self->prev[self->next[i]] = self->prev[i];
+}
+
+void cell_list_build(struct cell_list *self, const real (*x)[3],
+                     size_t num_atoms)
+{
+        for (size_t b = 0; b < self->num_buckets; b++)
+                self->head[b] = empty;
+
+        for (size_t i = 0; i < num_atoms; i++)
+                bucket_insert(self, i, bucket_of(self, x[i]));
+}
+
+/** Moves the atoms in [start, end) to the buckets of their current
+ * positions. */
+void cell_list_update(struct cell_list *self, const real (*x)[3],
+                      size_t start, size_t end)
+{
+        for (size_t i = start; i < end; i++) {
+                const size_t b = bucket_of(self, x[i]);
+
+                if (b != self->bucket[i]) {
+                        bucket_remove(self, i);
+                        bucket_insert(self, i, b);
+                }
+        }
+}
+
+/** Tells whether atom i is closer than the cell size to any atom other
+ * than itself and its neighbours along the chain. */
+bool cell_list_overlaps(const struct cell_list *self, const real (*x)[3],
+                        size_t i)
+{
+        bool overlap;
+
+        cell_list_gather(self, x, i, NULL, 0, &overlap);
+
+        return overlap;
+}
+
+/** Visits the atoms in the cells around atom i, except i itself and its
+ * neighbours along the chain.  If one of them is closer than the cell
+ * size, overlap is set and the search stops there.  Otherwise the first
+ * max_near atoms visited are stored in near with their squared
+ * distances, sorted by atom (an atom may appear twice if two cells share
+ * a bucket), and their number is returned. */
+size_t cell_list_gather(const struct cell_list *self, const real (*x)[3],
+                        size_t i, struct cell_neighbor *near, size_t max_near,
+                        bool *overlap)
+{
+        const real d2 = (real) gsl_pow_2(self->cell_size);
+        const long ci = cell_coordinate(self, x[i][0]);
+        const long cj = cell_coordinate(self, x[i][1]);
+        const long ck = cell_coordinate(self, x[i][2]);
+        size_t n = 0;
+
+        *overlap = false;
+
+        for (long di = -1; di <= 1; di++) {
+                for (long dj = -1; dj <= 1; dj++) {
+                        for (long dk = -1; dk <= 1; dk++) {
+                                const size_t b = hash(self, ci + di, cj + dj, ck + dk);
+
+                                for (size_t j = self->head[b]; j != empty; j = self->next[j]) {
+                                        if (j + 1 >= i && j <= i + 1)
+                                                continue;
+
+                                        const real dx = x[j][0] - x[i][0];
+                                        const real dy = x[j][1] - x[i][1];
+                                        const real dz = x[j][2] - x[i][2];
+                                        const real r2 = dx*dx + dy*dy + dz*dz;
+
+                                        if (r2 < d2) {
+                                                *overlap = true;
+                                                return 0;
+                                        }
+
+                                        if (n < max_near) {
+                                                /* Insertion sort: there are few of them. */
+                                                size_t m = n++;
+                                                for (; m > 0 && near[m-1].atom > j; m--)
+                                                        near[m] = near[m-1];
+                                                near[m].atom = j;
+                                                near[m].distance2 = r2;
+                                        }
+                                }
+                        }
+                }
+        }
+
+        return n;
+}
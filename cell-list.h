@@ -0,0 +1,40 @@
+#ifndef CELL_LIST_H
+#define CELL_LIST_H
+
+/** Spatial index of the atoms of a chain: a uniform grid of cubic
+ * cells, hashed into a power of two number of buckets so that sparse
+ * chains need no grid of their own, each bucket holding a doubly linked
+ * list of atoms.  Links are atom indices, so the index can be copied
+ * with memcpy along with the protein that contains it. */
+struct cell_list {
+        size_t num_buckets;
+        double cell_size;       /**< Edge of the cells. */
+        size_t *head;           /**< First atom of each bucket, or SIZE_MAX. */
+        size_t *next, *prev;    /**< Neighbours of each atom in its bucket. */
+        size_t *bucket;         /**< Bucket of each atom. */
+};
+
+/** Atom found near another one and the square of their distance. */
+struct cell_neighbor {
+        size_t atom;
+        real distance2;
+};
+
+
+extern size_t cell_list_size(size_t num_atoms);
+extern void cell_list_bind(struct cell_list *self, size_t num_atoms,
+                           double cell_size, char *base);
+
+extern void cell_list_build(struct cell_list *self, const real (*x)[3],
+                            size_t num_atoms);
+extern void cell_list_update(struct cell_list *self, const real (*x)[3],
+                             size_t start, size_t end);
+
+extern bool cell_list_overlaps(const struct cell_list *self,
+                               const real (*x)[3], size_t i);
+extern size_t cell_list_gather(const struct cell_list *self,
+                               const real (*x)[3], size_t i,
+                               struct cell_neighbor *near, size_t max_near,
+                               bool *overlap);
+
+#endif // !CELL_LIST_H
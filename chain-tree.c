@@ -0,0 +1,174 @@
+#include "molecular-simulator.h"
+
+
+/* Atoms in each leaf segment. */
+static const size_t leaf_size = 8;
+
+
+static inline size_t num_leaves(size_t num_atoms)
+{
+        size_t n = 1;
+
+        while (n*leaf_size < num_atoms)
+                n *= 2;
+
+        return n;
+}
+
+/** Bytes needed by the nodes of the tree of a chain of num_atoms atoms. */
+size_t chain_tree_size(size_t num_atoms)
+{
+        const size_t num_nodes = 2*num_leaves(num_atoms);
+
+        return 3*cache_line_round_up(num_nodes*sizeof(size_t))
+                + cache_line_round_up(num_nodes*sizeof(double));
+}
+
+/** Points the tree at its nodes, chain_tree_size(num_atoms) bytes
+ * starting at base (which must be cache aligned), and lays out their
+ * segments. */
+void chain_tree_bind(struct chain_tree *self, size_t num_atoms, char *base)
+{
+        self->num_leaves = num_leaves(num_atoms);
+
+        const size_t num_nodes = 2*self->num_leaves;
+        const size_t indices_size = cache_line_round_up(num_nodes*sizeof(size_t));
+
+        self->lo = (size_t *) base;
+        base += indices_size;
+        self->hi = (size_t *) base;
+        base += indices_size;
+        self->anchor = (size_t *) base;
+        base += indices_size;
+        self->radius = (double *) base;
+
+        for (size_t n = self->num_leaves; n < num_nodes; n++) {
+                const size_t leaf = n - self->num_leaves;
+
+                self->lo[n] = GSL_MIN(leaf*leaf_size, num_atoms);
+                self->hi[n] = GSL_MIN((leaf + 1)*leaf_size, num_atoms);
+        }
+        for (size_t n = self->num_leaves - 1; n >= 1; n--) {
+                self->lo[n] = self->lo[2*n];
+                self->hi[n] = self->hi[2*n + 1];
+        }
+        for (size_t n = 1; n < num_nodes; n++)
+                self->anchor[n] = self->lo[n] + (self->hi[n] - self->lo[n])/2;
+}
+
+
+
+static inline double distance(const real u[3], const real v[3])
+{
+        const double dx = (double) v[0] - u[0];
+        const double dy = (double) v[1] - u[1];
+        const double dz = (double) v[2] - u[2];
+
+        return sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+static void fit_node(struct chain_tree *self, const real (*x)[3], size_t n)
+{
+        const real *c = x[self->anchor[n]];
+        double r = 0.0;
+
+        if (n >= self->num_leaves) {
+                for (size_t i = self->lo[n]; i < self->hi[n]; i++)
+                        r = GSL_MAX(r, distance(c, x[i]));
+        } else {
+                for (size_t m = 2*n; m <= 2*n + 1; m++)
+                        if (self->lo[m] < self->hi[m])
+                                r = GSL_MAX(r, distance(c, x[self->anchor[m]])
+                                               + self->radius[m]);
+        }
+
+        self->radius[n] = r;
+}
+
+void chain_tree_build(struct chain_tree *self, const real (*x)[3])
+{
+        for (size_t n = 2*self->num_leaves - 1; n >= 1; n--)
+                if (self->lo[n] < self->hi[n])
+                        fit_node(self, x, n);
+}
+
+static void update(struct chain_tree *self, const real (*x)[3],
+                   size_t n, size_t start, size_t end)
+{
+        /* Untouched or carried along rigidly. */
+        if (self->hi[n] <= start || end <= self->lo[n]
+            || (start <= self->lo[n] && self->hi[n] <= end))
+                return;
+
+        if (n < self->num_leaves) {
+                update(self, x, 2*n, start, end);
+                update(self, x, 2*n + 1, start, end);
+        }
+        fit_node(self, x, n);
+}
+
+/** Refits the spheres after the atoms in [start, end) have been moved
+ * rigidly.  Only the nodes whose segment straddles one end of the
+ * range, at most two per level, change. */
+void chain_tree_update(struct chain_tree *self, const real (*x)[3],
+                       size_t start, size_t end)
+{
+        update(self, x, 1, start, end);
+}
+
+
+
+static bool overlaps(const struct chain_tree *self, const real (*x)[3],
+                     size_t a, size_t b, size_t k, double d)
+{
+        /* Only pairs with one atom on each side of k matter. */
+        if (self->lo[a] >= k || self->hi[b] <= k
+            || self->lo[a] >= self->hi[a] || self->lo[b] >= self->hi[b])
+                return false;
+
+        /* The margin absorbs the rounding of the coordinates. */
+        const double gap = distance(x[self->anchor[a]], x[self->anchor[b]])
+                - self->radius[a] - self->radius[b];
+        if (gap >= d*(1.0 + 16*REAL_EPSILON))
+                return false;
+
+        const bool a_is_leaf = a >= self->num_leaves;
+        const bool b_is_leaf = b >= self->num_leaves;
+
+        if (a_is_leaf && b_is_leaf) {
+                const real d2 = (real) gsl_pow_2(d);
+
+                for (size_t i = self->lo[a]; i < GSL_MIN(self->hi[a], k); i++) {
+                        for (size_t j = GSL_MAX(self->lo[b], k); j < self->hi[b]; j++) {
+                                if (j == i + 1)
+                                        continue;
+
+                                const real dx = x[j][0] - x[i][0];
+                                const real dy = x[j][1] - x[i][1];
+                                const real dz = x[j][2] - x[i][2];
+
+                                if (dx*dx + dy*dy + dz*dz < d2)
+                                        return true;
+                        }
+                }
+
+                return false;
+        }
+
+        /* Open the larger node. */
+        if (b_is_leaf || (!a_is_leaf && self->radius[a] >= self->radius[b]))
+                return overlaps(self, x, 2*a, b, k, d)
+                        || overlaps(self, x, 2*a + 1, b, k, d);
+        else
+                return overlaps(self, x, a, 2*b, k, d)
+                        || overlaps(self, x, a, 2*b + 1, k, d);
+}
+
+/** Tells whether an atom in [0, k) is closer than d to an atom in
+ * [k, N), the pair (k-1, k) excepted.  Pairs of segments whose spheres
+ * are far apart are discarded without looking at their atoms. */
+bool chain_tree_split_overlaps(const struct chain_tree *self,
+                               const real (*x)[3], size_t k, double d)
+{
+        return overlaps(self, x, 1, 1, k, d);
+}
@@ -0,0 +1,29 @@
+#ifndef CHAIN_TREE_H
+#define CHAIN_TREE_H
+
+/** Bounding volume hierarchy of a chain, in the spirit of Clisby's
+ * SAW-tree: a complete binary tree whose leaves are short segments of
+ * consecutive atoms.  Each node bounds its segment with a sphere
+ * centred on one of its atoms (its anchor), so that a rigid movement of
+ * a whole segment carries its sphere along without touching the node.
+ * Nodes are stored heap-style, the root being node 1. */
+struct chain_tree {
+        size_t num_leaves;      /**< Power of two. */
+        size_t *lo, *hi;        /**< Segment of each node, [lo, hi). */
+        size_t *anchor;         /**< Centre of the sphere of each node. */
+        double *radius;         /**< Radius of the sphere of each node. */
+};
+
+
+extern size_t chain_tree_size(size_t num_atoms);
+extern void chain_tree_bind(struct chain_tree *self, size_t num_atoms,
+                            char *base);
+
+extern void chain_tree_build(struct chain_tree *self, const real (*x)[3]);
+extern void chain_tree_update(struct chain_tree *self, const real (*x)[3],
+                              size_t start, size_t end);
+
+extern bool chain_tree_split_overlaps(const struct chain_tree *self,
+                                      const real (*x)[3], size_t k, double d);
+
+#endif // !CHAIN_TREE_H
@@ -0,0 +1,559 @@
+#include "molecular-simulator.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+
+enum transport { TRANSPORT_UNIX, TRANSPORT_TCP, TRANSPORT_SHM };
+
+/* How long either end of a link waits for the other to appear. */
+static const double connect_timeout = 60.0;
+static const long connect_retry_ns = 50000000L;
+
+static const size_t shm_magic = 0x676f7265706c6963UL;
+
+/* Start of a shared memory segment.  The mailboxes of link k follow: 2k
+ * is read by the listener, 2k+1 by the process that joined. */
+struct shm_header {
+        size_t magic;           /* Written last, once the segment is ready. */
+        size_t num_channels;
+        char padding[CACHE_LINE_SIZE - 2*sizeof(size_t)];
+};
+
+/*
+ * A mailbox holds one message at a time.  Its two counters only grow:
+ * the writer waits until every message sent has been received before
+ * writing the next one, and the reader until there is one it has not
+ * received.  The writer also leaves its process ID, to be checked by a
+ * reader that has waited for long, and marks the mailbox closed when it
+ * is done with the link, as a socket would.
+ */
+struct mailbox {
+        size_t sent;
+        pid_t writer;
+        int closed;
+        char padding0[CACHE_LINE_SIZE - sizeof(size_t) - sizeof(pid_t) - sizeof(int)];
+        size_t received;
+        char padding1[CACHE_LINE_SIZE - sizeof(size_t)];
+        size_t n;
+        double values[CHANNEL_MAX_VALUES];
+};
+
+static int parse_address(const char *address, enum transport *transport,
+                         char *rest, size_t size);
+static int split_host_port(char *rest, const char **host, const char **port);
+static int open_socket(enum transport transport, char *rest, bool listening);
+static size_t shm_size(size_t num_channels);
+static struct mailbox *shm_mailbox(void *shm, size_t k);
+static int wait_until(const struct channel *c, const size_t *counter,
+                      size_t value);
+static void pause_before_retry(void);
+static int send_all(int fd, const void *buffer, size_t size);
+static int receive_all(int fd, void *buffer, size_t size);
+
+
+
+/** Starts accepting num_channels links at address.  Returns NULL on
+ * failure, with errno set. */
+struct channel_listener *new_channel_listener(const char *address,
+                                              size_t num_channels)
+{
+        enum transport transport;
+        char rest[256];
+
+        if (parse_address(address, &transport, rest, sizeof(rest)) == -1)
+                return NULL;
+
+        struct channel_listener *self = calloc(1, sizeof(struct channel_listener));
+        if (self == NULL)
+                return NULL;
+
+        self->fd = -1;
+        self->num_channels = num_channels;
+        strncpy(self->address, address, sizeof(self->address) - 1);
+
+        if (transport != TRANSPORT_SHM) {
+                if (transport == TRANSPORT_UNIX)
+                        unlink(rest);
+                if ((self->fd = open_socket(transport, rest, true)) == -1
+                    || listen(self->fd, (int) num_channels) == -1) {
+                        delete_channel_listener(self);
+                        return NULL;
+                }
+                return self;
+        }
+
+        /* A segment left behind by a run that crashed is replaced. */
+        shm_unlink(rest);
+        const int fd = shm_open(rest, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd == -1) {
+                delete_channel_listener(self);
+                return NULL;
+        }
+        self->shm_size = shm_size(num_channels);
+        if (ftruncate(fd, (off_t) self->shm_size) == -1) {
+                close(fd);
+                delete_channel_listener(self);
+                return NULL;
+        }
+        self->shm = mmap(NULL, self->shm_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+        close(fd);
+        if (self->shm == MAP_FAILED) {
+                self->shm = NULL;
+                delete_channel_listener(self);
+                return NULL;
+        }
+
+        struct shm_header *header = self->shm;
+        header->num_channels = num_channels;
+        for (size_t k = 0; k < num_channels; k++)
+                shm_mailbox(self->shm, 2*k + 1)->writer = getpid();
+        __atomic_store_n(&header->magic, shm_magic, __ATOMIC_RELEASE);
+
+        return self;
+}
+
+void delete_channel_listener(struct channel_listener *self)
+{
+        enum transport transport;
+        char rest[256];
+
+        assert(self != NULL);
+
+        parse_address(self->address, &transport, rest, sizeof(rest));
+
+        if (self->fd != -1) {
+                close(self->fd);
+                if (transport == TRANSPORT_UNIX)
+                        unlink(rest);
+        }
+        if (self->shm != NULL) {
+                /* Links never accepted are closed too, so that the
+                 * processes that joined them do not wait for ever. */
+                for (size_t k = 0; k < self->num_channels; k++)
+                        __atomic_store_n(&shm_mailbox(self->shm, 2*k + 1)->closed,
+                                         1, __ATOMIC_RELEASE);
+                munmap(self->shm, self->shm_size);
+                shm_unlink(rest);
+        }
+
+        free(self);
+}
+
+/** Accepts the next link.  Over sockets links come in the order the
+ * other processes connect; in shared memory the kth link accepted is
+ * the one joined with index k. */
+int channel_listener_accept(struct channel_listener *self, struct channel *c)
+{
+        assert(self != NULL && c != NULL);
+
+        if (self->num_accepted == self->num_channels) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        c->fd = -1;
+        c->inbox = c->outbox = NULL;
+
+        if (self->shm != NULL) {
+                c->inbox = shm_mailbox(self->shm, 2*self->num_accepted);
+                c->outbox = shm_mailbox(self->shm, 2*self->num_accepted + 1);
+        } else {
+                while ((c->fd = accept(self->fd, NULL, NULL)) == -1)
+                        if (errno != EINTR)
+                                return -1;
+
+                const int one = 1;
+                setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        self->num_accepted++;
+
+        return 0;
+}
+
+
+
+/** Joins the listener at address, as its link number index if it is in
+ * shared memory.  Waits for the listener to appear for a while. */
+int channel_connect(struct channel *c, const char *address, size_t index)
+{
+        enum transport transport;
+        char rest[256];
+
+        assert(c != NULL);
+
+        c->fd = -1;
+        c->inbox = c->outbox = NULL;
+
+        if (parse_address(address, &transport, rest, sizeof(rest)) == -1)
+                return -1;
+
+        const size_t max_retries = (size_t) (connect_timeout*1e9/(double) connect_retry_ns);
+
+        for (size_t retry = 0; retry < max_retries; retry++) {
+                if (transport != TRANSPORT_SHM) {
+                        char copy[256];
+                        strcpy(copy, rest);
+                        if ((c->fd = open_socket(transport, copy, false)) != -1) {
+                                const int one = 1;
+                                setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY,
+                                           &one, sizeof(one));
+                                return 0;
+                        }
+                        if (errno != ENOENT && errno != ECONNREFUSED)
+                                return -1;
+                        pause_before_retry();
+                        continue;
+                }
+
+                const int fd = shm_open(rest, O_RDWR, 0600);
+                struct stat st;
+                if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) {
+                        if (fd != -1)
+                                close(fd);
+                        else if (errno != ENOENT)
+                                return -1;
+                        pause_before_retry();
+                        continue;
+                }
+
+                void *shm = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, 0);
+                close(fd);
+                if (shm == MAP_FAILED)
+                        return -1;
+
+                const struct shm_header *header = shm;
+                if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != shm_magic) {
+                        munmap(shm, (size_t) st.st_size);
+                        pause_before_retry();
+                        continue;
+                }
+                if (index >= header->num_channels
+                    || (size_t) st.st_size < shm_size(header->num_channels)) {
+                        munmap(shm, (size_t) st.st_size);
+                        errno = EINVAL;
+                        return -1;
+                }
+
+                /* The mapping stays for the rest of the process. */
+                c->inbox = shm_mailbox(shm, 2*index + 1);
+                c->outbox = shm_mailbox(shm, 2*index);
+                __atomic_store_n(&c->outbox->writer, getpid(), __ATOMIC_RELEASE);
+                return 0;
+        }
+
+        errno = ETIMEDOUT;
+        return -1;
+}
+
+void channel_close(struct channel *c)
+{
+        assert(c != NULL);
+
+        if (c->fd != -1)
+                close(c->fd);
+        if (c->outbox != NULL)
+                __atomic_store_n(&c->outbox->closed, 1, __ATOMIC_RELEASE);
+        c->fd = -1;
+        c->inbox = c->outbox = NULL;
+}
+
+/** Sends the n values, waiting for the other end to have received the
+ * previous message if in shared memory.  Returns -1 if the link
+ * failed. */
+int channel_send(struct channel *c, const double values[], size_t n)
+{
+        assert(c != NULL && (values != NULL || n == 0));
+
+        if (n > CHANNEL_MAX_VALUES) {
+                errno = EMSGSIZE;
+                return -1;
+        }
+
+        if (c->fd != -1) {
+                /* The length goes first, as a value like the others. */
+                double buffer[n + 1];
+                buffer[0] = (double) n;
+                memcpy(buffer + 1, values, n*sizeof(double));
+                return send_all(c->fd, buffer, sizeof(buffer));
+        }
+
+        struct mailbox *box = c->outbox;
+        const size_t sent = box->sent;
+
+        if (wait_until(c, &box->received, sent) == -1)
+                return -1;
+        box->n = n;
+        memcpy(box->values, values, n*sizeof(double));
+        __atomic_store_n(&box->sent, sent + 1, __ATOMIC_RELEASE);
+
+        return 0;
+}
+
+/** Waits for the next message and stores its values.  Returns their
+ * number, or -1 if the message does not fit or the link failed. */
+long channel_receive(struct channel *c, double values[], size_t max_values)
+{
+        assert(c != NULL);
+
+        size_t n;
+
+        if (c->fd != -1) {
+                double length;
+                if (receive_all(c->fd, &length, sizeof(length)) == -1)
+                        return -1;
+                if (!(length >= 0.0 && length <= CHANNEL_MAX_VALUES)) {
+                        errno = EPROTO;
+                        return -1;
+                }
+
+                n = (size_t) length;
+                double buffer[n + 1];
+                if (receive_all(c->fd, buffer, n*sizeof(double)) == -1)
+                        return -1;
+                if (n > max_values) {
+                        errno = EMSGSIZE;
+                        return -1;
+                }
+                memcpy(values, buffer, n*sizeof(double));
+
+                return (long) n;
+        }
+
+        struct mailbox *box = c->inbox;
+        const size_t received = box->received;
+
+        if (wait_until(c, &box->sent, received + 1) == -1)
+                return -1;
+        n = box->n;
+        if (n <= max_values)
+                memcpy(values, box->values, n*sizeof(double));
+        __atomic_store_n(&box->received, received + 1, __ATOMIC_RELEASE);
+
+        if (n > max_values) {
+                errno = EMSGSIZE;
+                return -1;
+        }
+
+        return (long) n;
+}
+
+
+
+int parse_address(const char *address, enum transport *transport,
+                  char *rest, size_t size)
+{
+        static const struct {
+                const char *prefix;
+                enum transport transport;
+        } prefixes[] = {
+                { "unix:", TRANSPORT_UNIX },
+                { "tcp:", TRANSPORT_TCP },
+                { "shm:", TRANSPORT_SHM }
+        };
+
+        for (size_t k = 0; k < sizeof(prefixes)/sizeof(prefixes[0]); k++) {
+                const size_t length = strlen(prefixes[k].prefix);
+
+                if (strncmp(address, prefixes[k].prefix, length) == 0
+                    && strlen(address + length) < size) {
+                        *transport = prefixes[k].transport;
+                        strcpy(rest, address + length);
+                        return 0;
+                }
+        }
+
+        errno = EINVAL;
+        return -1;
+}
+
+/* Splits HOST:PORT in place.  An empty host or * means any. */
+int split_host_port(char *rest, const char **host, const char **port)
+{
+        char *colon = strrchr(rest, ':');
+
+        if (colon == NULL) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        *colon = '\0';
+        *host = (rest[0] == '\0' || strcmp(rest, "*") == 0) ? NULL : rest;
+        *port = colon + 1;
+
+        return 0;
+}
+
+/* Socket bound to (if listening) or connected to the address. */
+int open_socket(enum transport transport, char *rest, bool listening)
+{
+        int fd = -1;
+
+        if (transport == TRANSPORT_UNIX) {
+                struct sockaddr_un sa;
+
+                memset(&sa, 0, sizeof(sa));
+                sa.sun_family = AF_UNIX;
+                if (strlen(rest) >= sizeof(sa.sun_path)) {
+                        errno = ENAMETOOLONG;
+                        return -1;
+                }
+                strcpy(sa.sun_path, rest);
+
+                if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+                        return -1;
+                const int status = listening
+                        ? bind(fd, (struct sockaddr *) &sa, sizeof(sa))
+                        : connect(fd, (struct sockaddr *) &sa, sizeof(sa));
+                if (status == -1) {
+                        const int saved = errno;
+                        close(fd);
+                        errno = saved;
+                        return -1;
+                }
+                return fd;
+        }
+
+        const char *host, *port;
+        if (split_host_port(rest, &host, &port) == -1)
+                return -1;
+
+        struct addrinfo hints, *list;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = listening ? AI_PASSIVE : 0;
+        if (getaddrinfo(host, port, &hints, &list) != 0) {
+                errno = EHOSTUNREACH;
+                return -1;
+        }
+
+        int saved = ECONNREFUSED;
+        for (struct addrinfo *ai = list; ai != NULL; ai = ai->ai_next) {
+                if ((fd = socket(ai->ai_family, ai->ai_socktype,
+                                 ai->ai_protocol)) == -1)
+                        continue;
+
+                const int one = 1;
+                if (listening)
+                        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+                if ((listening ? bind(fd, ai->ai_addr, ai->ai_addrlen)
+                               : connect(fd, ai->ai_addr, ai->ai_addrlen)) == 0)
+                        break;
+
+                saved = errno;
+                close(fd);
+                fd = -1;
+        }
+        freeaddrinfo(list);
+
+        if (fd == -1)
+                errno = saved;
+
+        return fd;
+}
+
+size_t shm_size(size_t num_channels)
+{
+        return sizeof(struct shm_header)
+                + 2*num_channels*cache_line_round_up(sizeof(struct mailbox));
+}
+
+struct mailbox *shm_mailbox(void *shm, size_t k)
+{
+        return (struct mailbox *) ((char *) shm + sizeof(struct shm_header)
+                                   + k*cache_line_round_up(sizeof(struct mailbox)));
+}
+
+/*
+ * Waits until a counter written by the other end of c reaches value.
+ * Fails with ECONNRESET once the other end has closed the link or its
+ * process is gone, and with ETIMEDOUT if it never joined.
+ */
+int wait_until(const struct channel *c, const size_t *counter, size_t value)
+{
+        const struct mailbox *peer = c->inbox;
+        struct backoff b = { 0 };
+        double waited = 0.0;
+
+        while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < value) {
+                if (__atomic_load_n(&peer->closed, __ATOMIC_ACQUIRE)) {
+                        /* A message may have been left before closing. */
+                        if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) >= value)
+                                break;
+                        errno = ECONNRESET;
+                        return -1;
+                }
+
+                if (backoff_is_sleeping(&b)) {
+                        const pid_t writer = __atomic_load_n(&peer->writer,
+                                                             __ATOMIC_ACQUIRE);
+                        if (writer != 0 && kill(writer, 0) == -1 && errno == ESRCH) {
+                                errno = ECONNRESET;
+                                return -1;
+                        }
+                        if (writer == 0 && waited > connect_timeout) {
+                                errno = ETIMEDOUT;
+                                return -1;
+                        }
+                }
+
+                waited += backoff_pause(&b);
+        }
+
+        return 0;
+}
+
+void pause_before_retry(void)
+{
+        const struct timespec ts = { 0, connect_retry_ns };
+
+        nanosleep(&ts, NULL);
+}
+
+int send_all(int fd, const void *buffer, size_t size)
+{
+        const char *p = buffer;
+
+        while (size > 0) {
+                const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+                if (n == -1 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return -1;
+                p += n;
+                size -= (size_t) n;
+        }
+
+        return 0;
+}
+
+int receive_all(int fd, void *buffer, size_t size)
+{
+        char *p = buffer;
+
+        while (size > 0) {
+                const ssize_t n = recv(fd, p, size, 0);
+                if (n == -1 && errno == EINTR)
+                        continue;
+                if (n == 0)
+                        errno = ECONNRESET;
+                if (n <= 0)
+                        return -1;
+                p += n;
+                size -= (size_t) n;
+        }
+
+        return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+/* Longest message, in values. */
+#define CHANNEL_MAX_VALUES 1024
+
+struct mailbox;
+
+/** One end of a link between two processes that carries messages made
+ * of up to CHANNEL_MAX_VALUES doubles, either over a stream socket or
+ * through a pair of mailboxes in shared memory.  Values travel in the
+ * byte order of the host, so both ends must share it. */
+struct channel {
+        int fd;                         /**< Connected socket, or -1. */
+        struct mailbox *inbox;          /**< Mailboxes if in shared memory. */
+        struct mailbox *outbox;
+};
+
+/** End of the links that accepts the others.  Addresses are of the
+ * form unix:PATH, tcp:HOST:PORT or shm:NAME. */
+struct channel_listener {
+        int fd;                         /**< Listening socket, or -1. */
+        void *shm;                      /**< Shared memory segment otherwise. */
+        size_t shm_size;
+        size_t num_channels;            /**< Links to be accepted. */
+        size_t num_accepted;
+        char address[256];
+};
+
+
+extern struct channel_listener *new_channel_listener(const char *address,
+                                                     size_t num_channels);
+extern void delete_channel_listener(struct channel_listener *self);
+extern int channel_listener_accept(struct channel_listener *self,
+                                   struct channel *c);
+
+extern int channel_connect(struct channel *c, const char *address,
+                           size_t index);
+extern void channel_close(struct channel *c);
+
+extern int channel_send(struct channel *c, const double values[], size_t n);
+extern long channel_receive(struct channel *c, double values[],
+                            size_t max_values);
+
+#endif // !CHANNEL_H
@@ -1,15 +1,13 @@
 #include "molecular-simulator.h"
 
 
-struct contact_map {
-        size_t num_atoms;
-        size_t num_contacts;
-        double d_max;
-        double *distance;
-};
-
-
-static void contact_map_compute(struct contact_map *self, const struct protein *protein);
+static int contact_map_compute(struct contact_map *self, const struct protein *protein);
+static double native_distance(const struct contact_map *self,
+                              const struct protein *protein,
+                              size_t i, size_t j);
+static bool is_row_contact(const struct contact_map *self,
+                           const struct protein *protein,
+                           size_t i, size_t j);
 static void print_contact_map(FILE *stream, const struct contact_map *self);
 
 
@@ -20,7 +18,7 @@ struct contact_map *new_contact_map(const struct protein *protein, double d_max)
 
         struct contact_map *c;
 
-        if ((c = malloc(sizeof(struct contact_map))) == NULL)
+        if ((c = calloc(1, sizeof(struct contact_map))) == NULL)
                 return NULL;
 
         const size_t N = protein->num_atoms;
@@ -28,14 +26,12 @@ struct contact_map *new_contact_map(const struct protein *protein, double d_max)
         c->num_atoms = N;
         c->num_contacts = 0;
         c->d_max = d_max;
-        c->distance = calloc(N*N, sizeof(double));
-        if (c->distance == NULL) {
-                free(c);
+
+        if (contact_map_compute(c, protein) == -1) {
+                delete_contact_map(c);
                 return NULL;
         }
 
-        contact_map_compute(c, protein);
-
         return c;
 }
 
@@ -43,49 +39,153 @@ void delete_contact_map(struct contact_map *self)
 {
         assert(self != NULL);
 
-        if (self->distance)
-                free(self->distance);
+        free(self->angle_distance);
+        free(self->torsion_distance);
+        free(self->first);
+        free(self->second);
+        free(self->distance);
+        free(self->row);
+        free(self->partner);
+        free(self->partner_distance);
         free(self);
 }
 
-
 
-void contact_map_compute(struct contact_map *self,
-                         const struct protein *protein)
+
+/*
+ * Native distance between atoms i and j (signed for atoms three
+ * positions apart) or zero if they are not in contact.
+ */
+double native_distance(const struct contact_map *self,
+                       const struct protein *protein,
+                       size_t i, size_t j)
+{
+        const size_t lo = GSL_MIN(i, j), hi = GSL_MAX(i, j);
+
+        if (hi - lo < 2)
+                return 0.0;
+
+        const double d = protein_distance(protein, lo, hi);
+
+        switch (hi - lo) {
+        case 2:
+                return d;
+        case 3:
+                return protein_signum(protein, lo, hi)*d;
+        default:
+                return d <= self->d_max ? d : 0.0;
+        }
+}
+
+/* Contacts listed in the rows: all but the i,i+3 ones. */
+bool is_row_contact(const struct contact_map *self,
+                    const struct protein *protein,
+                    size_t i, size_t j)
+{
+        return GSL_MAX(i, j) - GSL_MIN(i, j) != 3
+                && native_distance(self, protein, i, j) != 0.0;
+}
+
+/*
+ * The rows of contacts of each atom are independent of each other, so
+ * they are counted and then filled in parallel.  Each contact is
+ * evaluated once from each of its ends, which avoids a transposition
+ * step.
+ */
+int contact_map_compute(struct contact_map *self,
+                        const struct protein *protein)
 {
         assert(self != NULL);
         assert(protein != NULL);
 
         const size_t N = self->num_atoms;
+        size_t i;
 
-        for (size_t i = 0; i < N; i++) {
-                for (size_t j = i+2; j < N; j++) {
-                        double d = protein_distance(protein, i, j);
-
-                        switch (j - i) {
-                        case 2:
-                                self->distance[N*i + j] = d;
-                                /* printf("%u, %u: %f\n", i, j, d); */
-                                ++self->num_contacts;
-                                break;
-                        case 3:
-                                self->distance[N*i + j] = protein_signum(protein, i, j)*d;
-                                /* printf("%u, %u: %f\n", i, j, d); */
-                                ++self->num_contacts;
-                                break;
-                        default:
-                                if (d <= self->d_max) {
-                                        self->distance[N*i + j] = d;
-                                        /* printf("%u, %u: %f\n", i, j, d); */
-                                        ++self->num_contacts;
-                                }
-                                break;
+        self->row = calloc(N + 1, sizeof(size_t));
+        self->angle_distance = calloc(N, sizeof(double));
+        self->torsion_distance = calloc(N, sizeof(double));
+        if (self->row == NULL || self->angle_distance == NULL
+            || self->torsion_distance == NULL)
+                return -1;
+
+#pragma omp parallel for private(i) schedule(dynamic, 64)
+        for (i = 0; i < N; i++) {
+                size_t n = 0;
+                for (size_t j = 0; j < N; j++)
+                        if (is_row_contact(self, protein, i, j))
+                                ++n;
+                self->row[i+1] = n;
+        }
+
+        for (i = 0; i < N; i++)
+                self->row[i+1] += self->row[i];
+
+        const size_t num_entries = self->row[N];
+        self->partner = calloc(num_entries, sizeof(size_t));
+        self->partner_distance = calloc(num_entries, sizeof(double));
+        if (num_entries > 0 && (self->partner == NULL
+                                || self->partner_distance == NULL))
+                return -1;
+
+#pragma omp parallel for private(i) schedule(dynamic, 64)
+        for (i = 0; i < N; i++) {
+                size_t n = self->row[i];
+                for (size_t j = 0; j < N; j++) {
+                        if (!is_row_contact(self, protein, i, j))
+                                continue;
+                        self->partner[n] = j;
+                        self->partner_distance[n] = native_distance(self, protein, i, j);
+                        ++n;
+                }
+                assert(n == self->row[i+1]);
+        }
+
+        self->num_contacts = num_entries/2 + (N > 3 ? N - 3 : 0);
+
+        /* Split the contacts of each atom with atoms after it by class. */
+        self->num_long_range = 0;
+        for (i = 0; i < N; i++)
+                for (size_t n = self->row[i]; n < self->row[i+1]; n++)
+                        if (self->partner[n] > i + 3)
+                                ++self->num_long_range;
+
+        self->first = calloc(self->num_long_range, sizeof(size_t));
+        self->second = calloc(self->num_long_range, sizeof(size_t));
+        self->distance = calloc(self->num_long_range, sizeof(double));
+        if (self->num_long_range > 0 && (self->first == NULL
+                                         || self->second == NULL
+                                         || self->distance == NULL))
+                return -1;
+
+        size_t m = 0;
+        for (i = 0; i < N; i++) {
+                for (size_t n = self->row[i]; n < self->row[i+1]; n++) {
+                        const size_t j = self->partner[n];
+
+                        if (j == i + 2) {
+                                self->angle_distance[i] = self->partner_distance[n];
+                        } else if (j > i + 3) {
+                                self->first[m] = i;
+                                self->second[m] = j;
+                                self->distance[m] = self->partner_distance[n];
+                                ++m;
                         }
                 }
+                if (i + 3 < N)
+                        self->torsion_distance[i] = native_distance(self, protein, i, i+3);
         }
+
+        return 0;
 }
 
-
+
+
+size_t contact_map_get_num_atoms(const struct contact_map *self)
+{
+        assert(self != NULL);
+
+        return self->num_atoms;
+}
 
 size_t contact_map_get_num_contacts(const struct contact_map *self)
 {
@@ -109,17 +209,33 @@ double contact_map_get_distance(const struct contact_map *self,
         assert(i < self->num_atoms);
         assert(j < self->num_atoms);
 
-        const size_t N = self->num_atoms;
+        const size_t lo = GSL_MIN(i, j), hi = GSL_MAX(i, j);
 
-        if (i == j)
+        switch (hi - lo) {
+        case 0:
+        case 1:
                 return 0.0;
-        else if (i < j)
-                return self->distance[N*i + j];
-        else
-                return self->distance[N*j + i];
+        case 2:
+                return self->angle_distance[lo];
+        case 3:
+                return self->torsion_distance[lo];
+        }
+
+        /* Binary search in the (sorted) row of the first atom. */
+        size_t l = self->row[lo], r = self->row[lo+1];
+        while (l < r) {
+                const size_t n = l + (r - l)/2;
+                if (self->partner[n] < hi)
+                        l = n + 1;
+                else
+                        r = n;
+        }
+
+        return (l < self->row[lo+1] && self->partner[l] == hi)
+                ? self->partner_distance[l] : 0.0;
 }
 
-
+
 
 void contact_map_plot(const struct contact_map *self, FILE *gnuplot,
                       const char *title_format, ...)
@@ -153,12 +269,16 @@ void print_contact_map(FILE *stream, const struct contact_map *self)
         const size_t N = self->num_atoms;
 
         for (size_t i = 0; i < N; i++) {
+                size_t n = self->row[i];
                 for (size_t j = 0; j < N; j++) {
-                        double d = contact_map_get_distance(self, i, j);
+                        bool contact = n < self->row[i+1] && self->partner[n] == j;
+                        if (contact)
+                                ++n;
+                        contact = contact || abs((int) i - (int) j) == 3;
                         if (abs((int) i - (int) j) < 2)
                                 fputs("0 ", stream);
                         else
-                                fputs(d != 0.0 ? "0 " : "1 ", stream);
+                                fputs(contact ? "0 " : "1 ", stream);
                 }
                 fputs("\n", stream);
         }
@@ -171,15 +291,29 @@ int contact_map_diff(const struct contact_map *m1, const struct contact_map *m2)
 
         const size_t N = m1->num_atoms;
 
+        /* Merge the (sorted) rows of both maps. */
         for (size_t i = 0; i < N; i++) {
-                for (size_t j = i+2; j < N; j++) {
-                        double d1 = contact_map_get_distance(m1, i, j);
-                        double d2 = contact_map_get_distance(m2, i, j);
-
-                        if (d1 != 0.0 && d2 == 0.0)
-                                printf("contact between %u and %u is not present in the second map\n", i, j);
-                        if (d1 == 0.0 && d2 != 0.0)
-                                printf("contact between %u and %u is not present in the first map\n", i, j);
+                size_t n1 = m1->row[i], n2 = m2->row[i];
+                const size_t e1 = m1->row[i+1], e2 = m2->row[i+1];
+
+                while (n1 < e1 || n2 < e2) {
+                        const size_t j1 = n1 < e1 ? m1->partner[n1] : N;
+                        const size_t j2 = n2 < e2 ? m2->partner[n2] : N;
+
+                        if (j1 == j2) {
+                                ++n1, ++n2;
+                                continue;
+                        }
+
+                        if (j1 < j2) {
+                                if (j1 > i + 1)
+                                        printf("contact between %u and %u is not present in the second map\n", i, j1);
+                                ++n1;
+                        } else {
+                                if (j2 > i + 1)
+                                        printf("contact between %u and %u is not present in the first map\n", i, j2);
+                                ++n2;
+                        }
                 }
         }
 
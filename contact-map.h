@@ -3,13 +3,37 @@
 
 struct protein;
 
-struct contact_map;
+/** Native contacts of a protein.  Every pair of atoms two and three
+ * positions apart along the chain is a contact, so those two classes
+ * are stored as plain arrays indexed by their first atom.  The
+ * remaining (long range) contacts are stored as a list of pairs sorted
+ * by first and second atom.  Additionally, the contacts of each atom
+ * other than the (signed) i,i+3 ones are listed in compressed sparse
+ * row form, sorted by partner. */
+struct contact_map {
+        size_t num_atoms;
+        size_t num_contacts;
+        double d_max;
+
+        double *angle_distance;   /**< Native distance between atoms i and i+2. */
+        double *torsion_distance; /**< Native signed distance between atoms i and i+3. */
+
+        size_t num_long_range;  /**< Number of contacts (i, j) with j > i+3. */
+        size_t *first;          /**< First atom of each long range contact. */
+        size_t *second;         /**< Second atom of each long range contact. */
+        double *distance;       /**< Native distance of each long range contact. */
+
+        size_t *row;            /**< Contacts of atom i are in [row[i], row[i+1]). */
+        size_t *partner;        /**< Other atom of each contact. */
+        double *partner_distance; /**< Native distance of each contact. */
+};
 
 
 extern struct contact_map *new_contact_map(const struct protein *protein,
                                            double d_max);
 extern void delete_contact_map(struct contact_map *self);
 
+extern size_t contact_map_get_num_atoms(const struct contact_map *self);
 extern size_t contact_map_get_num_contacts(const struct contact_map *self);
 extern double contact_map_get_d_max(const struct contact_map *self);
 
@@ -0,0 +1,263 @@
+#include "molecular-simulator.h"
+
+
+static int coordinator_handshake(struct coordinator *self);
+static int send_temperatures(struct coordinator *self, bool go_on);
+static int receive_energies(struct coordinator *self);
+
+
+/** Waits for num_groups groups to join at address and gives them the
+ * temperatures, in the order of their indices.  Between them the
+ * groups must have as many replicas as there are temperatures.
+ * Exchanges are decided with stream 0 of seed.  Returns NULL on
+ * failure. */
+struct coordinator *new_coordinator(const char *address, size_t num_groups,
+                                    const double temperatures[],
+                                    size_t num_temperatures,
+                                    unsigned long seed)
+{
+        if (address == NULL || num_groups == 0 || temperatures == NULL
+            || num_temperatures < num_groups)
+                return NULL;
+
+        struct coordinator *self = calloc(1, sizeof(struct coordinator));
+        if (self == NULL)
+                return NULL;
+
+        const size_t n = num_temperatures;
+        self->num_groups = num_groups;
+        self->num_temperatures = n;
+        self->channel = calloc(num_groups, sizeof(struct channel));
+        self->first = calloc(num_groups + 1, sizeof(size_t));
+        self->temperature = malloc(n*sizeof(double));
+        self->holder = malloc(n*sizeof(size_t));
+        self->energy = calloc(n, sizeof(double));
+        self->exchanges = calloc(n, sizeof(size_t));
+        self->total = calloc(n, sizeof(size_t));
+        self->rng = gsl_rng_alloc(random_stream_philox);
+        if (self->channel == NULL || self->first == NULL
+            || self->temperature == NULL || self->holder == NULL
+            || self->energy == NULL || self->exchanges == NULL
+            || self->total == NULL || self->rng == NULL) {
+                delete_coordinator(self);
+                return NULL;
+        }
+
+        for (size_t g = 0; g < num_groups; g++)
+                self->channel[g].fd = -1;
+        memcpy(self->temperature, temperatures, n*sizeof(double));
+        for (size_t t = 0; t < n; t++)
+                self->holder[t] = t;
+        random_stream_set(self->rng, seed, 0);
+
+        self->listener = new_channel_listener(address, num_groups);
+        if (self->listener == NULL || coordinator_handshake(self) == -1) {
+                const int saved = errno;
+                delete_coordinator(self);
+                errno = saved;
+                return NULL;
+        }
+
+        return self;
+}
+
+/*
+ * Accepts every group, places its link at its index and hands out the
+ * temperatures: replica r of the run starts at the rth.
+ */
+int coordinator_handshake(struct coordinator *self)
+{
+        size_t size[self->num_groups];
+        bool joined[self->num_groups];
+
+        memset(joined, 0, sizeof(joined));
+
+        for (size_t k = 0; k < self->num_groups; k++) {
+                struct channel c;
+                double hello[2];
+
+                if (channel_listener_accept(self->listener, &c) == -1)
+                        return -1;
+                if (channel_receive(&c, hello, 2) != 2) {
+                        const int saved = errno;
+                        channel_close(&c);
+                        errno = saved;
+                        return -1;
+                }
+
+                const size_t g = (size_t) hello[0];
+                if (hello[0] < 0.0 || g >= self->num_groups || joined[g]
+                    || hello[1] < 1.0 || hello[1] >= CHANNEL_MAX_VALUES) {
+                        channel_close(&c);
+                        errno = EPROTO;
+                        return -1;
+                }
+                joined[g] = true;
+                size[g] = (size_t) hello[1];
+                self->channel[g] = c;
+        }
+
+        for (size_t g = 0; g < self->num_groups; g++)
+                self->first[g + 1] = self->first[g] + size[g];
+        if (self->first[self->num_groups] != self->num_temperatures) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        if (send_temperatures(self, true) == -1)
+                return -1;
+
+        self->joined = true;
+
+        return 0;
+}
+
+void delete_coordinator(struct coordinator *self)
+{
+        assert(self != NULL);
+
+        /* Groups that joined a failed handshake are not waiting for a
+         * block to end: closing their links is enough. */
+        if (self->joined && !self->stopped)
+                coordinator_stop(self);
+
+        if (self->channel != NULL)
+                for (size_t g = 0; g < self->num_groups; g++)
+                        channel_close(&self->channel[g]);
+        if (self->listener != NULL)
+                delete_channel_listener(self->listener);
+        if (self->rng != NULL)
+                gsl_rng_free(self->rng);
+
+        free(self->channel);
+        free(self->first);
+        free(self->temperature);
+        free(self->holder);
+        free(self->energy);
+        free(self->exchanges);
+        free(self->total);
+        free(self);
+}
+
+
+
+/** Decides the exchanges of num_rounds exchange points.  As in the
+ * asynchronous mode of replicas.c, pairs of neighbouring temperatures
+ * are attempted on alternate rounds.  Returns -1 if a group is lost. */
+int coordinator_run(struct coordinator *self, size_t num_rounds)
+{
+        assert(self != NULL && self->joined && !self->stopped);
+
+        for (size_t r = 0; r < num_rounds; r++, self->round++) {
+                if (receive_energies(self) == -1)
+                        return -1;
+
+                for (size_t t = self->round % 2; t + 1 < self->num_temperatures; t += 2) {
+                        const size_t i = self->holder[t], j = self->holder[t + 1];
+                        const double DU = self->energy[j] - self->energy[i];
+                        const double DB = 1.0/self->temperature[t + 1]
+                                - 1.0/self->temperature[t];
+
+                        if (gsl_rng_uniform(self->rng) < exp(DB*DU)) {
+                                self->holder[t] = j;
+                                self->holder[t + 1] = i;
+                                ++self->exchanges[t];
+                        }
+                        ++self->total[t];
+                }
+
+                if (send_temperatures(self, true) == -1)
+                        return -1;
+        }
+
+        return 0;
+}
+
+/** Lets the groups finish their current block of sweeps and stops
+ * them. */
+int coordinator_stop(struct coordinator *self)
+{
+        assert(self != NULL && self->joined && !self->stopped);
+
+        self->stopped = true;
+
+        if (receive_energies(self) == -1)
+                return -1;
+
+        return send_temperatures(self, false);
+}
+
+void coordinator_print_info(const struct coordinator *self, FILE *stream)
+{
+        for (size_t t = 0; t + 1 < self->num_temperatures; t++) {
+                /* Not a number until the pair has been attempted. */
+                const double ratio = self->total[t] == 0 ? GSL_NAN
+                        : (double) self->exchanges[t]/(double) self->total[t];
+
+                fprintf(stream, "ratio of exchanges between temperatures "
+                        "%2.2f and %2.2f: %2.2f\n", self->temperature[t],
+                        self->temperature[t + 1], ratio);
+        }
+        fflush(stream);
+}
+
+int receive_energies(struct coordinator *self)
+{
+        for (size_t g = 0; g < self->num_groups; g++) {
+                const size_t n = self->first[g + 1] - self->first[g];
+
+                if (channel_receive(&self->channel[g], self->energy + self->first[g],
+                                    n) != (long) n)
+                        return -1;
+        }
+
+        return 0;
+}
+
+int send_temperatures(struct coordinator *self, bool go_on)
+{
+        double temperature_of[self->num_temperatures];
+
+        for (size_t t = 0; t < self->num_temperatures; t++)
+                temperature_of[self->holder[t]] = self->temperature[t];
+
+        for (size_t g = 0; g < self->num_groups; g++) {
+                const size_t n = self->first[g + 1] - self->first[g];
+                double message[n + 1];
+
+                message[0] = go_on ? 1.0 : 0.0;
+                memcpy(message + 1, temperature_of + self->first[g],
+                       n*sizeof(double));
+                if (channel_send(&self->channel[g], message, go_on ? n + 1 : 1) == -1)
+                        return -1;
+        }
+
+        return 0;
+}
+
+
+
+/** Joins the coordinator at address as the given group, with
+ * num_replicas replicas, and stores the temperatures they start at. */
+int coordinator_join(struct channel *c, const char *address, size_t group,
+                     size_t num_replicas, double temperatures[])
+{
+        assert(c != NULL && num_replicas > 0 && temperatures != NULL);
+
+        const double hello[2] = { (double) group, (double) num_replicas };
+        double message[num_replicas + 1];
+
+        if (channel_connect(c, address, group) == -1)
+                return -1;
+
+        if (channel_send(c, hello, 2) == -1
+            || channel_receive(c, message, num_replicas + 1) != (long) num_replicas + 1
+            || message[0] != 1.0) {
+                channel_close(c);
+                return -1;
+        }
+
+        memcpy(temperatures, message + 1, num_replicas*sizeof(double));
+
+        return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
+struct channel_listener;
+
+/** Coordinator of a replica exchange run spread over several processes
+ * (groups), each running some of the replicas.  Replicas do not travel
+ * between processes: at every exchange point the groups send the
+ * energies of their replicas and the coordinator, which alone decides
+ * the exchanges, answers with the temperature each replica is to go on
+ * at.
+ *
+ * Every message is an array of doubles (see channel.h):
+ *   group -> coordinator, on joining: group index, number of replicas;
+ *   group -> coordinator, at every exchange point: their energies;
+ *   coordinator -> group: 1 and their temperatures, or 0 to stop.
+ */
+struct coordinator {
+        struct channel_listener *listener;
+        size_t num_groups;
+        struct channel *channel;        /**< Link to each group. */
+        size_t *first;                  /**< First replica of each group, and one past the last. */
+        size_t num_temperatures;
+        double *temperature;            /**< Ladder, increasing. */
+        size_t *holder;                 /**< Replica at each temperature. */
+        double *energy;                 /**< Energy of each replica. */
+        size_t *exchanges;              /**< Exchanges per pair of temperatures. */
+        size_t *total;                  /**< Attempts per pair of temperatures. */
+        size_t round;                   /**< Exchange points so far. */
+        bool joined;                    /**< Whether every group was given its temperatures. */
+        bool stopped;
+        gsl_rng *rng;
+};
+
+
+extern struct coordinator *new_coordinator(const char *address,
+                                           size_t num_groups,
+                                           const double temperatures[],
+                                           size_t num_temperatures,
+                                           unsigned long seed);
+extern void delete_coordinator(struct coordinator *self);
+
+extern int coordinator_run(struct coordinator *self, size_t num_rounds);
+extern int coordinator_stop(struct coordinator *self);
+extern void coordinator_print_info(const struct coordinator *self,
+                                   FILE *stream);
+
+extern int coordinator_join(struct channel *c, const char *address,
+                            size_t group, size_t num_replicas,
+                            double temperatures[]);
+
+#endif // !COORDINATOR_H
@@ -9,13 +9,17 @@ int main(int argc, char *argv[])
         set_prog_name("eval-potential");
 
         char *reference = NULL;
-        double d_max = 0.0, a = 0.0;
+        char *table = NULL;
+        struct go_potential g = { .family = GO_SQUARE_WELL, .a = 0.0 };
+        double d_max = 0.0;
 
         while (true) {
                 struct option cmd_options[] = {
                         {"reference", required_argument, NULL, 'r'},
                         {"dmax", required_argument, NULL, 'd'},
                         {"a", required_argument, NULL, 'a'},
+                        {"potential", required_argument, NULL, 'u'},
+                        {"table", required_argument, NULL, 'b'},
                         {"help", no_argument, NULL, 'h'},
                         {0, 0, 0, 0}
                 };
@@ -32,7 +36,14 @@ int main(int argc, char *argv[])
                         d_max = atof(optarg);
                         break;
                 case 'a':
-                        a = atof(optarg);
+                        g.a = atof(optarg);
+                        break;
+                case 'u':
+                        if (go_potential_parse_family(optarg, &g.family) != 0)
+                                die_printf("Unknown potential `%s'.\n", optarg);
+                        break;
+                case 'b':
+                        table = optarg;
                         break;
                 case 'h':
                         print_usage();
@@ -40,10 +51,21 @@ int main(int argc, char *argv[])
                 }
         }
 
-        if (reference == NULL || d_max <= 0.0 || a <= 0.0 || optind == argc) {
+        if (reference == NULL || d_max <= 0.0 || optind == argc
+            || (g.a <= 0.0 && g.family != GO_LENNARD_JONES)
+            || (table == NULL && g.family == GO_TABULATED)) {
                 print_usage();
                 exit(EXIT_FAILURE);
         }
+
+        size_t line_number;
+        if (table != NULL
+            && (g.table = go_spline_read_file(table, &line_number)) == NULL) {
+                if (line_number > 0)
+                        die_printf("%s:%zu: expected \"dr U\", with dr increasing.\n",
+                                   table, line_number);
+                die_printf("Unable to read the potential table `%s'.\n", table);
+        }
         
         struct protein *p1, *p2;
         struct contact_map *m1, *m2;
@@ -66,13 +88,15 @@ int main(int argc, char *argv[])
 
         contact_map_diff(m1, m2);
 
-        printf("%f\n", potential(p2, m1, a));
+        potential_set_num_threads((int) threading_num_cores());
+        printf("%f\n", potential(p2, m1, &g));
 
         exit(EXIT_SUCCESS);
 }
 
 void print_usage(void)
 {
-        printf("Usage: %s --reference FILE --dmax VALUE "
-               "--a VALUE FILE\n", get_prog_name());
+        printf("Usage: %s --reference FILE --dmax VALUE --a VALUE "
+               "[--potential square-well|lj-12-10|gaussian|tabulated] "
+               "[--table FILE] FILE\n", get_prog_name());
 }
@@ -1,105 +1,96 @@
 #include "molecular-simulator.h"
 
 
-static void make_random_unit_quaternion(gsl_vector *Q, gsl_rng *rng);
-static void make_rotation_matrix_from_unit_quaternion(const gsl_vector *Q,
-                                                      double R[3][3]);
+static void make_random_unit_quaternion(double q[4], gsl_rng *rng);
 
-void cross_product(const gsl_vector *u,
-                   const gsl_vector *v,
-                   gsl_vector *product)
-{
-        const double p1 = gsl_vector_get(u, 1)*gsl_vector_get(v, 2)
-                - gsl_vector_get(u, 2)*gsl_vector_get(v, 1);
-
-        const double p2 = gsl_vector_get(u, 2)*gsl_vector_get(v, 0)
-                - gsl_vector_get(u, 0)*gsl_vector_get(v, 2);
-
-        const double p3 = gsl_vector_get(u, 0)*gsl_vector_get(v, 1)
-                - gsl_vector_get(u, 1)*gsl_vector_get(v, 0);
-
-        gsl_vector_set(product, 0, p1);
-        gsl_vector_set(product, 1, p2);
-        gsl_vector_set(product, 2, p3);
-}
 
-double triple_scalar_product(const gsl_vector *u,
-                             const gsl_vector *v,
-                             const gsl_vector *w)
+/** Returns the sign (+1 or -1) of the torsion defined by four
+ * consecutive points of a chain. */
+double chirality(const real p0[3], const real p1[3],
+                 const real p2[3], const real p3[3])
 {
-        double space[3], result;
-        gsl_block b = block_init(3, space);
-        gsl_vector vxw = vector_init(b, 0, 3, 1);
-
-        cross_product(v, w, &vxw);
-        gsl_blas_ddot(u, &vxw, &result);
+        double u[3], v[3], w[3];
+        for (size_t k = 0; k < 3; k++) {
+                u[k] = p1[k] - p0[k];
+                v[k] = p2[k] - p1[k];
+                w[k] = p3[k] - p2[k];
+        }
 
-        return result;
+        /* XXX Should we check that this is not zero? */
+        return signbit(vec3_triple(u, v, w)) != 0 ? -1.0 : 1.0;
 }
 
 void make_random_rotation_matrix(double R[3][3], gsl_rng *rng)
 {
-        declare_stack_allocated_vector(Q, 4);
-        make_random_unit_quaternion(Q, rng);
+        double q[4];
 
-        make_rotation_matrix_from_unit_quaternion(Q, R);
+        make_random_unit_quaternion(q, rng);
+        mat3_from_quaternion(R, q);
 }
 
-void make_random_unit_quaternion(gsl_vector *Q, gsl_rng *rng)
+/** Unit quaternion of a rotation by an angle uniformly distributed in
+ * [-max_angle, max_angle] about a uniformly distributed axis.  From
+ * max_angle = M_PI on, it is that of a uniformly distributed rotation.
+ * Movements that turn a single vector apply it as it is (see
+ * rotate_by_quaternion()). */
+void make_bounded_rotation_quaternion(double q[4], gsl_rng *rng,
+                                      double max_angle)
 {
-        /* This comes from Graphics Gems III p. 129. */
-        for (size_t i = 0; i < 4; i++)
-                gsl_vector_set(Q, i, gsl_ran_ugaussian(rng));
-        vector_normalize(Q);
+        if (max_angle >= M_PI) {
+                make_random_unit_quaternion(q, rng);
+                return;
+        }
+
+        const double theta = max_angle*(2.0*gsl_rng_uniform(rng) - 1.0);
+
+        /* Uniform on the sphere: z and the azimuth are uniform. */
+        const double z = 2.0*gsl_rng_uniform(rng) - 1.0;
+        const double phi = 2.0*M_PI*gsl_rng_uniform(rng);
+        const double rho = sqrt(1.0 - z*z);
+        const double axis[3] = { rho*cos(phi), rho*sin(phi), z };
+
+        q[0] = cos(0.5*theta);
+        for (size_t i = 0; i < 3; i++)
+                q[i + 1] = sin(0.5*theta)*axis[i];
 }
 
-void make_rotation_matrix_from_unit_quaternion(const gsl_vector *Q,
-                                               double R[3][3])
+/*
+ * Uniformly distributed unit quaternion from three uniforms, with no
+ * rejection (Shoemake, Graphics Gems III p. 129).
+ */
+void make_random_unit_quaternion(double q[4], gsl_rng *rng)
 {
-        R[0][0] = gsl_pow_2(gsl_vector_get(Q, 0))
-                + gsl_pow_2(gsl_vector_get(Q, 1))
-                - gsl_pow_2(gsl_vector_get(Q, 2))
-                - gsl_pow_2(gsl_vector_get(Q, 3));
-        R[0][1] = 2.0*(gsl_vector_get(Q, 1)*gsl_vector_get(Q, 2)
-                       + gsl_vector_get(Q, 0)*gsl_vector_get(Q, 3));
-        R[0][2] = 2.0*(gsl_vector_get(Q, 1)*gsl_vector_get(Q, 3)
-                       - gsl_vector_get(Q, 0)*gsl_vector_get(Q, 2));
-
-        R[1][0] = 2.0*(gsl_vector_get(Q, 1)*gsl_vector_get(Q, 2)
-                       - gsl_vector_get(Q, 0)*gsl_vector_get(Q, 3));
-        R[1][1] = gsl_pow_2(gsl_vector_get(Q, 0))
-                - gsl_pow_2(gsl_vector_get(Q, 1))
-                + gsl_pow_2(gsl_vector_get(Q, 2))
-                - gsl_pow_2(gsl_vector_get(Q, 3));
-        R[1][2] = 2.0*(gsl_vector_get(Q, 2)*gsl_vector_get(Q, 3)
-                       + gsl_vector_get(Q, 0)*gsl_vector_get(Q, 1));
-
-        R[2][0] = 2.0*(gsl_vector_get(Q, 1)*gsl_vector_get(Q, 3)
-                       + gsl_vector_get(Q, 0)*gsl_vector_get(Q, 2));
-        R[2][1] = 2.0*(gsl_vector_get(Q, 2)*gsl_vector_get(Q, 3)
-                       - gsl_vector_get(Q, 0)*gsl_vector_get(Q, 1));
-        R[2][2] = gsl_pow_2(gsl_vector_get(Q, 0))
-                - gsl_pow_2(gsl_vector_get(Q, 1))
-                - gsl_pow_2(gsl_vector_get(Q, 2))
-                + gsl_pow_2(gsl_vector_get(Q, 3));
+        const double u = gsl_rng_uniform(rng);
+        const double t1 = 2.0*M_PI*gsl_rng_uniform(rng);
+        const double t2 = 2.0*M_PI*gsl_rng_uniform(rng);
+        const double r1 = sqrt(1.0 - u), r2 = sqrt(u);
+
+        q[0] = r2*cos(t2);
+        q[1] = r1*sin(t1);
+        q[2] = r1*cos(t1);
+        q[3] = r2*sin(t2);
 }
 
 /** Rotates point b around point a using the rotation matrix R. */
-void rotate(bool transpose, const gsl_matrix *R, const gsl_vector *a, gsl_vector *b)
+void rotate(bool transpose, const double R[3][3],
+            const real a[3], real b[3])
 {
-        declare_stack_allocated_vector(v, 3);
-        gsl_vector_memcpy(v, b);
-        gsl_vector_sub(v, a);
+        double v[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
 
-        /* Rotate end vector. */
-        declare_stack_allocated_vector(w, 3);
-        gsl_blas_dgemv(transpose == false ? CblasNoTrans : CblasTrans, 1.0, R, v, 0.0, w);
+        /* Rotate end vector and update position. */
+        mat3_apply(v, transpose, R, v);
+        for (size_t i = 0; i < 3; i++)
+                b[i] = (real) (a[i] + v[i]);
+}
 
-        /* Update position. */
-        gsl_vector_memcpy(b, a);
-        gsl_vector_add(b, w);
+/** Rotates point b around point a by the unit quaternion q. */
+void rotate_by_quaternion(const double q[4], const real a[3], real b[3])
+{
+        double v[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
 
-        assert(gsl_fcmp(gsl_blas_dnrm2(v), gsl_blas_dnrm2(w), 1e-15) == 0);
+        quaternion_apply(v, q, v);
+        for (size_t i = 0; i < 3; i++)
+                b[i] = (real) (a[i] + v[i]);
 }
 
 int print_matrix(FILE *stream, const gsl_matrix *matrix)
@@ -139,3 +130,8 @@ int print_vector(FILE *stream, const gsl_vector *vector)
 
         return n;
 }
+
+int print_point(FILE *stream, const real point[3])
+{
+        return fprintf(stream, "%g %g %g\n", point[0], point[1], point[2]);
+}
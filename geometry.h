@@ -1,29 +1,27 @@
 #ifndef GEOMETRY_H
 #define GEOMETRY_H
 
-extern void cross_product(const gsl_vector *u, const gsl_vector *v,
-                          gsl_vector *result);
-
-extern double triple_scalar_product(const gsl_vector *u,
-                                    const gsl_vector *v,
-                                    const gsl_vector *w);
+extern double chirality(const real p0[3], const real p1[3],
+                        const real p2[3], const real p3[3]);
 
 extern void make_random_rotation_matrix(double R[3][3], gsl_rng *rng);
+extern void make_bounded_rotation_quaternion(double q[4], gsl_rng *rng,
+                                             double max_angle);
 
-extern void rotate(bool transpose, const gsl_matrix *R, const gsl_vector *a, gsl_vector *b);
+extern void rotate(bool transpose, const double R[3][3],
+                   const real a[3], real b[3]);
+extern void rotate_by_quaternion(const double q[4], const real a[3], real b[3]);
 
 extern int print_matrix(FILE *stream, const gsl_matrix *matrix);
 
 extern int print_vector(FILE *stream, const gsl_vector *vector);
+extern int print_point(FILE *stream, const real point[3]);
 #if DEBUG_LEVEL > 0
 # define dprint_vector(v) print_vector(stderr, v)
+# define dprint_point(p) print_point(stderr, p)
 #else
 # define dprint_vector(v)
+# define dprint_point(p)
 #endif // DEBUG_LEVEL > 0
 
-static inline void vector_normalize(gsl_vector *v)
-{
-        gsl_vector_scale(v, 1.0/gsl_blas_dnrm2(v));
-}
-
 #endif // !GEOMETRY_H
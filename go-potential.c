@@ -0,0 +1,191 @@
+#include "molecular-simulator.h"
+
+
+static const char *family_names[] = {
+        [GO_SQUARE_WELL] = "square-well",
+        [GO_LENNARD_JONES] = "lj-12-10",
+        [GO_GAUSSIAN] = "gaussian",
+        [GO_TABULATED] = "tabulated"
+};
+
+
+/** Sets family from its name.  Returns -1 if the name is unknown. */
+int go_potential_parse_family(const char *name,
+                              enum go_potential_family *family)
+{
+        for (size_t k = 0; k < sizeof(family_names)/sizeof(family_names[0]); k++) {
+                if (strcmp(name, family_names[k]) == 0) {
+                        *family = (enum go_potential_family) k;
+                        return 0;
+                }
+        }
+
+        return -1;
+}
+
+const char *go_potential_family_name(enum go_potential_family family)
+{
+        return family_names[family];
+}
+
+
+
+/*
+ * Extrema of the spline: its values at the knots and at the critical
+ * points inside each interval (roots of b + 2 c t + 3 d t^2), as well
+ * as zero, its value outside the table.
+ */
+static void spline_range(struct go_spline *s, const double *h)
+{
+        s->min = s->max = 0.0;
+
+        for (size_t i = 0; i < s->n; i++) {
+                s->min = GSL_MIN(s->min, s->y[i]);
+                s->max = GSL_MAX(s->max, s->y[i]);
+        }
+
+        for (size_t i = 0; i + 1 < s->n; i++) {
+                const double A = 3.0*s->d[i], B = 2.0*s->c[i], C = s->b[i];
+                double t[2];
+                size_t m = 0;
+
+                if (A == 0.0) {
+                        if (B != 0.0)
+                                t[m++] = -C/B;
+                } else {
+                        const double disc = B*B - 4.0*A*C;
+                        if (disc >= 0.0) {
+                                t[m++] = (-B + sqrt(disc))/(2.0*A);
+                                t[m++] = (-B - sqrt(disc))/(2.0*A);
+                        }
+                }
+
+                for (size_t k = 0; k < m; k++) {
+                        if (t[k] <= 0.0 || t[k] >= h[i])
+                                continue;
+                        const double y = go_spline_eval(s, s->x[i] + t[k]);
+                        s->min = GSL_MIN(s->min, y);
+                        s->max = GSL_MAX(s->max, y);
+                }
+        }
+}
+
+/** Creates the natural cubic spline through the n points (x[i], y[i]).
+ * The abscissae must be strictly increasing. */
+struct go_spline *new_go_spline(size_t n, const double *x, const double *y)
+{
+        if (n < 2 || x == NULL || y == NULL)
+                return NULL;
+        for (size_t i = 1; i < n; i++)
+                if (x[i] <= x[i-1])
+                        return NULL;
+
+        struct go_spline *s = malloc(sizeof(struct go_spline));
+        double *v = calloc(5*n, sizeof(double));
+        double *h = calloc(2*n, sizeof(double));
+        if (s == NULL || v == NULL || h == NULL) {
+                free(s), free(v), free(h);
+                return NULL;
+        }
+
+        s->n = n;
+        s->x = v, s->y = v + n, s->b = v + 2*n, s->c = v + 3*n, s->d = v + 4*n;
+        memcpy(s->x, x, n*sizeof(double));
+        memcpy(s->y, y, n*sizeof(double));
+
+        /*
+         * Solve the tridiagonal system for the second order coefficients
+         * c[1..n-2] (c[0] = c[n-1] = 0) by forward elimination and back
+         * substitution.
+         */
+        double *mu = h + n;
+        for (size_t i = 0; i + 1 < n; i++)
+                h[i] = x[i+1] - x[i];
+
+        for (size_t i = 1; i + 1 < n; i++) {
+                const double r = 3.0*((y[i+1] - y[i])/h[i] - (y[i] - y[i-1])/h[i-1]);
+                const double diag = 2.0*(h[i-1] + h[i]) - h[i-1]*mu[i-1];
+
+                mu[i] = h[i]/diag;
+                s->c[i] = (r - h[i-1]*s->c[i-1])/diag;
+        }
+
+        for (size_t i = n - 2; i >= 1; i--)
+                s->c[i] -= mu[i]*s->c[i+1];
+
+        for (size_t i = 0; i + 1 < n; i++) {
+                s->b[i] = (y[i+1] - y[i])/h[i] - h[i]*(s->c[i+1] + 2.0*s->c[i])/3.0;
+                s->d[i] = (s->c[i+1] - s->c[i])/(3.0*h[i]);
+        }
+        spline_range(s, h);
+
+        free(h);
+
+        return s;
+}
+
+/** Reads a spline from a file of "dr U" lines, dr increasing.  Lines
+ * starting with # and blank lines are ignored.  Returns NULL on
+ * failure, with *line_number set to the line that could not be read,
+ * or to zero if the fault was not in a line. */
+struct go_spline *go_spline_read_file(const char *name, size_t *line_number)
+{
+        *line_number = 0;
+
+        FILE *f = fopen(name, "r");
+        if (f == NULL)
+                return NULL;
+
+        size_t n = 0, max_n = 0, k = 0;
+        double *x = NULL, *y = NULL;
+        char line[256];
+        bool failed = false;
+
+        while (!failed && fgets(line, sizeof(line), f) != NULL) {
+                ++k;
+                if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+                        continue;
+                if (n == max_n) {
+                        max_n = max_n == 0 ? 64 : 2*max_n;
+                        double *tx = realloc(x, max_n*sizeof(double));
+                        if (tx != NULL)
+                                x = tx;
+                        double *ty = realloc(y, max_n*sizeof(double));
+                        if (ty != NULL)
+                                y = ty;
+                        if (tx == NULL || ty == NULL) {
+                                failed = true;
+                                break;
+                        }
+                }
+
+                char extra;
+                if (sscanf(line, "%lf %lf %c", &x[n], &y[n], &extra) != 2
+                    || (n > 0 && x[n] <= x[n-1])) {
+                        *line_number = k;
+                        errno = EINVAL;
+                        failed = true;
+                        break;
+                }
+                ++n;
+        }
+        fclose(f);
+
+        struct go_spline *s = NULL;
+        if (!failed)
+                s = new_go_spline(n, x, y);
+
+        free(x);
+        free(y);
+
+        return s;
+}
+
+void delete_go_spline(struct go_spline *self)
+{
+        if (self == NULL)
+                return;
+
+        free(self->x);
+        free(self);
+}
@@ -0,0 +1,58 @@
+#ifndef GO_POTENTIAL_H
+#define GO_POTENTIAL_H
+
+/** Shape of the well of every native contact.  All of them reach their
+ * minimum, -1, at the native distance. */
+enum go_potential_family {
+        GO_SQUARE_WELL = 0,     /**< -1 + (dr/a)^2 for |dr| < a, 0 elsewhere. */
+        GO_LENNARD_JONES,       /**< 5 (d/r)^12 - 6 (d/r)^10. */
+        GO_GAUSSIAN,            /**< -exp(-dr^2/(2 a^2)). */
+        GO_TABULATED            /**< Cubic spline through a table of dr, U(dr). */
+};
+
+/** Natural cubic spline.  Outside [x[0], x[n-1]] it is zero. */
+struct go_spline {
+        size_t n;               /**< Number of knots. */
+        double *x;              /**< Abscissae, increasing. */
+        double *y, *b, *c, *d;  /**< Coefficients of each interval. */
+        double min, max;        /**< Range of the spline (zero included). */
+};
+
+/** Go potential: family of the wells and their parameters. */
+struct go_potential {
+        enum go_potential_family family;
+        double a;                       /**< Width of the wells (square well, Gaussian). */
+        const struct go_spline *table;  /**< Table of the tabulated family. */
+};
+
+
+extern int go_potential_parse_family(const char *name,
+                                     enum go_potential_family *family);
+extern const char *go_potential_family_name(enum go_potential_family family);
+
+extern struct go_spline *new_go_spline(size_t n, const double *x,
+                                       const double *y);
+extern struct go_spline *go_spline_read_file(const char *name,
+                                             size_t *line_number);
+extern void delete_go_spline(struct go_spline *self);
+
+static inline double go_spline_eval(const struct go_spline *self, double x)
+{
+        if (x < self->x[0] || x > self->x[self->n-1])
+                return 0.0;
+
+        size_t lo = 0, hi = self->n - 1;
+        while (hi - lo > 1) {
+                const size_t mid = lo + (hi - lo)/2;
+                if (self->x[mid] <= x)
+                        lo = mid;
+                else
+                        hi = mid;
+        }
+
+        const double h = x - self->x[lo];
+
+        return self->y[lo] + h*(self->b[lo] + h*(self->c[lo] + h*self->d[lo]));
+}
+
+#endif // !GO_POTENTIAL_H
@@ -0,0 +1,171 @@
+#include "molecular-simulator.h"
+
+
+/* Iterations of the bisections below: well past double precision. */
+static const size_t bisection_steps = 64;
+
+static void interpolate(const struct ladder_sample samples[], size_t n,
+                        double beta, double *mean, double *variance);
+static double normal_tail(double mu, double sigma, double delta);
+
+
+void ladder_sample_init(struct ladder_sample *self, double temperature)
+{
+        self->temperature = temperature;
+        self->count = 0;
+        self->mean = self->m2 = 0.0;
+}
+
+void ladder_sample_add(struct ladder_sample *self, double energy)
+{
+        const double d = energy - self->mean;
+
+        self->count++;
+        self->mean += d/(double) self->count;
+        self->m2 += d*(energy - self->mean);
+}
+
+double ladder_sample_variance(const struct ladder_sample *self)
+{
+        return self->count > 1 ? self->m2/(double) (self->count - 1) : 0.0;
+}
+
+/*
+ * Mean and variance of the energy at inverse temperature beta, linear
+ * in beta between the samples (sorted by temperature) and constant
+ * beyond them.
+ */
+void interpolate(const struct ladder_sample samples[], size_t n, double beta,
+                 double *mean, double *variance)
+{
+        size_t i = 0;
+        while (i + 1 < n && 1.0/samples[i + 1].temperature >= beta)
+                i++;
+
+        const double b0 = 1.0/samples[i].temperature;
+        if (i + 1 == n || beta >= b0) {
+                *mean = samples[i].mean;
+                *variance = ladder_sample_variance(&samples[i]);
+                return;
+        }
+
+        const double b1 = 1.0/samples[i + 1].temperature;
+        const double w = (b0 - beta)/(b0 - b1);
+
+        *mean = (1.0 - w)*samples[i].mean + w*samples[i + 1].mean;
+        *variance = (1.0 - w)*ladder_sample_variance(&samples[i])
+                + w*ladder_sample_variance(&samples[i + 1]);
+}
+
+/*
+ * E[min(1, exp(-delta X))] for X normal with mean mu and deviation
+ * sigma.  The second term is written so that it cannot overflow when
+ * the tail it weighs is far out.
+ */
+double normal_tail(double mu, double sigma, double delta)
+{
+        if (sigma <= 0.0)
+                return GSL_MIN(1.0, exp(-delta*mu));
+
+        const double below = 0.5*erfc(mu/(sigma*M_SQRT2));
+        const double z = (delta*sigma - mu/sigma)/M_SQRT2;
+
+        double above;
+        if (z < 5.0) {
+                above = 0.5*exp(-delta*mu + 0.5*gsl_pow_2(delta*sigma))*erfc(z);
+        } else {
+                /* erfc(z) ~ exp(-z^2)/(z sqrt(pi)) (1 - 1/(2 z^2)) */
+                above = 0.5*exp(-0.5*gsl_pow_2(mu/sigma))
+                        /(z*sqrt(M_PI))*(1.0 - 0.5/(z*z));
+        }
+
+        return GSL_MIN(1.0, below + above);
+}
+
+/** Acceptance ratio of exchanges between temperatures t1 < t2 that the
+ * samples predict, energies being taken as normally distributed. */
+double ladder_acceptance(const struct ladder_sample samples[], size_t n,
+                         double t1, double t2)
+{
+        assert(samples != NULL && n > 0);
+
+        double U1, U2, v1, v2;
+        interpolate(samples, n, 1.0/t1, &U1, &v1);
+        interpolate(samples, n, 1.0/t2, &U2, &v2);
+
+        return normal_tail(U2 - U1, sqrt(v1 + v2), 1.0/t1 - 1.0/t2);
+}
+
+/** Places temperatures from the lowest to the highest of the samples
+ * (sorted by temperature) so that the acceptance predicted between
+ * neighbours is target, except between the last two where it may be
+ * higher.  Returns the number of temperatures, or zero if more than
+ * max_temperatures would be needed. */
+size_t ladder_place(const struct ladder_sample samples[], size_t n,
+                    double target, double temperatures[],
+                    size_t max_temperatures)
+{
+        assert(samples != NULL && n > 0 && temperatures != NULL);
+        assert(target > 0.0 && target < 1.0);
+
+        const double t_max = samples[n - 1].temperature;
+        double t = samples[0].temperature;
+        size_t m = 0;
+
+        if (max_temperatures == 0)
+                return 0;
+        temperatures[m++] = t;
+
+        while (m < max_temperatures) {
+                if (ladder_acceptance(samples, n, t, t_max) >= target) {
+                        temperatures[m++] = t_max;
+                        return m;
+                }
+
+                /* The acceptance decreases as the gap grows. */
+                double lo = t, hi = t_max;
+                for (size_t i = 0; i < bisection_steps; i++) {
+                        const double mid = 0.5*(lo + hi);
+                        if (ladder_acceptance(samples, n, t, mid) >= target)
+                                lo = mid;
+                        else
+                                hi = mid;
+                }
+                t = temperatures[m++] = lo;
+        }
+
+        return 0;
+}
+
+/** Places num_temperatures temperatures between the extremes of the
+ * samples with the highest acceptance predicted between every pair of
+ * neighbours, which is returned. */
+double ladder_equalize(const struct ladder_sample samples[], size_t n,
+                       double temperatures[], size_t num_temperatures)
+{
+        assert(samples != NULL && n > 0 && temperatures != NULL);
+        assert(num_temperatures >= 2);
+
+        const size_t m = num_temperatures;
+
+        /* The higher the target, the more temperatures it needs. */
+        double lo = 0.0, hi = 1.0;
+        for (size_t i = 0; i < bisection_steps; i++) {
+                const double mid = 0.5*(lo + hi);
+                if (ladder_place(samples, n, mid, temperatures, m) != 0)
+                        lo = mid;
+                else
+                        hi = mid;
+        }
+
+        if (lo == 0.0 || ladder_place(samples, n, lo, temperatures, m) < m) {
+                /* Only if the bisection missed the count: fall back on
+                 * a geometric ladder. */
+                const double t0 = samples[0].temperature;
+                const double r = samples[n - 1].temperature/t0;
+                for (size_t k = 0; k < m; k++)
+                        temperatures[k] = t0*pow(r, (double) k/(double) (m - 1));
+        }
+
+        return lo;
+}
@@ -0,0 +1,26 @@
+#ifndef LADDER_H
+#define LADDER_H
+
+/** Energy statistics of a replica at a fixed temperature: a Gaussian
+ * summary of its energy histogram (Welford's running moments). */
+struct ladder_sample {
+        double temperature;
+        size_t count;
+        double mean;
+        double m2;              /**< Sum of squared deviations from the mean. */
+};
+
+
+extern void ladder_sample_init(struct ladder_sample *self, double temperature);
+extern void ladder_sample_add(struct ladder_sample *self, double energy);
+extern double ladder_sample_variance(const struct ladder_sample *self);
+
+extern double ladder_acceptance(const struct ladder_sample samples[], size_t n,
+                                double t1, double t2);
+extern size_t ladder_place(const struct ladder_sample samples[], size_t n,
+                           double target, double temperatures[],
+                           size_t max_temperatures);
+extern double ladder_equalize(const struct ladder_sample samples[], size_t n,
+                              double temperatures[], size_t num_temperatures);
+
+#endif // !LADDER_H
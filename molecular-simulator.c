@@ -1,8 +1,37 @@
 #include "molecular-simulator.h"
 
+#include <sys/stat.h>
+
+
+/* The ladder is tuned in a few passes, each measuring the energies at
+ * the temperatures of the previous one. */
+static const size_t ladder_passes = 4;
+static const size_t ladder_sweeps = 100000;
+
+/* Exchange points between the coordinator's reports. */
+static const size_t coordinator_report_rounds = 100;
+
+static const size_t thermalization_sweeps = 2500000;
+
+/* Iterations between the reports of a run. */
+static const size_t report_iterations = 100;
+
+/* Most jobs in a batch, and temperatures in one of them. */
+#define MAX_JOBS 256
+#define MAX_JOB_TEMPERATURES 256
 
 static void print_usage(void);
+static unsigned long master_seed(void);
+static struct go_spline *read_table(const char *name);
 static void show_progress(const struct replicas *r, size_t k);
+static void run_coordinator(const char *address, size_t num_groups,
+                            size_t num_rounds,
+                            const struct simulation_options *opts);
+static void run_batch(const char *manifest,
+                      const struct simulation_options *opts,
+                      bool setup_only, bool simulate_only);
+static struct threading plan_batch(struct replicas *jobs[], size_t num_jobs,
+                                   const struct simulation_options *opts);
 
 
 int main(int argc, char *argv[])
@@ -10,13 +39,21 @@ int main(int argc, char *argv[])
         set_prog_name("molecular-simulator");
 
         bool setup_only = false, simulate_only = false, resume = false;
+        bool huge_pages = false, asynchronous = false, tune_ladder = false;
+        bool any_pair = false;
+        double target_acceptance = 0.0;
+        const char *table = NULL;
+        const char *coordinator = NULL, *join = NULL, *batch = NULL;
+        size_t num_groups = 0, group = 0, num_rounds = 0;
         gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
         gsl_rng_env_setup();
-        gsl_rng_set(rng, gsl_rng_default_seed);
+        const unsigned long seed = master_seed();
+        gsl_rng_set(rng, seed);
         const size_t max_temperatures = 256;
         double temperatures[max_temperatures];
         struct simulation_options opts = {
-                .rng = rng, .d_max = 0.0, .a = 0.0,
+                .rng = rng, .seed = seed,
+                .d_max = 0.0, .a = 0.0,
                 .num_replicas = 0, .temperatures = (double *) &temperatures
         };
 
@@ -29,17 +66,38 @@ int main(int argc, char *argv[])
                         {"setup-only", no_argument, (int *) &setup_only, true},
 
                         {"simulate-only", no_argument, (int *) &simulate_only, true},
+                        {"huge-pages", no_argument, (int *) &huge_pages, true},
+                        {"asynchronous", no_argument, (int *) &asynchronous, true},
+                        {"tune-ladder", no_argument, (int *) &tune_ladder, true},
+                        {"exchange-rounds", required_argument, NULL, 'x'},
+                        {"any-pair", no_argument, (int *) &any_pair, true},
+                        {"target-acceptance", required_argument, NULL, 'c'},
+                        {"threads", required_argument, NULL, 'n'},
+                        {"pin", required_argument, NULL, 'i'},
+                        {"potential", required_argument, NULL, 'u'},
+                        {"table", required_argument, NULL, 'b'},
+                        {"coordinator", required_argument, NULL, 'o'},
+                        {"groups", required_argument, NULL, 'G'},
+                        {"rounds", required_argument, NULL, 'R'},
+                        {"join", required_argument, NULL, 'j'},
+                        {"group", required_argument, NULL, 'g'},
+                        {"replicas", required_argument, NULL, 'r'},
+                        {"batch", required_argument, NULL, 'B'},
                         {"help", no_argument, NULL, 'h'},
                         {0, 0, 0, 0}
                 };
 
-                int c = getopt_long_only(argc, argv, "", long_options, NULL);
+                /* The short options keep -t, -d and -a unambiguous next to
+                 * the long options they are prefixes of. */
+                int c = getopt_long_only(argc, argv, "t:d:a:h", long_options, NULL);
 
                 if (c == -1)
                         break;
 
                 switch (c) {
                 case 't':
+                        if (opts.num_replicas == max_temperatures)
+                                die("Too many temperatures.");
                         temperatures[opts.num_replicas++] = atof(optarg);
                         break;
                 case 'd':
@@ -48,23 +106,120 @@ int main(int argc, char *argv[])
                 case 'a':
                         opts.a = atof(optarg);
                         break;
+                case 'n':
+                        opts.num_threads = (size_t) atol(optarg);
+                        break;
+                case 'i':
+                        if (threading_binding_parse(optarg, &opts.binding) != 0)
+                                die_printf("Unknown binding `%s'.\n", optarg);
+                        break;
+                case 'u':
+                        if (go_potential_parse_family(optarg, &opts.family) != 0)
+                                die_printf("Unknown potential `%s'.\n", optarg);
+                        break;
+                case 'b':
+                        table = optarg;
+                        break;
+                case 'c':
+                        target_acceptance = atof(optarg);
+                        tune_ladder = true;
+                        break;
+                case 'x':
+                        opts.exchange_rounds = (size_t) atol(optarg);
+                        break;
+                case 'o':
+                        coordinator = optarg;
+                        break;
+                case 'G':
+                        num_groups = (size_t) atol(optarg);
+                        break;
+                case 'R':
+                        num_rounds = (size_t) atol(optarg);
+                        break;
+                case 'j':
+                        join = optarg;
+                        break;
+                case 'g':
+                        group = (size_t) atol(optarg);
+                        break;
+                case 'r':
+                        opts.num_replicas = (size_t) atol(optarg);
+                        break;
+                case 'B':
+                        batch = optarg;
+                        break;
                 case 'h':
                         print_usage();
                         exit(EXIT_SUCCESS);
                 }
         }
 
-        if (opts.d_max <= 0.0 || opts.a <= 0.0 || opts.num_replicas == 0
+        if (coordinator != NULL) {
+                if (num_groups == 0 || opts.num_replicas < num_groups
+                    || join != NULL || batch != NULL || tune_ladder) {
+                        print_usage();
+                        exit(EXIT_FAILURE);
+                }
+                run_coordinator(coordinator, num_groups, num_rounds, &opts);
+                gsl_rng_free(rng);
+                exit(EXIT_SUCCESS);
+        }
+
+        /* The proteins and their parameters come from the manifest. */
+        if (batch != NULL) {
+                if (resume || asynchronous || tune_ladder || join != NULL
+                    || optind != argc || (setup_only && simulate_only)
+                    || (table == NULL && opts.family == GO_TABULATED)) {
+                        print_usage();
+                        exit(EXIT_FAILURE);
+                }
+                opts.huge_pages = huge_pages;
+                opts.any_pair = any_pair;
+
+                struct go_spline *spline = read_table(table);
+                opts.table = spline;
+
+                run_batch(batch, &opts, setup_only, simulate_only);
+                delete_go_spline(spline);
+                gsl_rng_free(rng);
+                exit(EXIT_SUCCESS);
+        }
+
+        if (opts.d_max <= 0.0 || opts.num_replicas == 0
+            || opts.num_replicas > max_temperatures
+            || (join != NULL && (tune_ladder || setup_only))
+            || (opts.a <= 0.0 && opts.family != GO_LENNARD_JONES)
+            || (table == NULL && opts.family == GO_TABULATED)
+            || target_acceptance < 0.0 || target_acceptance >= 1.0
             || (setup_only && simulate_only))
         {
                 print_usage();
                 exit(EXIT_FAILURE);
         }
 
+        opts.huge_pages = huge_pages;
+        opts.asynchronous = asynchronous;
+        opts.any_pair = any_pair;
+
+        struct go_spline *spline = read_table(table);
+        opts.table = spline;
+
         if (resume && (argc - optind - 1 != (int) opts.num_replicas))
                 die("The number of temperatures does not match "
                     "the number of configuration files.");
 
+        /* A group takes its temperatures from the coordinator, and random
+         * streams no other group uses. */
+        struct channel link;
+        if (join != NULL) {
+                printf("Joining `%s' as group %zu.\n", join, group);
+                if (coordinator_join(&link, join, group, opts.num_replicas,
+                                     temperatures) == -1)
+                        die_printf("Unable to join `%s' (%s).\n", join,
+                                   strerror(errno));
+                opts.stream_offset = (group + 1) << 32;
+        }
+
         struct replicas *r;
         r = new_replicas(protein_read_xyz_file(argv[optind++]), &opts);
         if (r == NULL)
@@ -93,7 +248,14 @@ int main(int argc, char *argv[])
         
         if (!simulate_only) {
                 printf("Running thermalization phase.\n");
-                replicas_thermalize(r, 2500000);
+                replicas_thermalize(r, thermalization_sweeps);
+                if (tune_ladder) {
+                        printf("Tuning the temperature ladder.\n");
+                        for (size_t p = 0; p < ladder_passes; p++)
+                                if ((r = replicas_tune_ladder(r, ladder_sweeps,
+                                                              target_acceptance)) == NULL)
+                                        die("Unable to tune the temperature ladder.");
+                }
                 if (setup_only) {
                         printf("Finished setup phase.\n");
                         exit(EXIT_SUCCESS);
@@ -101,15 +263,29 @@ int main(int argc, char *argv[])
         }
         
         printf("Running production phase.\n");
-        size_t k = 1;
+        if (join != NULL) {
+                if (replicas_run_remote(r, &link) == -1)
+                        die("Lost the coordinator.");
+                channel_close(&link);
+                delete_replicas(r);
+                delete_go_spline(spline);
+                gsl_rng_free(rng);
+                exit(EXIT_SUCCESS);
+        }
+
+        size_t k = 0;
         /* while (replicas_have_not_converged(r)) { */
         while (true) {
-                replicas_next_iteration(r);
+                /* Run up to the next report in one go, so that
+                 * asynchronous replicas are not stopped in between. */
+                const size_t n = k == 0 ? 1 : report_iterations - k % report_iterations;
+                replicas_run(r, n);
+                k += n;
                 show_progress(r, k);
-                ++k;
         }
 
         delete_replicas(r);
+        delete_go_spline(spline);
         gsl_rng_free(rng);
         exit(EXIT_SUCCESS);
 }
@@ -120,17 +296,255 @@ void print_usage(void)
 {
         fprintf(stderr,
                 "Usage: molecular-simulator [--resume] [--setup-only] [--simulate-only] "
+                "[--huge-pages] [--asynchronous] "
+                "[--threads N] [--pin none|cores|spread] "
+                "[--potential square-well|lj-12-10|gaussian|tabulated] "
+                "[--table FILE] "
+                "[--tune-ladder] [--target-acceptance VALUE] "
+                "[--exchange-rounds N] [--any-pair] "
                 "-d VALUE -a VALUE -t VALUE [-t VALUE ...] PROTEIN-FILE "
-                "[CONFORMATION-FILE ...]\n");
+                "[CONFORMATION-FILE ...]\n"
+                "       molecular-simulator --coordinator ADDRESS --groups N "
+                "[--rounds N] -t VALUE [-t VALUE ...]\n"
+                "       molecular-simulator --join ADDRESS --group K --replicas N "
+                "[--resume] [--simulate-only] ... -d VALUE -a VALUE PROTEIN-FILE "
+                "[CONFORMATION-FILE ...]\n"
+                "       molecular-simulator --batch MANIFEST [--setup-only] "
+                "[--simulate-only] [--threads N] ...\n"
+                "ADDRESS is unix:PATH, tcp:HOST:PORT or shm:NAME.\n"
+                "MANIFEST has a job per line: NAME PROTEIN-FILE DMAX A "
+                "ITERATIONS T [T ...].\n");
+}
+
+/*
+ * Master seed of the random streams: GSL_RNG_SEED if it is set, so that
+ * a run can be repeated, or else one from the clock and the process, so
+ * that every run, and every segment of a resumed one, draws numbers of
+ * its own.  Replicas log the seed they were given.
+ */
+unsigned long master_seed(void)
+{
+        if (getenv("GSL_RNG_SEED") != NULL)
+                return gsl_rng_default_seed;
+
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+
+        const unsigned long usec = (unsigned long) tv.tv_sec*1000000UL
+                + (unsigned long) tv.tv_usec;
+        return usec ^ ((unsigned long) getpid() << 44);
+}
+
+/* Spline of the potential table in the named file, if any. */
+struct go_spline *read_table(const char *name)
+{
+        size_t line_number;
+        struct go_spline *s;
+
+        if (name == NULL)
+                return NULL;
+        if ((s = go_spline_read_file(name, &line_number)) == NULL) {
+                if (line_number > 0)
+                        die_printf("%s:%zu: expected \"dr U\", with dr increasing.\n",
+                                   name, line_number);
+                die_printf("Unable to read the potential table `%s'.\n", name);
+        }
+
+        return s;
+}
+
+/*
+ * Decides the exchanges of a run spread over num_groups processes, with
+ * the temperatures of opts, for num_rounds exchange points (until
+ * killed if none), and then stops the groups.
+ */
+void run_coordinator(const char *address, size_t num_groups,
+                     size_t num_rounds, const struct simulation_options *opts)
+{
+        printf("Waiting for %zu groups at `%s' (seed %lu).\n", num_groups,
+               address, opts->seed);
+        struct coordinator *c = new_coordinator(address, num_groups,
+                                                opts->temperatures,
+                                                opts->num_replicas, opts->seed);
+        if (c == NULL)
+                die_printf("Unable to coordinate (%s).\n", strerror(errno));
+
+        while (num_rounds == 0 || c->round < num_rounds) {
+                size_t n = coordinator_report_rounds;
+                if (num_rounds != 0)
+                        n = GSL_MIN(n, num_rounds - c->round);
+                if (coordinator_run(c, n) == -1)
+                        die_printf("Lost a group (%s).\n", strerror(errno));
+                printf("exchange points: %zu\n", c->round);
+                coordinator_print_info(c, stdout);
+        }
+
+        if (coordinator_stop(c) == -1)
+                die_printf("Lost a group (%s).\n", strerror(errno));
+        printf("Stopped the groups after %zu exchange points.\n", c->round);
+        delete_coordinator(c);
+}
+
+/*
+ * Runs the jobs of a manifest, each line of which reads NAME
+ * PROTEIN-FILE DMAX A ITERATIONS T [T ...] (from a `#' on, lines are
+ * comments), with the other options of opts, in a single pool of
+ * threads.  Every job keeps its files in a directory of its own name,
+ * and has its own random streams and exchange generator.  The jobs
+ * advance an iteration at a time each (see replicas_run_batch()), and
+ * leave the pool as soon as they are done.
+ */
+void run_batch(const char *manifest, const struct simulation_options *opts,
+               bool setup_only, bool simulate_only)
+{
+        FILE *f = fopen(manifest, "r");
+        if (f == NULL)
+                die_printf("Unable to open `%s' (%s).\n", manifest, strerror(errno));
+
+        struct replicas *jobs[MAX_JOBS];
+        gsl_rng *rng[MAX_JOBS];
+        size_t iterations[MAX_JOBS];
+        size_t num_jobs = 0, line_number = 0;
+        char line[4096];
+
+        while (fgets(line, sizeof(line), f) != NULL) {
+                ++line_number;
+                line[strcspn(line, "#\n")] = '\0';
+
+                const char *name = strtok(line, " \t");
+                if (name == NULL)
+                        continue;
+                const char *file = strtok(NULL, " \t");
+                const char *d_max = strtok(NULL, " \t");
+                const char *a = strtok(NULL, " \t");
+                const char *iters = strtok(NULL, " \t");
+
+                double temperatures[MAX_JOB_TEMPERATURES];
+                struct simulation_options o = *opts;
+                o.num_replicas = 0;
+                o.temperatures = temperatures;
+                for (const char *t; (t = strtok(NULL, " \t")) != NULL; ) {
+                        if (o.num_replicas == MAX_JOB_TEMPERATURES)
+                                die_printf("%s:%zu: too many temperatures.\n",
+                                           manifest, line_number);
+                        temperatures[o.num_replicas++] = atof(t);
+                }
+                if (o.num_replicas == 0 || atol(iters) <= 0)
+                        die_printf("%s:%zu: expected NAME PROTEIN-FILE DMAX A "
+                                   "ITERATIONS T [T ...].\n", manifest, line_number);
+                if (num_jobs == MAX_JOBS)
+                        die_printf("%s:%zu: too many jobs.\n", manifest, line_number);
+
+                if (mkdir(name, 0777) == -1 && errno != EEXIST)
+                        die_printf("Unable to create `%s' (%s).\n", name,
+                                   strerror(errno));
+
+                rng[num_jobs] = gsl_rng_alloc(gsl_rng_default);
+                gsl_rng_set(rng[num_jobs], opts->seed + num_jobs);
+                o.rng = rng[num_jobs];
+                o.d_max = atof(d_max);
+                o.a = atof(a);
+                o.stream_offset = (num_jobs + 1) << 32;
+                o.directory = name;
+
+                struct replicas *r = new_replicas(protein_read_xyz_file(file), &o);
+                if (r == NULL)
+                        die_printf("Unable to set up job `%s' (%s).\n", name,
+                                   strerror(errno));
+                replicas_first_iteration(r);
+                printf("Job `%s': %zu replicas of `%s', %ld iterations.\n",
+                       name, r->num_replicas, file, atol(iters));
+
+                iterations[num_jobs] = (size_t) atol(iters);
+                jobs[num_jobs++] = r;
+        }
+        fclose(f);
+
+        struct threading plan = plan_batch(jobs, num_jobs, opts);
+
+        if (!simulate_only) {
+                printf("Running thermalization phase.\n");
+                replicas_thermalize_batch(jobs, num_jobs, &plan,
+                                          thermalization_sweeps);
+                if (setup_only) {
+                        printf("Finished setup phase.\n");
+                        for (size_t j = 0; j < num_jobs; j++) {
+                                delete_replicas(jobs[j]);
+                                gsl_rng_free(rng[j]);
+                        }
+                        return;
+                }
+        }
+
+        printf("Running production phase.\n");
+        size_t k = 0;
+        while (num_jobs > 0) {
+                size_t n = report_iterations - k % report_iterations;
+                for (size_t j = 0; j < num_jobs; j++)
+                        n = GSL_MIN(n, iterations[j] - k);
+                replicas_run_batch(jobs, num_jobs, &plan, n);
+                k += n;
+
+                size_t kept = 0;
+                for (size_t j = 0; j < num_jobs; j++) {
+                        struct replicas *r = jobs[j];
+
+                        fprintf(r->log, "iterations: %zu of %zu\n", k, iterations[j]);
+                        replicas_print_info(r, r->log);
+                        if (r->any_pair)
+                                replicas_print_acceptance_matrix(r, r->log);
+                        fflush(r->log);
+
+                        if (k < iterations[j]) {
+                                jobs[kept] = r;
+                                rng[kept] = rng[j];
+                                iterations[kept++] = iterations[j];
+                                continue;
+                        }
+                        printf("Job `%s' finished after %zu iterations.\n",
+                               r->directory, k);
+                        delete_replicas(r);
+                        gsl_rng_free(rng[j]);
+                }
+
+                if (kept > 0 && kept < num_jobs)
+                        plan = plan_batch(jobs, kept, opts);
+                num_jobs = kept;
+                fflush(stdout);
+        }
+}
+
+/*
+ * Threading plan of the pool running the jobs, as if they were a
+ * single set of replicas, applied.
+ */
+struct threading plan_batch(struct replicas *jobs[], size_t num_jobs,
+                            const struct simulation_options *opts)
+{
+        size_t num_replicas = 0;
+
+        for (size_t j = 0; j < num_jobs; j++)
+                num_replicas += jobs[j]->num_replicas;
+
+        struct threading t = threading_plan(opts->num_threads, num_replicas);
+        t.binding = opts->binding;
+        threading_apply(&t);
+        printf("Running %zu job(s), %zu replicas: %d replica thread(s), "
+               "pinned to %s.\n", num_jobs, num_replicas, t.replica_threads,
+               threading_binding_name(t.binding));
+
+        return t;
 }
 
 void show_progress(const struct replicas *r, size_t k)
 {
-        if (k != 1 && k % 100 != 0)
+        if (k != 1 && k % report_iterations != 0)
                 return;
 
         printf("total number of exchanges: %zu\n", replicas_total_exchanges(r));
         replicas_print_info(r, stdout);
+        if (r->any_pair)
+                replicas_print_acceptance_matrix(r, stdout);
 
         for (size_t j = 0; j < r->num_replicas; j++) {
                 struct simulation *s = r->replica[j];
@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <math.h>
 #include <limits.h>
+#include <float.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <time.h>
@@ -23,9 +24,21 @@
 #include <gsl/gsl_blas.h>
 
 #include "utils.h"
+#include "arena.h"
+#include "vec3.h"
+#include "random-stream.h"
 #include "geometry.h"
 #include "contact-map.h"
+#include "cell-list.h"
+#include "chain-tree.h"
 #include "protein.h"
+#include "go-potential.h"
+#include "potential-kernels.h"
 #include "potential.h"
+#include "threading.h"
+#include "move-controller.h"
+#include "ladder.h"
+#include "channel.h"
+#include "coordinator.h"
 #include "simulation.h"
 #include "replicas.h"
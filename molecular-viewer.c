@@ -29,6 +29,7 @@ int main(int argc, char *argv[])
 
         if (d_max > 0.0) {
                 struct contact_map *m = new_contact_map(p, d_max);
+                const struct go_potential g = { .family = GO_SQUARE_WELL, .a = 0.1 };
                 FILE *g2 = popen(GNUPLOT_EXECUTABLE " -persist", "w");
                 if (g2 == NULL)
                         die_printf("Unable to run Gnuplot binary `%s'.\n",
@@ -37,7 +38,7 @@ int main(int argc, char *argv[])
                 contact_map_plot(m, g2,
                                  "%s (native contacts: %u, pot. energy: %f)",
                                  argv[argc-1], contact_map_get_num_contacts(m),
-                                 potential(p, m, 0.1));
+                                 potential(p, m, &g));
 
                 pclose(g2);
         }
@@ -0,0 +1,169 @@
+#include "molecular-simulator.h"
+
+
+/* Acceptance ratio the amplitudes are steered toward. */
+static const double target_acceptance = 0.4;
+
+/* Proposals of a movement between two adjustments of its parameters. */
+static const size_t window_size = 1000;
+
+/* Bounds of the amplitudes and of the share of each interior movement
+ * while adapting, so that none of them is ruled out for good. */
+static const double min_amplitude = 0.01;
+static const double min_weight = 0.05;
+
+static const enum protein_movements interior[] = {
+        PROTEIN_SPIKE_MOVE, PROTEIN_SHIFT_MOVE, PROTEIN_PIVOT_MOVE,
+        PROTEIN_CRANKSHAFT_MOVE, PROTEIN_SEGMENT_MOVE
+};
+static const size_t num_interior = sizeof(interior)/sizeof(interior[0]);
+
+static const char *const movement_name[PROTEIN_NUM_MOVEMENTS] = {
+        [PROTEIN_SPIKE_MOVE] = "spike",
+        [PROTEIN_SHIFT_MOVE] = "shift",
+        [PROTEIN_PIVOT_MOVE] = "pivot",
+        [PROTEIN_END_MOVE_FIRST] = "end (first)",
+        [PROTEIN_END_MOVE_LAST] = "end (last)",
+        [PROTEIN_CRANKSHAFT_MOVE] = "crankshaft",
+        [PROTEIN_SEGMENT_MOVE] = "segment",
+};
+
+
+/** Proposes what protein_propose_natural_movement() does: spike, shift,
+ * crankshaft and segment movements with the same probability and full
+ * rotations. */
+void move_controller_init(struct move_controller *self)
+{
+        memset(self, 0, sizeof(*self));
+
+        for (size_t m = 0; m < PROTEIN_NUM_MOVEMENTS; m++)
+                self->amplitude[m] = M_PI;
+        self->weight[PROTEIN_SPIKE_MOVE] = 0.25;
+        self->weight[PROTEIN_SHIFT_MOVE] = 0.25;
+        self->weight[PROTEIN_CRANKSHAFT_MOVE] = 0.25;
+        self->weight[PROTEIN_SEGMENT_MOVE] = 0.25;
+}
+
+/** Starts tuning the proposals from the records that follow.  Every
+ * interior movement gets a share of the proposals so that it can be
+ * measured. */
+void move_controller_adapt(struct move_controller *self)
+{
+        self->adapting = true;
+
+        for (size_t n = 0; n < num_interior; n++)
+                self->weight[interior[n]] = 1.0/(double) num_interior;
+}
+
+/** Stops tuning: from now on the proposals are fixed. */
+void move_controller_freeze(struct move_controller *self)
+{
+        self->adapting = false;
+}
+
+/** Movement to propose on atom k. */
+enum protein_movements move_controller_choose(const struct move_controller *self,
+                                              gsl_rng *rng, size_t k,
+                                              size_t num_atoms)
+{
+        if (k == 0)
+                return PROTEIN_END_MOVE_FIRST;
+        if (k + 1 >= num_atoms)
+                return PROTEIN_END_MOVE_LAST;
+
+        double u = gsl_rng_uniform(rng);
+        for (size_t n = 0; n + 1 < num_interior; n++) {
+                if (u < self->weight[interior[n]])
+                        return interior[n];
+                u -= self->weight[interior[n]];
+        }
+
+        return interior[num_interior - 1];
+}
+
+
+
+/*
+ * Work done by a movement, counted as the atoms it moves: those are
+ * what the overlap check and the energy difference have to visit.
+ */
+static double movement_work(enum protein_movements m, size_t k,
+                            size_t num_atoms)
+{
+        switch (m) {
+        case PROTEIN_SHIFT_MOVE:
+        case PROTEIN_PIVOT_MOVE:
+                return (double) (num_atoms - k - 1);
+        case PROTEIN_CRANKSHAFT_MOVE:
+                return GSL_MIN(2.0, (double) (num_atoms - k - 1));
+        case PROTEIN_SEGMENT_MOVE:
+                /* The average length of the segments. */
+                return GSL_MIN(5.5, (double) (num_atoms - k - 1));
+        default:
+                return 1.0;
+        }
+}
+
+static void update_weights(struct move_controller *self)
+{
+        double total = 0.0;
+
+        for (size_t n = 0; n < num_interior; n++)
+                total += self->efficiency[interior[n]];
+        if (total <= 0.0)
+                return;
+
+        double sum = 0.0;
+        for (size_t n = 0; n < num_interior; n++) {
+                const enum protein_movements m = interior[n];
+
+                self->weight[m] = GSL_MAX(self->efficiency[m]/total, min_weight);
+                sum += self->weight[m];
+        }
+        for (size_t n = 0; n < num_interior; n++)
+                self->weight[interior[n]] /= sum;
+}
+
+/** Takes note of the outcome of a proposal of movement m on atom k.
+ * The squared displacement of the atoms it moved only counts if it was
+ * accepted.  Nothing changes unless the controller is adapting. */
+void move_controller_record(struct move_controller *self,
+                            enum protein_movements m, size_t k,
+                            size_t num_atoms, bool accepted,
+                            double displacement)
+{
+        if (!self->adapting)
+                return;
+
+        self->proposed[m]++;
+        self->work[m] += movement_work(m, k, num_atoms);
+        if (accepted) {
+                self->accepted[m]++;
+                self->displacement[m] += displacement;
+        }
+
+        if (self->proposed[m] < window_size)
+                return;
+
+        const double acceptance = (double) self->accepted[m]/(double) self->proposed[m];
+
+        self->amplitude[m] = GSL_MIN(M_PI, GSL_MAX(min_amplitude,
+                self->amplitude[m]*exp(acceptance - target_acceptance)));
+        self->efficiency[m] = self->displacement[m]/self->work[m];
+
+        self->proposed[m] = self->accepted[m] = 0;
+        self->displacement[m] = self->work[m] = 0.0;
+
+        update_weights(self);
+}
+
+void move_controller_print(const struct move_controller *self, FILE *stream)
+{
+        for (size_t m = 0; m < PROTEIN_NUM_MOVEMENTS; m++) {
+                fprintf(stream, "  %-12s amplitude %5.3f", movement_name[m],
+                        self->amplitude[m]);
+                if (m != PROTEIN_END_MOVE_FIRST && m != PROTEIN_END_MOVE_LAST)
+                        fprintf(stream, ", weight %5.3f", self->weight[m]);
+                fprintf(stream, "\n");
+        }
+}
@@ -0,0 +1,43 @@
+#ifndef MOVE_CONTROLLER_H
+#define MOVE_CONTROLLER_H
+
+/** Choice of the movements proposed by a replica.  While adapting, the
+ * rotation amplitude of each kind of movement is steered toward a target
+ * acceptance ratio and the mix of interior movements (all but the end
+ * movements) toward the largest squared displacement per unit of work.
+ * Once frozen the proposals no longer depend on the history of the
+ * replica, as detailed balance requires. */
+struct move_controller {
+        /** Relative frequency of each movement on interior atoms. */
+        double weight[PROTEIN_NUM_MOVEMENTS];
+        /** Largest rotation angle of each movement. */
+        double amplitude[PROTEIN_NUM_MOVEMENTS];
+        /** Whether records change the parameters above. */
+        bool adapting;
+
+        /* Current adaptation window of each movement. */
+        size_t proposed[PROTEIN_NUM_MOVEMENTS];
+        size_t accepted[PROTEIN_NUM_MOVEMENTS];
+        double displacement[PROTEIN_NUM_MOVEMENTS];
+        double work[PROTEIN_NUM_MOVEMENTS];
+        /** Squared displacement per unit of work in the last window. */
+        double efficiency[PROTEIN_NUM_MOVEMENTS];
+};
+
+
+extern void move_controller_init(struct move_controller *self);
+extern void move_controller_adapt(struct move_controller *self);
+extern void move_controller_freeze(struct move_controller *self);
+
+extern enum protein_movements move_controller_choose(const struct move_controller *self,
+                                                     gsl_rng *rng, size_t k,
+                                                     size_t num_atoms);
+extern void move_controller_record(struct move_controller *self,
+                                   enum protein_movements m, size_t k,
+                                   size_t num_atoms, bool accepted,
+                                   double displacement);
+
+extern void move_controller_print(const struct move_controller *self,
+                                  FILE *stream);
+
+#endif // !MOVE_CONTROLLER_H
@@ -1,6 +1,33 @@
 #include "molecular-simulator.h"
 
 
+static bool end_move_first(struct protein *self, gsl_rng *rng,
+                           double amplitude, bool check);
+static bool end_move_last(struct protein *self, gsl_rng *rng,
+                          double amplitude, bool check);
+static bool shift_move(struct protein *self, gsl_rng *rng, size_t k,
+                       double amplitude);
+static bool spike_move(struct protein *self, gsl_rng *rng, size_t k,
+                       double amplitude, bool check);
+static bool pivot_move(struct protein *self, gsl_rng *rng, size_t k,
+                       double amplitude);
+static bool segment_move(struct protein *self, gsl_rng *rng, size_t k,
+                         size_t length, double amplitude, bool check);
+static size_t segment_length(const struct protein *self, gsl_rng *rng, size_t k);
+static double random_angle(gsl_rng *rng, double amplitude);
+
+/* Longest segment rotated by a segment movement. */
+static const size_t max_segment_length = 8;
+
+/* Interior movements chosen by protein_do_natural_movement(). */
+static const enum protein_movements natural_movements[] = {
+        PROTEIN_SPIKE_MOVE, PROTEIN_SHIFT_MOVE,
+        PROTEIN_CRANKSHAFT_MOVE, PROTEIN_SEGMENT_MOVE
+};
+static const size_t num_natural_movements =
+        sizeof(natural_movements)/sizeof(natural_movements[0]);
+
+
 bool protein_do_movement(struct protein *self, gsl_rng *rng,
                          enum protein_movements m, size_t k)
 {
@@ -22,11 +49,22 @@ bool protein_do_movement(struct protein *self, gsl_rng *rng,
         case PROTEIN_END_MOVE_LAST:
                 status = protein_do_end_move_last(self, rng);
                 break;
+        case PROTEIN_CRANKSHAFT_MOVE:
+                status = protein_do_crankshaft_move(self, rng, k);
+                break;
+        case PROTEIN_SEGMENT_MOVE:
+                status = protein_do_segment_move(self, rng, k);
+                break;
         }
 
         return status;
 }
 
+bool protein_do_pivot_move(struct protein *self, gsl_rng *rng, size_t k)
+{
+        return pivot_move(self, rng, k, M_PI);
+}
+
 bool protein_do_natural_movement(struct protein *self, gsl_rng *rng, size_t k)
 {
         /* dprintf("thread #%d is changing atom %u\n", omp_get_thread_num(), k); */
@@ -34,97 +72,201 @@ bool protein_do_natural_movement(struct protein *self, gsl_rng *rng, size_t k)
         if (k == 0) {
                 return protein_do_end_move_first(self, rng);
         } else if (1 <= k && k <= self->num_atoms-2) {
-                return protein_do_movement(self, rng, gsl_rng_uniform_int(rng, 2), k);
+                const size_t n = gsl_rng_uniform_int(rng, num_natural_movements);
+                return protein_do_movement(self, rng, natural_movements[n], k);
         } else {
                 return protein_do_end_move_last(self, rng);
         }
 }
 
-bool protein_is_overlapping(const struct protein *self, size_t start, size_t end)
+/** Like protein_do_movement(), but the rotation of the movement is by
+ * no more than amplitude radians, and a movement of a single atom is
+ * not checked for overlaps: the caller has to do it, for instance with
+ * potential_delta_checked(), and undo the movement if needed.  With an
+ * amplitude of M_PI the movements are those of protein_do_movement(). */
+bool protein_propose_movement(struct protein *self, gsl_rng *rng,
+                              enum protein_movements m, size_t k,
+                              double amplitude)
 {
-        const size_t N = self->num_atoms;
-        const double bead_diameter = 1.1*3.8;
+        bool status = false;
+
+        switch (m) {
+        case PROTEIN_SPIKE_MOVE:
+                status = spike_move(self, rng, k, amplitude, false);
+                break;
+        case PROTEIN_SHIFT_MOVE:
+                status = shift_move(self, rng, k, amplitude);
+                break;
+        case PROTEIN_PIVOT_MOVE:
+                status = pivot_move(self, rng, k, amplitude);
+                break;
+        case PROTEIN_END_MOVE_FIRST:
+                status = end_move_first(self, rng, amplitude, false);
+                break;
+        case PROTEIN_END_MOVE_LAST:
+                status = end_move_last(self, rng, amplitude, false);
+                break;
+        case PROTEIN_CRANKSHAFT_MOVE:
+                status = segment_move(self, rng, k, GSL_MIN(2, self->num_atoms - 1 - k),
+                                      amplitude, false);
+                break;
+        case PROTEIN_SEGMENT_MOVE:
+                status = segment_move(self, rng, k, segment_length(self, rng, k),
+                                      amplitude, false);
+                break;
+        }
+
+        return status;
+}
+
+/** Like protein_do_natural_movement(), but see protein_propose_movement(). */
+bool protein_propose_natural_movement(struct protein *self, gsl_rng *rng,
+                                      size_t k)
+{
+        enum protein_movements m;
+
+        if (k == 0)
+                m = PROTEIN_END_MOVE_FIRST;
+        else if (1 <= k && k <= self->num_atoms-2)
+                m = natural_movements[gsl_rng_uniform_int(rng, num_natural_movements)];
+        else
+                m = PROTEIN_END_MOVE_LAST;
+
+        return protein_propose_movement(self, rng, m, k, M_PI);
+}
 
+/** Diameter of the beads: atoms that are not consecutive in the chain
+ * may not be closer than this. */
+const double protein_bead_diameter = 1.1*3.8;
+
+/** Tells whether any atom in [start, end) overlaps another one.  Only
+ * the atoms in the neighbouring cells of the cell list of the protein,
+ * which must be up to date, are looked at. */
+bool protein_is_overlapping(const struct protein *self, size_t start, size_t end)
+{
         for (size_t i = start; i < end; i++) {
-                for (size_t j = 0; j < N; j++) {
-                        if (j == i - 1 || j == i || j == i + 1)
-                                continue;
-
-                        if (protein_distance(self, i, j) < bead_diameter) {
-                                dprintf("overlap of %g between atoms %u and %u\n",
-                                        protein_distance(self, i, j), i, j);
-                                return true;
-                        }
+                if (cell_list_overlaps(&self->cells,
+                                       (const real (*)[3]) self->atom, i)) {
+                        dprintf("overlap of atom %u\n", i);
+                        return true;
                 }
         }
 
         return false;
 }
 
+/** Tells whether an atom in [k, N) overlaps one before k.  After a
+ * rigid movement of that tail these are the only pairs whose distance
+ * has changed, so provided the conformation was self-avoiding before
+ * the movement this is equivalent to protein_is_overlapping(self, k, N),
+ * but only the segments of the chain tree that come close to each other
+ * are opened. */
+bool protein_is_tail_overlapping(const struct protein *self, size_t k)
+{
+        return chain_tree_split_overlaps(&self->tree,
+                                         (const real (*)[3]) self->atom,
+                                         k, protein_bead_diameter);
+}
+
 
 
-bool protein_do_end_move_first(struct protein *self, gsl_rng *rng)
+/*
+ * Every movement records the atoms it is about to modify in the undo
+ * journal of the protein, changes the conformation in place and
+ * updates the cached torsions and spatial indices of the modified
+ * range.  If the resulting conformation is not self-avoiding, the
+ * movement is undone and false is returned.  Otherwise the journal is
+ * left in place so that the caller can still roll the movement back
+ * (e.g. when it is rejected by the Metropolis criterion).  Movements of
+ * a single atom can leave the overlap check to the caller.
+ *
+ * The rotation of each movement is by an angle of at most amplitude
+ * radians.  Smaller rotations are proposed symmetrically (a rotation and
+ * its inverse are equally likely), so that the Metropolis criterion
+ * still applies.
+ */
+
+/* Angle of the rotation of spike and pivot movements. */
+double random_angle(gsl_rng *rng, double amplitude)
 {
-        dprintf("moving first atom.\n");
-        dprintf("before: atom(0) == "); dprint_vector(self->atom[0]);
+        if (amplitude >= M_PI)
+                return 2*M_PI*gsl_rng_uniform_pos(rng);
+        else
+                return amplitude*(2.0*gsl_rng_uniform(rng) - 1.0);
+}
 
-        double R[3][3];
-        make_random_rotation_matrix(R, rng);
-        gsl_matrix_view RV = gsl_matrix_view_array((double *) R, 3, 3);
-        rotate(false, &RV.matrix, self->atom[1], self->atom[0]);
-        dprintf("after: atom(0) == "); dprint_vector(self->atom[0]);
-
-        if (protein_is_overlapping(self, 0, 1)) {
-                rotate(true, &RV.matrix, self->atom[1], self->atom[0]);
-                dprintf("after undo: atom(0) == "); dprint_vector(self->atom[0]);
+static bool end_move_first(struct protein *self, gsl_rng *rng,
+                           double amplitude, bool check)
+{
+        dprintf("moving first atom.\n");
+        dprintf("before: atom(0) == "); dprint_point(self->atom[0]);
+
+        double q[4];
+        make_bounded_rotation_quaternion(q, rng, amplitude);
+        protein_save_atoms(self, 0, 1);
+        rotate_by_quaternion(q, self->atom[1], self->atom[0]);
+        protein_update(self);
+        dprintf("after: atom(0) == "); dprint_point(self->atom[0]);
+
+        if (check && protein_is_overlapping(self, 0, 1)) {
+                protein_undo(self);
+                dprintf("after undo: atom(0) == "); dprint_point(self->atom[0]);
                 return false;
         }
 
         return true;
 }
 
-bool protein_do_end_move_last(struct protein *self, gsl_rng *rng)
+static bool end_move_last(struct protein *self, gsl_rng *rng,
+                          double amplitude, bool check)
 {
         dprintf("moving last atom.\n");
         dprintf("before: atom(%d) == ", self->num_atoms-1);
-        dprint_vector(self->atom[self->num_atoms - 1]);
+        dprint_point(self->atom[self->num_atoms - 1]);
 
         const size_t N = self->num_atoms;
 
-        double R[3][3];
-        make_random_rotation_matrix(R, rng);
-        gsl_matrix_view RV = gsl_matrix_view_array((double *) R, 3, 3);
-        rotate(false, &RV.matrix, self->atom[N-2], self->atom[N-1]);
+        double q[4];
+        make_bounded_rotation_quaternion(q, rng, amplitude);
+        protein_save_atoms(self, N-1, N);
+        rotate_by_quaternion(q, self->atom[N-2], self->atom[N-1]);
+        protein_update(self);
 
         dprintf("after: atom(%d) == ", N-1);
-        dprint_vector(self->atom[N-1]);
+        dprint_point(self->atom[N-1]);
 
-        if (protein_is_overlapping(self, N-1, N)) {
-                rotate(true, &RV.matrix,
-                       self->atom[N - 2],
-                       self->atom[N - 1]);
+        if (check && protein_is_overlapping(self, N-1, N)) {
+                protein_undo(self);
                 dprintf("after undo: atom(%d) == ", N-1);
-                dprint_vector(self->atom[N-1]);
+                dprint_point(self->atom[N-1]);
                 return false;
         }
         return true;
 }
 
-
+bool protein_do_end_move_first(struct protein *self, gsl_rng *rng)
+{
+        return end_move_first(self, rng, M_PI, true);
+}
 
-bool protein_do_shift_move(struct protein *self, gsl_rng *rng, size_t k)
+bool protein_do_end_move_last(struct protein *self, gsl_rng *rng)
 {
-        assert(k <= self->num_atoms - 3);
+        return end_move_last(self, rng, M_PI, true);
+}
+
 
-        bool status = true;
+
+static bool shift_move(struct protein *self, gsl_rng *rng, size_t k,
+                       double amplitude)
+{
+        assert(k <= self->num_atoms - 3);
 
         dprintf("shifting move at atom %u\n", k);
-        dprintf("before: atom(%u) == ", self->num_atoms-1); dprint_vector(self->atom[self->num_atoms-1]);
-        dprintf("before: atom(%u) == ", k+1); dprint_vector(self->atom[k+1]);
+        dprintf("before: atom(%u) == ", self->num_atoms-1); dprint_point(self->atom[self->num_atoms-1]);
+        dprintf("before: atom(%u) == ", k+1); dprint_point(self->atom[k+1]);
 
-        double R[3][3];
-        make_random_rotation_matrix(R, rng);
-        gsl_matrix_const_view RV = gsl_matrix_const_view_array((double *) R, 3, 3);
+        double q[4];
+        make_bounded_rotation_quaternion(q, rng, amplitude);
 
         /*
          * 1. Take a consecutive pair of atoms: a(k) and a(k+1).
@@ -132,181 +274,161 @@ bool protein_do_shift_move(struct protein *self, gsl_rng *rng, size_t k)
          * 3. Translate the atoms a(k+2) ... a(num_atoms-1) so that
          * the connectivity of the chain is maintained.
          */
-        gsl_vector *bak = gsl_vector_alloc(3);
-        gsl_vector_memcpy(bak, self->atom[k+1]);
+        protein_save_atoms(self, k+1, self->num_atoms);
 
         /* t = atom(k+1) - R atom(k+1) */
-        declare_stack_allocated_vector(t, 3);
-        gsl_vector_memcpy(t, self->atom[k+1]);
-        rotate(false, &RV.matrix, self->atom[k], self->atom[k+1]);
-        gsl_vector_sub(t, self->atom[k+1]);
+        real t[3];
+        rotate_by_quaternion(q, self->atom[k], self->atom[k+1]);
+        for (size_t j = 0; j < 3; j++)
+                t[j] = self->journal.atom[k+1][j] - self->atom[k+1][j];
 
         for (size_t i = k+2; i < self->num_atoms; i++)
-                gsl_vector_sub(self->atom[i], t);
+                for (size_t j = 0; j < 3; j++)
+                        self->atom[i][j] -= t[j];
+        protein_update(self);
 
-        dprintf("after: atom(%u) == ", self->num_atoms-1); dprint_vector(self->atom[self->num_atoms-1]);
-        dprintf("after: atom(%u) == ", k+1); dprint_vector(self->atom[k+1]);
+        dprintf("after: atom(%u) == ", self->num_atoms-1); dprint_point(self->atom[self->num_atoms-1]);
+        dprintf("after: atom(%u) == ", k+1); dprint_point(self->atom[k+1]);
 
-        if (protein_is_overlapping(self, k+1, self->num_atoms)) {
+        if (protein_is_tail_overlapping(self, k+1)) {
                 dprintf("undoing shift movement.\n");
 
-                for (size_t i = k+2; i < self->num_atoms; i++)
-                        gsl_vector_add(self->atom[i], t);
-
-                dprintf("after undo: atom(%u) == ", self->num_atoms-1); dprint_vector(self->atom[self->num_atoms-1]);
+                protein_undo(self);
 
-                gsl_vector_memcpy(self->atom[k+1], bak);
+                dprintf("after undo: atom(%u) == ", self->num_atoms-1); dprint_point(self->atom[self->num_atoms-1]);
+                dprintf("after undo: atom(%u) == ", k+1); dprint_point(self->atom[k+1]);
 
-                dprintf("after undo: atom(%u) == ", k+1); dprint_vector(self->atom[k+1]);
-
-                status = false;
+                return false;
         }
 
-        gsl_vector_free(bak);
-
-        return status;
+        return true;
 }
 
-
 
-bool protein_do_spike_move(struct protein *self, gsl_rng *rng, size_t k)
-{
-        bool status = true;
-
-        const double theta = 2*M_PI*gsl_rng_uniform_pos(rng);
-
-        gsl_vector *bak = gsl_vector_alloc(3);
-        gsl_vector_memcpy(bak, self->atom[k]);
 
-        dprintf("before: atom(%u) == ", k); dprint_vector(self->atom[k]);
-
-        /* v = p3-p1 */
-        gsl_vector *v = gsl_vector_alloc(3);
-        gsl_vector_memcpy(v, self->atom[k+1]);
-        gsl_vector_sub(v, self->atom[k-1]);
-        vector_normalize(v);
+bool protein_do_shift_move(struct protein *self, gsl_rng *rng, size_t k)
+{
+        return shift_move(self, rng, k, M_PI);
+}
 
-        /* a = p2-p1 */
-        gsl_vector *a = gsl_vector_alloc(3);
-        gsl_vector_memcpy(a, self->atom[k]);
-        gsl_vector_sub(a, self->atom[k-1]);
 
-        /* w = <a, v> v */
-        gsl_vector *w = gsl_vector_alloc(3);
-        gsl_vector_memcpy(w, v);
-        double len;
-        gsl_blas_ddot(a, v, &len);
-        gsl_vector_scale(w, len);
 
-        /* t = p1 + w */
-        gsl_vector *t = gsl_vector_alloc(3);
-        gsl_vector_memcpy(t, w);
-        gsl_vector_add(t, self->atom[k-1]);
+/*
+ * Rotation of atom k about the axis through its two neighbours.
+ */
+static bool spike_move(struct protein *self, gsl_rng *rng, size_t k,
+                       double amplitude, bool check)
+{
+        dprintf("spike move at atom %u.\n", k);
 
-        /* q = atom[k] - t */
-        gsl_vector *q = gsl_vector_alloc(3);
-        gsl_vector_memcpy(q, self->atom[k]);
-        gsl_vector_sub(q, t);
+        return segment_move(self, rng, k, 1, amplitude, check);
+}
 
-        gsl_matrix *G = gsl_matrix_alloc(3, 3);
-        gsl_vector_view u0 = gsl_matrix_column(G, 0);
-        gsl_vector_view u1 = gsl_matrix_column(G, 1);
-        gsl_vector_view u2 = gsl_matrix_column(G, 2);
+bool protein_do_spike_move(struct protein *self, gsl_rng *rng, size_t k)
+{
+        return spike_move(self, rng, k, M_PI, true);
+}
 
-        gsl_vector_memcpy(&u0.vector, q);
-        vector_normalize(&u0.vector);
 
-        gsl_vector_memcpy(&u2.vector, w);
-        vector_normalize(&u2.vector);
 
-        cross_product(&u0.vector, &u2.vector, &u1.vector);
-        assert(gsl_fcmp(gsl_blas_dnrm2(&u1.vector), 0.0, 1e-3) != 0);
+static bool pivot_move(struct protein *self, gsl_rng *rng, size_t k,
+                       double amplitude)
+{
+        const double theta = random_angle(rng, amplitude);
 
-        /* XXX This code could be replaced by BLAS' DROT. */
-        double R[3][3] = {{cos(theta),  -sin(theta),    0.0},
-                          {sin(theta),   cos(theta),    0.0},
-                          {       0.0,          0.0,    1.0}};
-        gsl_matrix_const_view RV = gsl_matrix_const_view_array((double *) R, 3, 3);
+        dprintf("pivoting move at atom %u.\n", k);
+        dprintf("before: atom(%d) == ", k+1);
+        dprint_point(self->atom[k+1]);
 
-        gsl_matrix *A = gsl_matrix_alloc(3, 3);
-        gsl_matrix *B = gsl_matrix_alloc(3, 3);
-        gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1.0, &RV.matrix, G, 0.0, A);
-        gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, G, A, 0.0, B);
 
-        gsl_vector *z = gsl_vector_alloc(3);
-        gsl_blas_dgemv(CblasNoTrans, 1.0, B, q, 0.0, z);
+        /* The tail turns about the z axis through atom k. */
+        const double z[3] = { 0.0, 0.0, 1.0 };
+        double R[3][3];
+        mat3_rotation(R, z, theta);
 
-        gsl_vector_add(z, t);
-        gsl_vector_memcpy(self->atom[k], z);
+        protein_save_atoms(self, k+1, self->num_atoms);
+        for (size_t i = k+1; i < self->num_atoms; i++)
+                rotate(false, (const double (*)[3]) R, self->atom[k], self->atom[i]);
+        protein_update(self);
 
-        dprintf("after: atom(%d) == ", k); dprint_vector(self->atom[k]);
+        dprintf("after: atom(%d) == ", k+1);
+        dprint_point(self->atom[k+1]);
 
-        /* We are done if the conformation is correct. */
-        if (protein_is_overlapping(self, k, k+1)) {
-                gsl_vector_memcpy(self->atom[k], bak);
-                dprintf("after undo: atom(%d) == ", k); dprint_vector(self->atom[k]);
+        if (protein_is_tail_overlapping(self, k+1)) {
+                dprintf("undoing invalid conformation.\n");
+                protein_undo(self);
+                dprintf("after undo: atom(%d) == ", k+1);
+                dprint_point(self->atom[k+1]);
 
-                status = false;
+                return false;
         }
 
-        gsl_vector_free(bak);
-        gsl_vector_free(v); gsl_vector_free(a); gsl_vector_free(w);
-        gsl_vector_free(t); gsl_vector_free(q); gsl_vector_free(z);
-        gsl_matrix_free(G); gsl_matrix_free(A); gsl_matrix_free(B);
+        return true;
+}
 
-        return status;
+
+void protein_scramble(struct protein *self, gsl_rng *rng)
+{
+        for (size_t r = 0; r < 10*self->num_atoms; r++)
+                for (size_t k = 0; k < self->num_atoms; k++)
+                        protein_do_natural_movement(self, rng, k);
 }
 
-
 
-bool protein_do_pivot_move(struct protein *self, gsl_rng *rng, size_t k)
+
+/*
+ * Rotation of the atoms [k, k+length) about the axis through their
+ * neighbours k-1 and k+length, which stay in place with the rest of the
+ * chain.  A spike movement is the case length == 1 and a crankshaft
+ * movement the case length == 2.  Segments of more than one atom are
+ * always checked for overlaps.
+ */
+bool segment_move(struct protein *self, gsl_rng *rng, size_t k,
+                  size_t length, double amplitude, bool check)
 {
-        const double theta = 2*M_PI*gsl_rng_uniform_pos(rng);
+        assert(k >= 1 && length >= 1 && k + length < self->num_atoms);
 
-        dprintf("pivoting move at atom %u.\n", k);
-        dprintf("before: atom(%d) == ", k+1);
-        dprint_vector(self->atom[k+1]);
-
-
-        /* XXX This code could be replaced by BLAS' DROT. */
-        double RR[3][3] = {{cos(theta), -sin(theta), 0.0},
-                           {sin(theta),  cos(theta), 0.0},
-                           {       0.0,         0.0, 1.0}};
-        gsl_matrix_const_view RV = gsl_matrix_const_view_array((double *) RR, 3, 3);
-        declare_stack_allocated_vector(y, 3);
-        for (size_t i = k+1; i < self->num_atoms; i++) {
-                gsl_vector_memcpy(y, self->atom[k]);
-                gsl_vector_sub(self->atom[i], y);
-                gsl_blas_dgemv(CblasNoTrans, 1.0, &RV.matrix, self->atom[i], 1.0, y);
-                gsl_vector_memcpy(self->atom[i], y);
-        }
+        const double theta = random_angle(rng, amplitude);
+        const real *a = self->atom[k-1], *b = self->atom[k+length];
 
-        dprintf("after: atom(%d) == ", k+1);
-        dprint_vector(self->atom[k+1]);
+        dprintf("rotating atoms %u to %u.\n", k, k+length-1);
 
-        if (protein_is_overlapping(self, k+1, self->num_atoms)) {
-                dprintf("undoing invalid conformation.\n");
-                for (size_t i = k+1; i < self->num_atoms; i++) {
-                        gsl_vector_memcpy(y, self->atom[k]);
-                        gsl_vector_sub(self->atom[i], y);
-                        gsl_blas_dgemv(CblasTrans, 1.0,
-                                       &RV.matrix, self->atom[i],
-                                       1.0, y);
-                        gsl_vector_memcpy(self->atom[i], y);
-                }
-                dprintf("after undo: atom(%d) == ", k+1);
-                dprint_vector(self->atom[k+1]);
+        double u[3], R[3][3];
+        for (size_t j = 0; j < 3; j++)
+                u[j] = b[j] - a[j];
+        mat3_rotation(R, u, theta);
+
+        protein_save_atoms(self, k, k+length);
+        for (size_t i = k; i < k+length; i++)
+                rotate(false, (const double (*)[3]) R, self->atom[k-1], self->atom[i]);
+        protein_update(self);
 
+        if ((check || length > 1) && protein_is_overlapping(self, k, k+length)) {
+                dprintf("undoing segment movement.\n");
+                protein_undo(self);
                 return false;
         }
 
         return true;
 }
 
+/* Atoms rotated by a segment movement at atom k: at least three, as
+ * fewer are spike and crankshaft movements, unless the chain ends
+ * first. */
+size_t segment_length(const struct protein *self, gsl_rng *rng, size_t k)
+{
+        const size_t length = 3 + gsl_rng_uniform_int(rng, max_segment_length - 2);
 
-void protein_scramble(struct protein *self, gsl_rng *rng)
+        return GSL_MIN(length, self->num_atoms - 1 - k);
+}
+
+bool protein_do_crankshaft_move(struct protein *self, gsl_rng *rng, size_t k)
 {
-        for (size_t r = 0; r < 10*self->num_atoms; r++)
-                for (size_t k = 0; k < self->num_atoms; k++)
-                        protein_do_natural_movement(self, rng, k);
+        return segment_move(self, rng, k, GSL_MIN(2, self->num_atoms - 1 - k),
+                            M_PI, true);
+}
+
+bool protein_do_segment_move(struct protein *self, gsl_rng *rng, size_t k)
+{
+        return segment_move(self, rng, k, segment_length(self, rng, k), M_PI, true);
 }
@@ -0,0 +1,270 @@
+/*
+ * Full and incremental evaluation of the Go potential for one family
+ * of wells.  This file is included by potential.c once per family,
+ * with GO_FAMILY set to its name and the functions
+ *
+ *   GO_FAMILY_pair(r, d_nat, g)    well of a single contact,
+ *   GO_FAMILY_pairs(x, first, second, d_nat, n, g)
+ *   GO_FAMILY_row(x, c, partner, d_nat, n, g)
+ *                                  batched kernels,
+ *   GO_FAMILY_min_change(g)        lower bound of the change of the
+ *                                  well of a contact (-inf if none),
+ *
+ * already defined, so that every loop below is compiled with the well
+ * of the family inlined.
+ */
+
+#define GO_CONCAT_(a, b) a ## b
+#define GO_CONCAT(a, b) GO_CONCAT_(a, b)
+#define GO_FN(name) GO_CONCAT(GO_FAMILY, name)
+
+
+static double GO_FN(_potential)(const struct protein *p,
+                                const struct contact_map *native_map,
+                                const struct go_potential *g)
+{
+        double U = 0.0;
+        size_t i, n;
+        const size_t N = p->num_atoms;
+        const size_t M = native_map->num_long_range;
+        const size_t *first = native_map->first, *second = native_map->second;
+        const double *d_nat = native_map->distance;
+
+        /* Atoms two and three positions apart along the chain. */
+        for (i = 0; i + 2 < N; i++)
+                U += GO_FN(_pair)(distance(p->atom[i], p->atom[i+2]),
+                                  native_map->angle_distance[i], g);
+        for (i = 0; i + 3 < N; i++)
+                U += GO_FN(_pair)(p->torsion[i], native_map->torsion_distance[i], g);
+
+        /*
+         * The chunks are added up in order once all are done, so that
+         * the sum does not depend on the number of threads.
+         */
+        const size_t num_chunks = (M + potential_chunk_size - 1)/potential_chunk_size;
+        double chunk[num_chunks + 1];
+
+#pragma omp parallel for private(n) schedule(static) \
+        num_threads(potential_num_threads) if(potential_num_threads > 1)
+        for (n = 0; n < num_chunks; n++) {
+                const size_t lo = n*potential_chunk_size;
+                chunk[n] = GO_FN(_pairs)((const real (*)[3]) p->atom,
+                                         first + lo, second + lo, d_nat + lo,
+                                         GSL_MIN(potential_chunk_size, M - lo), g);
+        }
+
+        for (n = 0; n < num_chunks; n++)
+                U += chunk[n];
+
+        return U;
+}
+
+/*
+ * Energy change of the contacts partner[lo, hi) of an atom whose old
+ * and new positions are c_old and c, the partners being read from
+ * x_old before the movement and from the protein after it.
+ */
+static inline double GO_FN(_row_delta)(const struct protein *p,
+                                       const real (*x_old)[3],
+                                       const real c[3], const real c_old[3],
+                                       const size_t *partner, const double *dnat,
+                                       size_t lo, size_t hi,
+                                       const struct go_potential *g)
+{
+        if (lo == hi)
+                return 0.0;
+
+        return GO_FN(_row)((const real (*)[3]) p->atom, c, partner + lo, dnat + lo, hi - lo, g)
+                - GO_FN(_row)(x_old, c_old, partner + lo, dnat + lo, hi - lo, g);
+}
+
+/*
+ * Energy of the contacts partner[0, n) of an atom at c, taking the
+ * squared distances of the partners found in near[0, num_near) (sorted
+ * by atom) from there instead of computing them again.
+ */
+static inline double GO_FN(_row_near)(const real (*x)[3], const real c[3],
+                                      const size_t *partner, const double *dnat,
+                                      size_t n,
+                                      const struct cell_neighbor *near,
+                                      size_t num_near,
+                                      const struct go_potential *g)
+{
+        double U = 0.0;
+
+        for (size_t k = 0, m = 0; k < n; k++) {
+                while (m < num_near && near[m].atom < partner[k])
+                        m++;
+
+                const real r = m < num_near && near[m].atom == partner[k]
+                        ? real_sqrt(near[m].distance2)
+                        : distance(c, x[partner[k]]);
+
+                U += GO_FN(_pair)(r, dnat[k], g);
+        }
+
+        return U;
+}
+
+static inline double GO_FN(_torsion_delta)(const struct protein *p,
+                                           const struct contact_map *native_map,
+                                           size_t i,
+                                           const struct go_potential *g)
+{
+        const double d = native_map->torsion_distance[i];
+
+        return GO_FN(_pair)(p->torsion[i], d, g) - GO_FN(_pair)(p->journal.torsion[i], d, g);
+}
+
+/*
+ * Contacts between atoms i and i+3 whose torsion (i, ..., i+3) contains
+ * both moved and fixed atoms: those beginning before the moved range and
+ * those beginning inside it but ending after it.  The movement has
+ * already updated their cached signed distances and the journal holds
+ * the previous ones.
+ */
+static inline double GO_FN(_torsions_delta)(const struct protein *p,
+                                            const struct contact_map *native_map,
+                                            const struct go_potential *g)
+{
+        const size_t N = p->num_atoms;
+        const size_t start = p->journal.start, end = p->journal.end;
+        const size_t first = start >= 3 ? start - 3 : 0;
+        const size_t last = N < 4 ? 0 : GSL_MIN(end, N - 3);
+        double DU = 0.0;
+
+        for (size_t i = first; i < GSL_MIN(start, last); i++)
+                DU += GO_FN(_torsion_delta)(p, native_map, i, g);
+        for (size_t i = GSL_MAX(start, end >= 3 ? end - 3 : 0); i < last; i++)
+                DU += GO_FN(_torsion_delta)(p, native_map, i, g);
+
+        return DU;
+}
+
+static double GO_FN(_potential_delta)(const struct protein *p,
+                                      const struct contact_map *native_map,
+                                      const struct go_potential *g,
+                                      double bound)
+{
+        const size_t N = p->num_atoms;
+        const size_t start = p->journal.start, end = p->journal.end;
+        const size_t *row = native_map->row;
+        const size_t *partner = native_map->partner;
+        const double *dnat = native_map->partner_distance;
+
+        if (start == end)
+                return 0.0;
+
+        double DU = GO_FN(_torsions_delta)(p, native_map, g);
+
+        /*
+         * Every moved-fixed contact is in the row of its moved atom,
+         * so at most `remaining' of them are left to evaluate, each of
+         * which lowers the energy by no more than -min_change.  Once
+         * even that cannot bring DU below the bound, the evaluation
+         * stops.
+         */
+        const double min_change = GO_FN(_min_change)(g);
+        const bool bounded = isfinite(bound) && isfinite(min_change);
+        size_t remaining = row[end] - row[start];
+
+#define GO_STOP_IF_ABOVE_BOUND()                                        \
+        if (bounded && DU + (double) remaining*min_change >= bound)     \
+                return DU + (double) remaining*min_change
+
+        GO_STOP_IF_ABOVE_BOUND();
+
+        /*
+         * Contacts between moved and fixed atoms.  They are visited
+         * from whichever of the two sets is smaller; as rows are sorted
+         * by partner, the contacts of an atom with the other set are at
+         * most two contiguous segments of its row.
+         */
+        if (end - start <= N - (end - start)) {
+                /* The partners are fixed: old and new positions agree. */
+                for (size_t i = start; i < end; i++) {
+                        const size_t s = lower_bound(partner, row[i], row[i+1], start);
+                        const size_t e = lower_bound(partner, s, row[i+1], end);
+
+                        DU += GO_FN(_row_delta)(p, (const real (*)[3]) p->atom,
+                                                p->atom[i], p->journal.atom[i],
+                                                partner, dnat, row[i], s, g);
+                        DU += GO_FN(_row_delta)(p, (const real (*)[3]) p->atom,
+                                                p->atom[i], p->journal.atom[i],
+                                                partner, dnat, e, row[i+1], g);
+
+                        remaining -= row[i+1] - row[i];
+                        GO_STOP_IF_ABOVE_BOUND();
+                }
+        } else {
+                /* The partners moved: their old positions are in the journal. */
+                for (size_t i = 0; i < N; i++) {
+                        if (i == start) {
+                                i = end - 1;
+                                continue;
+                        }
+
+                        const size_t s = lower_bound(partner, row[i], row[i+1], start);
+                        const size_t e = lower_bound(partner, s, row[i+1], end);
+
+                        DU += GO_FN(_row_delta)(p, (const real (*)[3]) p->journal.atom,
+                                                p->atom[i], p->atom[i],
+                                                partner, dnat, s, e, g);
+
+                        remaining -= e - s;
+                        GO_STOP_IF_ABOVE_BOUND();
+                }
+        }
+
+#undef GO_STOP_IF_ABOVE_BOUND
+
+        return DU;
+}
+
+/*
+ * Single pass over the surroundings of a movement of one atom: the
+ * squared distances to the atoms in the cells around it decide whether
+ * it overlaps any of them and are then reused for its contacts with
+ * them.  Movements of more atoms are checked by the movements
+ * themselves.
+ */
+static double GO_FN(_potential_delta_checked)(const struct protein *p,
+                                              const struct contact_map *native_map,
+                                              const struct go_potential *g,
+                                              double bound, bool *overlapping)
+{
+        const size_t i = p->journal.start;
+
+        *overlapping = false;
+        if (p->journal.end - i != 1)
+                return GO_FN(_potential_delta)(p, native_map, g, bound);
+
+        struct cell_neighbor near[POTENTIAL_MAX_NEAR];
+        const size_t num_near = cell_list_gather(&p->cells,
+                                                 (const real (*)[3]) p->atom, i,
+                                                 near, POTENTIAL_MAX_NEAR,
+                                                 overlapping);
+        if (*overlapping)
+                return 0.0;
+
+        const size_t lo = native_map->row[i], hi = native_map->row[i+1];
+        const size_t *partner = native_map->partner + lo;
+        const double *dnat = native_map->partner_distance + lo;
+        const double min_change = GO_FN(_min_change)(g);
+        double DU = GO_FN(_torsions_delta)(p, native_map, g);
+
+        if (isfinite(bound) && isfinite(min_change)
+            && DU + (double) (hi - lo)*min_change >= bound)
+                return DU + (double) (hi - lo)*min_change;
+
+        /* The partners of the atom are fixed. */
+        return DU + GO_FN(_row_near)((const real (*)[3]) p->atom, p->atom[i],
+                                     partner, dnat, hi - lo, near, num_near, g)
+                - GO_FN(_row)((const real (*)[3]) p->atom, p->journal.atom[i],
+                              partner, dnat, hi - lo, g);
+}
+
+#undef GO_FN
+#undef GO_CONCAT
+#undef GO_CONCAT_
+#undef GO_FAMILY
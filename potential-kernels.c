@@ -0,0 +1,482 @@
+#include "molecular-simulator.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# define HAVE_X86_KERNELS 1
+# include <immintrin.h>
+#endif
+
+
+/*
+ * Scalar kernels.  These define the reference behaviour and are used
+ * for the remainders of the vector kernels.
+ */
+
+static inline double well(real r, double a, double dnat)
+{
+        const real dr = r - (real) dnat;
+
+        return fabs(dr) < (real) a ? -1.0 + gsl_pow_2(dr/a) : 0.0;
+}
+
+static inline real distance(const real u[3], const real v[3])
+{
+        const real dx = v[0] - u[0], dy = v[1] - u[1], dz = v[2] - u[2];
+
+        return real_sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+static double pairs_scalar(const real (*x)[3],
+                           const size_t *first, const size_t *second,
+                           const double *d_nat, size_t n, double a)
+{
+        double U = 0.0;
+
+        for (size_t k = 0; k < n; k++)
+                U += well(distance(x[first[k]], x[second[k]]), a, d_nat[k]);
+
+        return U;
+}
+
+static double row_scalar(const real (*x)[3], const real c[3],
+                         const size_t *partner,
+                         const double *d_nat, size_t n, double a)
+{
+        double U = 0.0;
+
+        for (size_t k = 0; k < n; k++)
+                U += well(distance(c, x[partner[k]]), a, d_nat[k]);
+
+        return U;
+}
+
+static const struct potential_kernels scalar_kernels = {
+        .name = "scalar", .pairs = pairs_scalar, .row = row_scalar
+};
+
+
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * AVX2 kernels.  Coordinates are gathered four contacts at a time
+ * using 64-bit indices (three times the atom index, as the coordinates
+ * are packed x, y, z triples).
+ */
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 static inline __m256i avx2_times_three(__m256i i)
+{
+        return _mm256_add_epi64(_mm256_slli_epi64(i, 1), i);
+}
+
+#ifndef SINGLE_PRECISION
+
+AVX2 static inline __m256d avx2_well(__m256d r, __m256d d_nat, __m256d a)
+{
+        const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+        const __m256d dr = _mm256_sub_pd(r, d_nat);
+        const __m256d inside = _mm256_cmp_pd(_mm256_and_pd(dr, abs_mask), a, _CMP_LT_OQ);
+        const __m256d t = _mm256_div_pd(dr, a);
+        const __m256d u = _mm256_fmsub_pd(t, t, _mm256_set1_pd(1.0));
+
+        return _mm256_and_pd(inside, u);
+}
+
+AVX2 static inline __m256d avx2_distance(__m256d dx, __m256d dy, __m256d dz)
+{
+        __m256d d2 = _mm256_mul_pd(dx, dx);
+        d2 = _mm256_fmadd_pd(dy, dy, d2);
+        d2 = _mm256_fmadd_pd(dz, dz, d2);
+
+        return _mm256_sqrt_pd(d2);
+}
+
+AVX2 static inline double avx2_sum(__m256d v)
+{
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+AVX2 static double pairs_avx2(const real (*x)[3],
+                              const size_t *first, const size_t *second,
+                              const double *d_nat, size_t n, double a)
+{
+        const double *base = &x[0][0];
+        const __m256d va = _mm256_set1_pd(a);
+        __m256d U = _mm256_setzero_pd();
+        size_t k;
+
+        for (k = 0; k + 4 <= n; k += 4) {
+                const __m256i i = avx2_times_three(_mm256_loadu_si256((const __m256i *) (first + k)));
+                const __m256i j = avx2_times_three(_mm256_loadu_si256((const __m256i *) (second + k)));
+
+                const __m256d dx = _mm256_sub_pd(_mm256_i64gather_pd(base + 0, j, 8),
+                                                 _mm256_i64gather_pd(base + 0, i, 8));
+                const __m256d dy = _mm256_sub_pd(_mm256_i64gather_pd(base + 1, j, 8),
+                                                 _mm256_i64gather_pd(base + 1, i, 8));
+                const __m256d dz = _mm256_sub_pd(_mm256_i64gather_pd(base + 2, j, 8),
+                                                 _mm256_i64gather_pd(base + 2, i, 8));
+
+                U = _mm256_add_pd(U, avx2_well(avx2_distance(dx, dy, dz),
+                                               _mm256_loadu_pd(d_nat + k), va));
+        }
+
+        return avx2_sum(U) + pairs_scalar(x, first + k, second + k, d_nat + k, n - k, a);
+}
+
+AVX2 static double row_avx2(const real (*x)[3], const real c[3],
+                            const size_t *partner,
+                            const double *d_nat, size_t n, double a)
+{
+        const double *base = &x[0][0];
+        const __m256d va = _mm256_set1_pd(a);
+        const __m256d cx = _mm256_set1_pd(c[0]);
+        const __m256d cy = _mm256_set1_pd(c[1]);
+        const __m256d cz = _mm256_set1_pd(c[2]);
+        __m256d U = _mm256_setzero_pd();
+        size_t k;
+
+        for (k = 0; k + 4 <= n; k += 4) {
+                const __m256i j = avx2_times_three(_mm256_loadu_si256((const __m256i *) (partner + k)));
+
+                const __m256d dx = _mm256_sub_pd(_mm256_i64gather_pd(base + 0, j, 8), cx);
+                const __m256d dy = _mm256_sub_pd(_mm256_i64gather_pd(base + 1, j, 8), cy);
+                const __m256d dz = _mm256_sub_pd(_mm256_i64gather_pd(base + 2, j, 8), cz);
+
+                U = _mm256_add_pd(U, avx2_well(avx2_distance(dx, dy, dz),
+                                               _mm256_loadu_pd(d_nat + k), va));
+        }
+
+        return avx2_sum(U) + row_scalar(x, c, partner + k, d_nat + k, n - k, a);
+}
+
+#else // SINGLE_PRECISION
+
+AVX2 static inline __m128 avx2_well(__m128 r, __m128 d_nat, __m128 a)
+{
+        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 dr = _mm_sub_ps(r, d_nat);
+        const __m128 inside = _mm_cmp_ps(_mm_and_ps(dr, abs_mask), a, _CMP_LT_OQ);
+        const __m128 t = _mm_div_ps(dr, a);
+        const __m128 u = _mm_fmsub_ps(t, t, _mm_set1_ps(1.0f));
+
+        return _mm_and_ps(inside, u);
+}
+
+AVX2 static inline __m128 avx2_distance(__m128 dx, __m128 dy, __m128 dz)
+{
+        __m128 d2 = _mm_mul_ps(dx, dx);
+        d2 = _mm_fmadd_ps(dy, dy, d2);
+        d2 = _mm_fmadd_ps(dz, dz, d2);
+
+        return _mm_sqrt_ps(d2);
+}
+
+/* Pair energies are single precision, their sum is double. */
+AVX2 static inline __m256d avx2_accumulate(__m256d U, __m128 u)
+{
+        return _mm256_add_pd(U, _mm256_cvtps_pd(u));
+}
+
+AVX2 static inline double avx2_sum(__m256d v)
+{
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+AVX2 static double pairs_avx2(const real (*x)[3],
+                              const size_t *first, const size_t *second,
+                              const double *d_nat, size_t n, double a)
+{
+        const float *base = &x[0][0];
+        const __m128 va = _mm_set1_ps((float) a);
+        __m256d U = _mm256_setzero_pd();
+        size_t k;
+
+        for (k = 0; k + 4 <= n; k += 4) {
+                const __m256i i = avx2_times_three(_mm256_loadu_si256((const __m256i *) (first + k)));
+                const __m256i j = avx2_times_three(_mm256_loadu_si256((const __m256i *) (second + k)));
+
+                const __m128 dx = _mm_sub_ps(_mm256_i64gather_ps(base + 0, j, 4),
+                                             _mm256_i64gather_ps(base + 0, i, 4));
+                const __m128 dy = _mm_sub_ps(_mm256_i64gather_ps(base + 1, j, 4),
+                                             _mm256_i64gather_ps(base + 1, i, 4));
+                const __m128 dz = _mm_sub_ps(_mm256_i64gather_ps(base + 2, j, 4),
+                                             _mm256_i64gather_ps(base + 2, i, 4));
+                const __m128 d = _mm256_cvtpd_ps(_mm256_loadu_pd(d_nat + k));
+
+                U = avx2_accumulate(U, avx2_well(avx2_distance(dx, dy, dz), d, va));
+        }
+
+        return avx2_sum(U) + pairs_scalar(x, first + k, second + k, d_nat + k, n - k, a);
+}
+
+AVX2 static double row_avx2(const real (*x)[3], const real c[3],
+                            const size_t *partner,
+                            const double *d_nat, size_t n, double a)
+{
+        const float *base = &x[0][0];
+        const __m128 va = _mm_set1_ps((float) a);
+        const __m128 cx = _mm_set1_ps(c[0]);
+        const __m128 cy = _mm_set1_ps(c[1]);
+        const __m128 cz = _mm_set1_ps(c[2]);
+        __m256d U = _mm256_setzero_pd();
+        size_t k;
+
+        for (k = 0; k + 4 <= n; k += 4) {
+                const __m256i j = avx2_times_three(_mm256_loadu_si256((const __m256i *) (partner + k)));
+
+                const __m128 dx = _mm_sub_ps(_mm256_i64gather_ps(base + 0, j, 4), cx);
+                const __m128 dy = _mm_sub_ps(_mm256_i64gather_ps(base + 1, j, 4), cy);
+                const __m128 dz = _mm_sub_ps(_mm256_i64gather_ps(base + 2, j, 4), cz);
+                const __m128 d = _mm256_cvtpd_ps(_mm256_loadu_pd(d_nat + k));
+
+                U = avx2_accumulate(U, avx2_well(avx2_distance(dx, dy, dz), d, va));
+        }
+
+        return avx2_sum(U) + row_scalar(x, c, partner + k, d_nat + k, n - k, a);
+}
+
+#endif // SINGLE_PRECISION
+
+static const struct potential_kernels avx2_kernels = {
+        .name = "avx2", .pairs = pairs_avx2, .row = row_avx2
+};
+
+
+
+/*
+ * AVX-512 kernels.  Same as above, eight contacts at a time, with the
+ * well applied through a mask register.
+ */
+
+#define AVX512 __attribute__((target("avx512f")))
+
+/* The gather intrinsics expand to conversions -Wsign-conversion flags. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+
+AVX512 static inline __m512i avx512_times_three(__m512i i)
+{
+        return _mm512_add_epi64(_mm512_slli_epi64(i, 1), i);
+}
+
+#ifndef SINGLE_PRECISION
+
+AVX512 static inline __m512d avx512_accumulate(__m512d U, __m512d r,
+                                               __m512d d_nat, __m512d a)
+{
+        const __m512d dr = _mm512_sub_pd(r, d_nat);
+        const __mmask8 inside = _mm512_cmp_pd_mask(_mm512_abs_pd(dr), a, _CMP_LT_OQ);
+        const __m512d t = _mm512_div_pd(dr, a);
+        const __m512d u = _mm512_fmsub_pd(t, t, _mm512_set1_pd(1.0));
+
+        return _mm512_mask_add_pd(U, inside, U, u);
+}
+
+AVX512 static inline __m512d avx512_distance(__m512d dx, __m512d dy, __m512d dz)
+{
+        __m512d d2 = _mm512_mul_pd(dx, dx);
+        d2 = _mm512_fmadd_pd(dy, dy, d2);
+        d2 = _mm512_fmadd_pd(dz, dz, d2);
+
+        return _mm512_sqrt_pd(d2);
+}
+
+AVX512 static double pairs_avx512(const real (*x)[3],
+                                  const size_t *first, const size_t *second,
+                                  const double *d_nat, size_t n, double a)
+{
+        const double *base = &x[0][0];
+        const __m512d va = _mm512_set1_pd(a);
+        __m512d U = _mm512_setzero_pd();
+        size_t k;
+
+        for (k = 0; k + 8 <= n; k += 8) {
+                const __m512i i = avx512_times_three(_mm512_loadu_si512(first + k));
+                const __m512i j = avx512_times_three(_mm512_loadu_si512(second + k));
+
+                const __m512d dx = _mm512_sub_pd(_mm512_i64gather_pd(j, base + 0, 8),
+                                                 _mm512_i64gather_pd(i, base + 0, 8));
+                const __m512d dy = _mm512_sub_pd(_mm512_i64gather_pd(j, base + 1, 8),
+                                                 _mm512_i64gather_pd(i, base + 1, 8));
+                const __m512d dz = _mm512_sub_pd(_mm512_i64gather_pd(j, base + 2, 8),
+                                                 _mm512_i64gather_pd(i, base + 2, 8));
+
+                U = avx512_accumulate(U, avx512_distance(dx, dy, dz),
+                                      _mm512_loadu_pd(d_nat + k), va);
+        }
+
+        return _mm512_reduce_add_pd(U)
+                + pairs_scalar(x, first + k, second + k, d_nat + k, n - k, a);
+}
+
+AVX512 static double row_avx512(const real (*x)[3], const real c[3],
+                                const size_t *partner,
+                                const double *d_nat, size_t n, double a)
+{
+        const double *base = &x[0][0];
+        const __m512d va = _mm512_set1_pd(a);
+        const __m512d cx = _mm512_set1_pd(c[0]);
+        const __m512d cy = _mm512_set1_pd(c[1]);
+        const __m512d cz = _mm512_set1_pd(c[2]);
+        __m512d U = _mm512_setzero_pd();
+        size_t k;
+
+        for (k = 0; k + 8 <= n; k += 8) {
+                const __m512i j = avx512_times_three(_mm512_loadu_si512(partner + k));
+
+                const __m512d dx = _mm512_sub_pd(_mm512_i64gather_pd(j, base + 0, 8), cx);
+                const __m512d dy = _mm512_sub_pd(_mm512_i64gather_pd(j, base + 1, 8), cy);
+                const __m512d dz = _mm512_sub_pd(_mm512_i64gather_pd(j, base + 2, 8), cz);
+
+                U = avx512_accumulate(U, avx512_distance(dx, dy, dz),
+                                      _mm512_loadu_pd(d_nat + k), va);
+        }
+
+        return _mm512_reduce_add_pd(U)
+                + row_scalar(x, c, partner + k, d_nat + k, n - k, a);
+}
+
+#else // SINGLE_PRECISION
+
+AVX512 static inline __m512d avx512_accumulate(__m512d U, __m256 r,
+                                               __m256 d_nat, __m256 a)
+{
+        const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        const __m256 dr = _mm256_sub_ps(r, d_nat);
+        const __m256 inside = _mm256_cmp_ps(_mm256_and_ps(dr, abs_mask), a, _CMP_LT_OQ);
+        const __m256 t = _mm256_div_ps(dr, a);
+        const __m256 u = _mm256_sub_ps(_mm256_mul_ps(t, t), _mm256_set1_ps(1.0f));
+
+        return _mm512_add_pd(U, _mm512_cvtps_pd(_mm256_and_ps(inside, u)));
+}
+
+AVX512 static inline __m256 avx512_distance(__m256 dx, __m256 dy, __m256 dz)
+{
+        const __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx),
+                                                      _mm256_mul_ps(dy, dy)),
+                                        _mm256_mul_ps(dz, dz));
+
+        return _mm256_sqrt_ps(d2);
+}
+
+AVX512 static double pairs_avx512(const real (*x)[3],
+                                  const size_t *first, const size_t *second,
+                                  const double *d_nat, size_t n, double a)
+{
+        const float *base = &x[0][0];
+        const __m256 va = _mm256_set1_ps((float) a);
+        __m512d U = _mm512_setzero_pd();
+        size_t k;
+
+        for (k = 0; k + 8 <= n; k += 8) {
+                const __m512i i = avx512_times_three(_mm512_loadu_si512(first + k));
+                const __m512i j = avx512_times_three(_mm512_loadu_si512(second + k));
+
+                const __m256 dx = _mm256_sub_ps(_mm512_i64gather_ps(j, base + 0, 4),
+                                                _mm512_i64gather_ps(i, base + 0, 4));
+                const __m256 dy = _mm256_sub_ps(_mm512_i64gather_ps(j, base + 1, 4),
+                                                _mm512_i64gather_ps(i, base + 1, 4));
+                const __m256 dz = _mm256_sub_ps(_mm512_i64gather_ps(j, base + 2, 4),
+                                                _mm512_i64gather_ps(i, base + 2, 4));
+                const __m256 d = _mm512_cvtpd_ps(_mm512_loadu_pd(d_nat + k));
+
+                U = avx512_accumulate(U, avx512_distance(dx, dy, dz), d, va);
+        }
+
+        return _mm512_reduce_add_pd(U)
+                + pairs_scalar(x, first + k, second + k, d_nat + k, n - k, a);
+}
+
+AVX512 static double row_avx512(const real (*x)[3], const real c[3],
+                                const size_t *partner,
+                                const double *d_nat, size_t n, double a)
+{
+        const float *base = &x[0][0];
+        const __m256 va = _mm256_set1_ps((float) a);
+        const __m256 cx = _mm256_set1_ps(c[0]);
+        const __m256 cy = _mm256_set1_ps(c[1]);
+        const __m256 cz = _mm256_set1_ps(c[2]);
+        __m512d U = _mm512_setzero_pd();
+        size_t k;
+
+        for (k = 0; k + 8 <= n; k += 8) {
+                const __m512i j = avx512_times_three(_mm512_loadu_si512(partner + k));
+
+                const __m256 dx = _mm256_sub_ps(_mm512_i64gather_ps(j, base + 0, 4), cx);
+                const __m256 dy = _mm256_sub_ps(_mm512_i64gather_ps(j, base + 1, 4), cy);
+                const __m256 dz = _mm256_sub_ps(_mm512_i64gather_ps(j, base + 2, 4), cz);
+                const __m256 d = _mm512_cvtpd_ps(_mm512_loadu_pd(d_nat + k));
+
+                U = avx512_accumulate(U, avx512_distance(dx, dy, dz), d, va);
+        }
+
+        return _mm512_reduce_add_pd(U)
+                + row_scalar(x, c, partner + k, d_nat + k, n - k, a);
+}
+
+#endif // SINGLE_PRECISION
+
+#pragma GCC diagnostic pop
+
+static const struct potential_kernels avx512_kernels = {
+        .name = "avx512", .pairs = pairs_avx512, .row = row_avx512
+};
+
+#endif // HAVE_X86_KERNELS
+
+
+
+const struct potential_kernels *potential_kernels = &scalar_kernels;
+
+/*
+ * Picks the widest kernels supported by the processor.  The choice can
+ * be overridden with the GO_REPLICANTS_KERNELS environment variable.
+ */
+__attribute__((constructor))
+static void potential_kernels_init(void)
+{
+        const char *name = getenv("GO_REPLICANTS_KERNELS");
+
+        if (name != NULL && potential_kernels_select(name) == 0)
+                return;
+
+#ifdef HAVE_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+                potential_kernels = &avx512_kernels;
+        else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+                potential_kernels = &avx2_kernels;
+#endif
+}
+
+/** Selects the kernels called name ("scalar", "avx2" or "avx512").
+ * Returns -1 if they do not exist or the processor does not support
+ * them. */
+int potential_kernels_select(const char *name)
+{
+        if (strcmp(name, scalar_kernels.name) == 0) {
+                potential_kernels = &scalar_kernels;
+                return 0;
+        }
+
+#ifdef HAVE_X86_KERNELS
+        __builtin_cpu_init();
+        if (strcmp(name, avx2_kernels.name) == 0
+            && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+                potential_kernels = &avx2_kernels;
+                return 0;
+        }
+        if (strcmp(name, avx512_kernels.name) == 0
+            && __builtin_cpu_supports("avx512f")) {
+                potential_kernels = &avx512_kernels;
+                return 0;
+        }
+#endif
+
+        return -1;
+}
@@ -0,0 +1,27 @@
+#ifndef POTENTIAL_KERNELS_H
+#define POTENTIAL_KERNELS_H
+
+/** Batched evaluation of the square well of the Go potential over
+ * native contacts.  The implementations differ only in the instruction
+ * set they use; the widest one supported by the processor is chosen at
+ * start-up. */
+struct potential_kernels {
+        const char *name;
+
+        /** Sum of the wells of contacts (first[k], second[k]). */
+        double (*pairs)(const real (*x)[3],
+                        const size_t *first, const size_t *second,
+                        const double *d_nat, size_t n, double a);
+
+        /** Sum of the wells of contacts between the point c and the
+         * atoms partner[k] of x. */
+        double (*row)(const real (*x)[3], const real c[3],
+                      const size_t *partner,
+                      const double *d_nat, size_t n, double a);
+};
+
+extern const struct potential_kernels *potential_kernels;
+
+extern int potential_kernels_select(const char *name);
+
+#endif // !POTENTIAL_KERNELS_H
@@ -1,42 +1,272 @@
 #include "molecular-simulator.h"
 
 
-static inline double pairwise_potential(const struct protein *self,
-                                        size_t i, size_t j,
-                                        double a, double dnat);
+static inline real distance(const real u[3], const real v[3]);
+static inline size_t lower_bound(const size_t *a, size_t lo, size_t hi,
+                                 size_t key);
 
+/* Long-range contacts handed to the kernels at a time. */
+static const size_t potential_chunk_size = 1024;
 
+/* Neighbours of a moved atom whose distances are kept for its contacts. */
+#define POTENTIAL_MAX_NEAR 64
+
+/* Threads used by each full evaluation. */
+static int potential_num_threads = 1;
+
+
+/** Sets the number of threads that evaluate the long range contacts in
+ * potential().  Only worth it for a program that evaluates a single
+ * protein, such as eval-potential: the simulations run a replica per
+ * thread and refresh their energies too seldom to gain from it. */
+void potential_set_num_threads(int num_threads)
+{
+        potential_num_threads = num_threads > 1 ? num_threads : 1;
+}
+
+static inline real distance(const real u[3], const real v[3])
+{
+        const real dx = v[0] - u[0], dy = v[1] - u[1], dz = v[2] - u[2];
+
+        return real_sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+/*
+ * First position in the sorted array a[lo, hi) whose value is not less
+ * than key.
+ */
+static inline size_t lower_bound(const size_t *a, size_t lo, size_t hi,
+                                 size_t key)
+{
+        while (lo < hi) {
+                const size_t mid = lo + (hi - lo)/2;
+
+                if (a[mid] < key)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return lo;
+}
+
+
+
+/*
+ * Batched kernels of the families without vectorized ones.
+ */
+#define DEFINE_BATCHED_KERNELS(family)                                  \
+static double family ## _pairs(const real (*x)[3],                      \
+                               const size_t *first, const size_t *second, \
+                               const double *d_nat, size_t n,           \
+                               const struct go_potential *g)            \
+{                                                                       \
+        double U = 0.0;                                                 \
+        for (size_t k = 0; k < n; k++)                                  \
+                U += family ## _pair(distance(x[first[k]], x[second[k]]), \
+                                     d_nat[k], g);                      \
+        return U;                                                       \
+}                                                                       \
+                                                                        \
+static double family ## _row(const real (*x)[3], const real c[3],       \
+                             const size_t *partner,                     \
+                             const double *d_nat, size_t n,             \
+                             const struct go_potential *g)              \
+{                                                                       \
+        double U = 0.0;                                                 \
+        for (size_t k = 0; k < n; k++)                                  \
+                U += family ## _pair(distance(c, x[partner[k]]),        \
+                                     d_nat[k], g);                      \
+        return U;                                                       \
+}
+
+
+/* Square well: the vectorized kernels of potential-kernels.c. */
+static inline double square_well_pair(real r, double dnat,
+                                      const struct go_potential *g)
+{
+        const real dr = r - (real) dnat;
+
+        return fabs(dr) < (real) g->a ? -1.0 + gsl_pow_2(dr/g->a) : 0.0;
+}
+
+static inline double square_well_pairs(const real (*x)[3],
+                                       const size_t *first, const size_t *second,
+                                       const double *d_nat, size_t n,
+                                       const struct go_potential *g)
+{
+        return potential_kernels->pairs(x, first, second, d_nat, n, g->a);
+}
+
+static inline double square_well_row(const real (*x)[3], const real c[3],
+                                     const size_t *partner,
+                                     const double *d_nat, size_t n,
+                                     const struct go_potential *g)
+{
+        return potential_kernels->row(x, c, partner, d_nat, n, g->a);
+}
+
+static inline double square_well_min_change(const struct go_potential
+                                             __attribute__((unused)) *g)
+{
+        return -1.0;
+}
+
+#define GO_FAMILY square_well
+#include "potential-family.c"
+
+
+/* Lennard-Jones 12-10.  It is only defined for distances of the same
+ * sign as the native one, so i,i+3 contacts of the wrong chirality do
+ * not attract. */
+static inline double lennard_jones_pair(real r, double dnat,
+                                        const struct go_potential
+                                        __attribute__((unused)) *g)
+{
+        if (r*dnat <= 0.0)
+                return 0.0;
+
+        const double x2 = gsl_pow_2(dnat/r);
+        const double x10 = gsl_pow_5(x2);
+
+        return x10*(5.0*x2 - 6.0);
+}
+
+/* The wall of the well is unbounded: no early termination. */
+static inline double lennard_jones_min_change(const struct go_potential
+                                              __attribute__((unused)) *g)
+{
+        return GSL_NEGINF;
+}
+
+DEFINE_BATCHED_KERNELS(lennard_jones)
+
+#define GO_FAMILY lennard_jones
+#include "potential-family.c"
+
+
+/* Gaussian well of width a. */
+static inline double gaussian_pair(real r, double dnat,
+                                   const struct go_potential *g)
+{
+        return -exp(-0.5*gsl_pow_2((r - dnat)/g->a));
+}
+
+static inline double gaussian_min_change(const struct go_potential
+                                         __attribute__((unused)) *g)
+{
+        return -1.0;
+}
+
+DEFINE_BATCHED_KERNELS(gaussian)
+
+#define GO_FAMILY gaussian
+#include "potential-family.c"
+
+
+/* User supplied well, as a function of the deviation from the native
+ * distance. */
+static inline double tabulated_pair(real r, double dnat,
+                                    const struct go_potential *g)
+{
+        return go_spline_eval(g->table, r - dnat);
+}
+
+static inline double tabulated_min_change(const struct go_potential *g)
+{
+        return g->table->min - g->table->max;
+}
+
+DEFINE_BATCHED_KERNELS(tabulated)
+
+#define GO_FAMILY tabulated
+#include "potential-family.c"
+
+
+
+/** Go potential energy of a conformation. */
 double potential(const struct protein *p,
                  const struct contact_map *native_map,
-                 double a)
-{
-        assert(p != NULL);
-        assert(a > 0.0);
-
-        double U = 0.0;
-        size_t i, j;
-        const size_t N = p->num_atoms;
-#pragma omp parallel for private(i, j) reduction(+:U)
-        for (i = 0; i < N; i++) {
-                for (j = i+2; j < N; j++) {
-                        double d_nat = contact_map_get_distance(native_map, i, j);
-
-                        if (d_nat == 0.0)
-                                continue;
-                        
-                        U += pairwise_potential(p, i, j, a, d_nat);
-                }
+                 const struct go_potential *g)
+{
+        assert(p != NULL && native_map != NULL && g != NULL);
+
+        switch (g->family) {
+        case GO_LENNARD_JONES:
+                return lennard_jones_potential(p, native_map, g);
+        case GO_GAUSSIAN:
+                return gaussian_potential(p, native_map, g);
+        case GO_TABULATED:
+                return tabulated_potential(p, native_map, g);
+        case GO_SQUARE_WELL:
+        default:
+                return square_well_potential(p, native_map, g);
         }
+}
 
-        return U;
+/** Energy difference between the current conformation and the one
+ * recorded in the undo journal.  Only the terms that can have changed
+ * are evaluated: contacts with exactly one end among the moved atoms
+ * and the i,i+3 contacts whose torsion involves a moved atom.  The
+ * movement is assumed to displace the journal range rigidly, as all
+ * the movements in movements.c do. */
+double potential_delta(const struct protein *p,
+                       const struct contact_map *native_map,
+                       const struct go_potential *g)
+{
+        return potential_delta_bounded(p, native_map, g, GSL_POSINF);
 }
 
-static inline double pairwise_potential(const struct protein *p,
-                                        size_t i, size_t j,
-                                        double a, double dnat)
+/** Like potential_delta(), but the evaluation may stop as soon as the
+ * difference is known not to be below bound, in which case a value
+ * not below bound is returned instead of the exact difference. */
+double potential_delta_bounded(const struct protein *p,
+                               const struct contact_map *native_map,
+                               const struct go_potential *g,
+                               double bound)
 {
-        const double r = protein_signum(p, i, j)*protein_distance(p, i, j);
+        assert(p != NULL && native_map != NULL && g != NULL);
 
-        return fabs(r - dnat) < a ? -1.0 + gsl_pow_2((r - dnat)/a)
-                                  :  0.0;
+        switch (g->family) {
+        case GO_LENNARD_JONES:
+                return lennard_jones_potential_delta(p, native_map, g, bound);
+        case GO_GAUSSIAN:
+                return gaussian_potential_delta(p, native_map, g, bound);
+        case GO_TABULATED:
+                return tabulated_potential_delta(p, native_map, g, bound);
+        case GO_SQUARE_WELL:
+        default:
+                return square_well_potential_delta(p, native_map, g, bound);
+        }
+}
+
+/** Checks a movement for overlaps and computes its energy difference
+ * in a single pass.  If the movement makes the protein overlap itself,
+ * overlapping is set and the difference is meaningless; otherwise this
+ * is potential_delta_bounded().  Movements of a single atom must not
+ * have been checked already (see protein_propose_natural_movement());
+ * those of more atoms must have been. */
+double potential_delta_checked(const struct protein *p,
+                               const struct contact_map *native_map,
+                               const struct go_potential *g,
+                               double bound, bool *overlapping)
+{
+        assert(p != NULL && native_map != NULL && g != NULL);
+        assert(overlapping != NULL);
+
+        switch (g->family) {
+        case GO_LENNARD_JONES:
+                return lennard_jones_potential_delta_checked(p, native_map, g,
+                                                             bound, overlapping);
+        case GO_GAUSSIAN:
+                return gaussian_potential_delta_checked(p, native_map, g,
+                                                        bound, overlapping);
+        case GO_TABULATED:
+                return tabulated_potential_delta_checked(p, native_map, g,
+                                                         bound, overlapping);
+        case GO_SQUARE_WELL:
+        default:
+                return square_well_potential_delta_checked(p, native_map, g,
+                                                           bound, overlapping);
+        }
 }
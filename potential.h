@@ -5,9 +5,27 @@ struct protein;
 
 struct contact_map;
 
+struct go_potential;
+
 
 extern double potential(const struct protein *p,
                         const struct contact_map *native_map,
-                        double a);
+                        const struct go_potential *g);
+
+extern double potential_delta(const struct protein *p,
+                              const struct contact_map *native_map,
+                              const struct go_potential *g);
+
+extern double potential_delta_bounded(const struct protein *p,
+                                      const struct contact_map *native_map,
+                                      const struct go_potential *g,
+                                      double bound);
+
+extern double potential_delta_checked(const struct protein *p,
+                                      const struct contact_map *native_map,
+                                      const struct go_potential *g,
+                                      double bound, bool *overlapping);
+
+extern void potential_set_num_threads(int num_threads);
 
 #endif // POTENTIAL_H
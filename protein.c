@@ -1,6 +1,14 @@
 #include "molecular-simulator.h"
 
 
+static void protein_bind(struct protein *self);
+static void protein_refresh_torsions(struct protein *self);
+static void protein_update_torsions(struct protein *self);
+static void torsions_around(const struct protein *self,
+                            size_t start, size_t end,
+                            size_t *first, size_t *last);
+
+
 struct protein *new_protein(size_t num_atoms, const double *atom)
 {
         struct protein *m;
@@ -8,30 +16,65 @@ struct protein *new_protein(size_t num_atoms, const double *atom)
         if (num_atoms == 0 || atom == NULL)
                 return NULL;
 
-        m = malloc(sizeof(struct protein) + num_atoms*sizeof(gsl_vector *));
+        m = cache_aligned_alloc(protein_size(num_atoms));
         if (m == NULL)
                 return NULL;
 
         m->num_atoms = num_atoms;
+        protein_bind(m);
+        protein_forget(m);
 
-        for (size_t i = 0; i < m->num_atoms; i++) {
-                m->atom[i] = gsl_vector_alloc(3);
+        for (size_t i = 0; i < num_atoms; i++)
                 for (size_t j = 0; j < 3; j++)
-                        gsl_vector_set(m->atom[i], j, atom[3*i + j]);
-        }
+                        m->atom[i][j] = (real) atom[3*i + j];
+        protein_refresh_torsions(m);
+        cell_list_build(&m->cells, (const real (*)[3]) m->atom, num_atoms);
+        chain_tree_build(&m->tree, (const real (*)[3]) m->atom);
 
         return m;
 }
 
 #include "sample-proteins.c"
 
+/*
+ * The header of the structure is followed, at the next cache line
+ * boundary, by the coordinates of the atoms and their torsions, then
+ * by the undo journal, laid out the same way, and finally by the
+ * arrays of the cell list and the nodes of the chain tree.
+ */
+size_t protein_size(size_t num_atoms)
+{
+        return cache_line_round_up(sizeof(struct protein))
+                + 2*cache_line_round_up(num_atoms*3*sizeof(real))
+                + 2*cache_line_round_up(num_atoms*sizeof(real))
+                + cell_list_size(num_atoms)
+                + chain_tree_size(num_atoms);
+}
+
+void protein_bind(struct protein *self)
+{
+        char *base = (char *) self;
+        const size_t coords_size = cache_line_round_up(self->num_atoms*3*sizeof(real));
+        const size_t torsions_size = cache_line_round_up(self->num_atoms*sizeof(real));
+
+        base += cache_line_round_up(sizeof(struct protein));
+        self->atom = (real (*)[3]) base;
+        base += coords_size;
+        self->torsion = (real *) base;
+        base += torsions_size;
+        self->journal.atom = (real (*)[3]) base;
+        base += coords_size;
+        self->journal.torsion = (real *) base;
+        base += torsions_size;
+        cell_list_bind(&self->cells, self->num_atoms, protein_bead_diameter, base);
+        base += cell_list_size(self->num_atoms);
+        chain_tree_bind(&self->tree, self->num_atoms, base);
+}
+
 void delete_protein(struct protein *self)
 {
         assert(self != NULL);
-        assert(self->atom != NULL);
 
-        for (size_t i = 0; i < self->num_atoms; i++)
-                gsl_vector_free(self->atom[i]);
         free(self);
 }
 
@@ -40,24 +83,201 @@ struct protein *protein_dup(const struct protein *self)
         if (self == NULL)
                 return NULL;
 
-        struct protein *p = malloc(sizeof(struct protein)
-                                   + self->num_atoms*sizeof(gsl_vector *));
+        struct protein *p = cache_aligned_alloc(protein_size(self->num_atoms));
 
         assert(p != NULL);
 
-        /* XXX This can be sped up by allocating a large gsl_block
-         * beforehand.
-         */
-        p->num_atoms = self->num_atoms;
+        memcpy(p, self, protein_size(self->num_atoms));
+        protein_bind(p);
+
+        return p;
+}
+
+/** Duplicates a protein inside an arena.  The copy is released
+ * together with the arena and must not be passed to delete_protein. */
+struct protein *protein_dup_in(const struct protein *self,
+                               struct arena *arena)
+{
+        if (self == NULL)
+                return NULL;
+
+        struct protein *p = arena_alloc(arena, protein_size(self->num_atoms));
+        if (p == NULL)
+                return NULL;
+
+        memcpy(p, self, protein_size(self->num_atoms));
+        protein_bind(p);
+
+        return p;
+}
+
+/** Copies the conformation of src into dest.  Both proteins must have
+ * the same number of atoms. */
+void protein_copy(struct protein *dest, const struct protein *src)
+{
+        assert(dest != NULL && src != NULL);
+        assert(dest->num_atoms == src->num_atoms);
+
+        memcpy(dest->atom, src->atom, src->num_atoms*sizeof(src->atom[0]));
+        memcpy(dest->torsion, src->torsion, src->num_atoms*sizeof(src->torsion[0]));
+        memcpy(dest->cells.head, src->cells.head, cell_list_size(src->num_atoms));
+        memcpy(dest->tree.lo, src->tree.lo, chain_tree_size(src->num_atoms));
+        protein_forget(dest);
+}
+
+/** Exchanges the conformations of two proteins with the same number of
+ * atoms.  The proteins themselves stay where they are in memory. */
+void protein_swap(struct protein *p, struct protein *q)
+{
+        assert(p != NULL && q != NULL);
+        assert(p->num_atoms == q->num_atoms);
+
         for (size_t i = 0; i < p->num_atoms; i++) {
-                p->atom[i] = gsl_vector_alloc(3);
-                gsl_vector_memcpy(p->atom[i], self->atom[i]);
+                for (size_t j = 0; j < 3; j++) {
+                        const real x = p->atom[i][j];
+                        p->atom[i][j] = q->atom[i][j];
+                        q->atom[i][j] = x;
+                }
+
+                const real t = p->torsion[i];
+                p->torsion[i] = q->torsion[i];
+                q->torsion[i] = t;
         }
 
-        return p;
+        cell_list_build(&p->cells, (const real (*)[3]) p->atom, p->num_atoms);
+        cell_list_build(&q->cells, (const real (*)[3]) q->atom, q->num_atoms);
+        chain_tree_build(&p->tree, (const real (*)[3]) p->atom);
+        chain_tree_build(&q->tree, (const real (*)[3]) q->atom);
+        protein_forget(p);
+        protein_forget(q);
 }
 
-
+
+
+/** Records the current positions of the atoms in [start, end) before
+ * a movement modifies them.  Only the last recorded range is kept. */
+void protein_save_atoms(struct protein *self, size_t start, size_t end)
+{
+        assert(start < end && end <= self->num_atoms);
+
+        struct protein_journal *j = &self->journal;
+
+        j->start = start;
+        j->end = end;
+        memcpy(j->atom[start], self->atom[start], (end - start)*sizeof(self->atom[0]));
+
+        size_t first, last;
+        torsions_around(self, start, end, &first, &last);
+        if (first < last)
+                memcpy(&j->torsion[first], &self->torsion[first],
+                       (last - first)*sizeof(self->torsion[0]));
+}
+
+/** Restores the atoms modified by the last movement. */
+void protein_undo(struct protein *self)
+{
+        struct protein_journal *j = &self->journal;
+
+        if (j->start < j->end) {
+                memcpy(self->atom[j->start], j->atom[j->start],
+                       (j->end - j->start)*sizeof(self->atom[0]));
+
+                size_t first, last;
+                torsions_around(self, j->start, j->end, &first, &last);
+                if (first < last)
+                        memcpy(&self->torsion[first], &j->torsion[first],
+                               (last - first)*sizeof(self->torsion[0]));
+
+                cell_list_update(&self->cells, (const real (*)[3]) self->atom,
+                                 j->start, j->end);
+                chain_tree_update(&self->tree, (const real (*)[3]) self->atom,
+                                  j->start, j->end);
+        }
+
+        protein_forget(self);
+}
+
+/** Sum of the squared displacements of the atoms moved by the last
+ * movement. */
+double protein_displacement(const struct protein *self)
+{
+        const struct protein_journal *j = &self->journal;
+        double d = 0.0;
+
+        for (size_t i = j->start; i < j->end; i++)
+                for (size_t k = 0; k < 3; k++)
+                        d += gsl_pow_2(self->atom[i][k] - j->atom[i][k]);
+
+        return d;
+}
+
+/** Empties the journal, making the last movement permanent. */
+void protein_forget(struct protein *self)
+{
+        self->journal.start = self->journal.end = 0;
+}
+
+
+
+static inline real signed_torsion(const struct protein *self, size_t i)
+{
+        return (real) chirality(self->atom[i], self->atom[i+1],
+                                self->atom[i+2], self->atom[i+3])
+                * (real) protein_distance(self, i, i+3);
+}
+
+/*
+ * Torsions (i, ..., i+3), i in [first, last), with at least one atom in
+ * [start, end).
+ */
+void torsions_around(const struct protein *self, size_t start, size_t end,
+                     size_t *first, size_t *last)
+{
+        const size_t N = self->num_atoms;
+
+        *first = start >= 3 ? start - 3 : 0;
+        *last = N < 4 ? 0 : GSL_MIN(end, N - 3);
+}
+
+void protein_refresh_torsions(struct protein *self)
+{
+        for (size_t i = 0; i + 3 < self->num_atoms; i++)
+                self->torsion[i] = signed_torsion(self, i);
+}
+
+/*
+ * Movements displace the journal range rigidly, so only the torsions
+ * that straddle one of its ends (at most three on each side) have to be
+ * recomputed.
+ */
+void protein_update_torsions(struct protein *self)
+{
+        const size_t start = self->journal.start, end = self->journal.end;
+        size_t first, last;
+
+        torsions_around(self, start, end, &first, &last);
+
+        /* Torsions that begin before the range... */
+        for (size_t i = first; i < GSL_MIN(start, last); i++)
+                self->torsion[i] = signed_torsion(self, i);
+
+        /* ...and those that begin inside it but end after it. */
+        for (size_t i = GSL_MAX(start, end >= 3 ? end - 3 : 0); i < last; i++)
+                self->torsion[i] = signed_torsion(self, i);
+}
+
+/** Brings the cached torsions and the spatial indices up to date after
+ * a movement has changed the atoms recorded in the journal. */
+void protein_update(struct protein *self)
+{
+        protein_update_torsions(self);
+        cell_list_update(&self->cells, (const real (*)[3]) self->atom,
+                         self->journal.start, self->journal.end);
+        chain_tree_update(&self->tree, (const real (*)[3]) self->atom,
+                          self->journal.start, self->journal.end);
+}
+
+
 
 struct protein *protein_read_xyz_file(const char *name)
 {
@@ -146,9 +366,9 @@ int protein_write_xyz(const struct protein *self, FILE *stream)
                         "Protein\n", self->num_atoms);
         for (size_t i = 0; i < self->num_atoms; i++) {
                 status = fprintf(stream, "CA %g %g %g\n",
-                                 gsl_vector_get(self->atom[i], 0),
-                                 gsl_vector_get(self->atom[i], 1),
-                                 gsl_vector_get(self->atom[i], 2));
+                                 self->atom[i][0],
+                                 self->atom[i][1],
+                                 self->atom[i][2]);
                 if (status < 0)
                         return -1;
                 n += status;
@@ -189,9 +409,9 @@ void protein_plot(const struct protein *self, FILE *gnuplot, bool draw_labels,
         if (draw_labels)
                 for (size_t i = 0; i < self->num_atoms; i++)
                         fprintf(gnuplot, "set label '%u' at %f, %f, %f\n", i,
-                                gsl_vector_get(self->atom[i], 0),
-                                gsl_vector_get(self->atom[i], 1),
-                                gsl_vector_get(self->atom[i], 2));
+                                self->atom[i][0],
+                                self->atom[i][1],
+                                self->atom[i][2]);
 
         fflush(gnuplot);
 }
@@ -202,9 +422,9 @@ int protein_print_atoms(const struct protein *self, FILE *stream)
 
         for (size_t i = 0; i < self->num_atoms; i++) {
                 status = fprintf(stream, "%f %f %f\n",
-                                 gsl_vector_get(self->atom[i], 0),
-                                 gsl_vector_get(self->atom[i], 1),
-                                 gsl_vector_get(self->atom[i], 2));
+                                 self->atom[i][0],
+                                 self->atom[i][1],
+                                 self->atom[i][2]);
                 if (status < 0)
                         return -1;
                 n += status;
@@ -217,43 +437,9 @@ int protein_print_atoms(const struct protein *self, FILE *stream)
 
 double protein_signum(const struct protein *self, size_t i, size_t j)
 {
-        if (abs((int) (i - j)) == 3) { /* XXX We don't need this check if we make sure j > i */
-                gsl_vector *v0 = self->atom[i];
-                gsl_vector *v1 = self->atom[i+1];
-                gsl_vector *v2 = self->atom[i+2];
-                gsl_vector *v3 = self->atom[i+3];
-
-                double uu[3], vv[3], ww[3];
-                gsl_vector_view u = gsl_vector_view_array((double *) &uu, 3);
-                gsl_vector_view v = gsl_vector_view_array((double *) &vv, 3);
-                gsl_vector_view w = gsl_vector_view_array((double *) &ww, 3);
-
-                gsl_vector_memcpy(&u.vector, v1);
-                gsl_vector_memcpy(&v.vector, v2);
-                gsl_vector_memcpy(&w.vector, v3);
-
-                gsl_vector_sub(&u.vector, v0);
-                gsl_vector_sub(&v.vector, v1);
-                gsl_vector_sub(&w.vector, v2);
-
-                /* XXX Should we check that this is not zero? */
-                return signbit(triple_scalar_product(&u.vector, &v.vector, &w.vector)) != 0 ? -1.0 : 1.0;
-        } else {
+        if (abs((int) (i - j)) == 3) /* XXX We don't need this check if we make sure j > i */
+                return chirality(self->atom[i], self->atom[i+1],
+                                 self->atom[i+2], self->atom[i+3]);
+        else
                 return 1.0;
-        }
-}
-
-double protein_distance(const struct protein *self,
-                        size_t i, size_t j)
-{
-        assert(self != NULL);
-        assert(i < self->num_atoms);
-        assert(j < self->num_atoms);
-
-        double data[] = {0, 0, 0};
-        gsl_vector_view v = gsl_vector_view_array((double *) &data, 3);
-        gsl_vector_memcpy(&v.vector, self->atom[j]);
-        gsl_vector_sub(&v.vector, self->atom[i]);
-
-        return gsl_blas_dnrm2(&v.vector);
 }
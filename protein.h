@@ -4,21 +4,64 @@
 #include "movements.h"
 
 
-/** Coarse-grained protein structure. */
+/** Undo journal.  Movements are applied in place and the journal
+ * keeps the previous positions of the atoms they touched so that a
+ * rejected movement can be rolled back. */
+struct protein_journal {
+        /** First atom modified by the last movement. */
+        size_t start;
+        /** One past the last atom modified by the last movement. */
+        size_t end;
+        /** Previous positions, indexed like the atoms themselves. */
+        real (*atom)[3];
+        /** Previous signed i,i+3 distances of the torsions around
+         * [start, end), indexed like the torsions themselves. */
+        real *torsion;
+};
+
+/** Coarse-grained protein structure.  The structure, its coordinates,
+ * its cached torsions, its undo journal and its spatial indices live in
+ * a single cache-aligned allocation so that a conformation can be duplicated
+ * with one malloc and one memcpy. */
 struct protein {
         /** Number of alpha carbons. */
         size_t num_atoms;
-        /** Array of vectors containing the position of each atom. */
-        gsl_vector *atom[];
+        /** Position of each atom (packed x, y, z triples). */
+        real (*atom)[3];
+        /** Distance between atoms i and i+3 times the chirality of the
+         * torsion they delimit, kept up to date by the movements. */
+        real *torsion;
+        /** Atoms touched by the last movement. */
+        struct protein_journal journal;
+        /** Atoms by bead-sized cell, for the overlap checks. */
+        struct cell_list cells;
+        /** Bounding spheres of segments, for the overlap checks of
+         * movements of whole tails. */
+        struct chain_tree tree;
 };
 
 
+struct arena;
+
+
 /* Allocation and deallocation of protein data structures. */
 extern struct protein *new_protein(size_t num_atoms, const double *atom);
 extern struct protein *new_protein_1pgb(void);
 extern struct protein *new_protein_2gb1(void);
 extern void delete_protein(struct protein *self);
 extern struct protein *protein_dup(const struct protein *self);
+extern struct protein *protein_dup_in(const struct protein *self,
+                                      struct arena *arena);
+extern size_t protein_size(size_t num_atoms);
+extern void protein_copy(struct protein *dest, const struct protein *src);
+extern void protein_swap(struct protein *p, struct protein *q);
+
+/* Undo journal. */
+extern void protein_save_atoms(struct protein *self, size_t start, size_t end);
+extern void protein_undo(struct protein *self);
+extern void protein_forget(struct protein *self);
+extern double protein_displacement(const struct protein *self);
+extern void protein_update(struct protein *self);
 
 /* Input/Output functions. */
 extern struct protein *protein_read_xyz_file(const char *name);
@@ -35,6 +78,19 @@ extern void protein_plot(const struct protein *self, FILE *gnuplot,
 
 /* Geometry functions. */
 extern double protein_signum(const struct protein *self, size_t i, size_t j);
-extern double protein_distance(const struct protein *self, size_t i, size_t j);
+
+static inline double protein_distance(const struct protein *self,
+                                      size_t i, size_t j)
+{
+        assert(self != NULL);
+        assert(i < self->num_atoms);
+        assert(j < self->num_atoms);
+
+        const real *u = self->atom[i];
+        const real *v = self->atom[j];
+        const real dx = v[0] - u[0], dy = v[1] - u[1], dz = v[2] - u[2];
+
+        return real_sqrt(dx*dx + dy*dy + dz*dz);
+}
 
 #endif // !PROTEIN_H
@@ -0,0 +1,136 @@
+#include "molecular-simulator.h"
+
+
+/* Constants of Salmon et al., "Parallel random numbers: as easy as
+ * 1, 2, 3" (SC'11). */
+static const uint32_t philox_m0 = 0xD2511F53, philox_m1 = 0xCD9E8D57;
+static const uint32_t philox_w0 = 0x9E3779B9, philox_w1 = 0xBB67AE85;
+enum { philox_rounds = 10 };
+
+struct philox_state {
+        uint32_t key[2];
+        uint64_t stream;        /* High half of the counter. */
+        uint64_t block;         /* Low half of the counter of the next batch. */
+        size_t next;            /* Next unused word of the buffer. */
+        uint32_t buffer[4*RANDOM_STREAM_BATCH];
+};
+
+static void philox_refill(struct philox_state *s);
+static void philox_set(void *vstate, unsigned long seed);
+static unsigned long philox_get(void *vstate);
+static double philox_get_double(void *vstate);
+
+
+static const gsl_rng_type philox_type = {
+        "philox4x32-10", 0xffffffffUL, 0, sizeof(struct philox_state),
+        &philox_set, &philox_get, &philox_get_double
+};
+
+const gsl_rng_type *random_stream_philox = &philox_type;
+
+
+
+static inline uint32_t mulhilo(uint32_t a, uint32_t b, uint32_t *hi)
+{
+        const uint64_t p = (uint64_t) a*b;
+
+        *hi = (uint32_t) (p >> 32);
+        return (uint32_t) p;
+}
+
+/*
+ * Generates the whole buffer.  The rounds are applied to all the blocks
+ * of the batch in lockstep, lanes innermost, so that the compiler can
+ * vectorize them.
+ */
+void philox_refill(struct philox_state *s)
+{
+        uint32_t c0[RANDOM_STREAM_BATCH], c1[RANDOM_STREAM_BATCH];
+        uint32_t c2[RANDOM_STREAM_BATCH], c3[RANDOM_STREAM_BATCH];
+
+        for (size_t j = 0; j < RANDOM_STREAM_BATCH; j++) {
+                const uint64_t block = s->block + j;
+                c0[j] = (uint32_t) block, c1[j] = (uint32_t) (block >> 32);
+                c2[j] = (uint32_t) s->stream, c3[j] = (uint32_t) (s->stream >> 32);
+        }
+
+        uint32_t k0 = s->key[0], k1 = s->key[1];
+        for (int round = 0; round < philox_rounds; round++) {
+                for (size_t j = 0; j < RANDOM_STREAM_BATCH; j++) {
+                        uint32_t hi0, hi1;
+                        const uint32_t lo0 = mulhilo(philox_m0, c0[j], &hi0);
+                        const uint32_t lo1 = mulhilo(philox_m1, c2[j], &hi1);
+
+                        c0[j] = hi1 ^ c1[j] ^ k0;
+                        c1[j] = lo1;
+                        c2[j] = hi0 ^ c3[j] ^ k1;
+                        c3[j] = lo0;
+                }
+                k0 += philox_w0, k1 += philox_w1;
+        }
+
+        for (size_t j = 0; j < RANDOM_STREAM_BATCH; j++) {
+                s->buffer[4*j] = c0[j], s->buffer[4*j + 1] = c1[j];
+                s->buffer[4*j + 2] = c2[j], s->buffer[4*j + 3] = c3[j];
+        }
+
+        s->block += RANDOM_STREAM_BATCH;
+        s->next = 0;
+}
+
+/* gsl_rng_set() keys the generator with seed and selects stream 0. */
+void philox_set(void *vstate, unsigned long seed)
+{
+        struct philox_state *s = vstate;
+
+        s->key[0] = (uint32_t) seed;
+        s->key[1] = (uint32_t) ((uint64_t) seed >> 32);
+        s->stream = 0;
+        s->block = 0;
+        s->next = 4*RANDOM_STREAM_BATCH;
+}
+
+unsigned long philox_get(void *vstate)
+{
+        struct philox_state *s = vstate;
+
+        if (s->next == 4*RANDOM_STREAM_BATCH)
+                philox_refill(s);
+
+        return s->buffer[s->next++];
+}
+
+double philox_get_double(void *vstate)
+{
+        return (double) philox_get(vstate)/4294967296.0;
+}
+
+
+
+/** Keys a generator of type random_stream_philox with the master seed
+ * and rewinds it to the start of the given stream. */
+void random_stream_set(const gsl_rng *r, unsigned long seed,
+                       unsigned long stream)
+{
+        assert(r != NULL && r->type == random_stream_philox);
+
+        struct philox_state *s = r->state;
+
+        philox_set(s, seed);
+        s->stream = stream;
+}
+
+/** One block of Philox4x32-10: the four words of the stream keyed by
+ * key at position counter. */
+void random_stream_block(const uint32_t key[2], const uint32_t counter[4],
+                         uint32_t out[4])
+{
+        struct philox_state s;
+
+        philox_set(&s, key[0] | (uint64_t) key[1] << 32);
+        s.block = counter[0] | (uint64_t) counter[1] << 32;
+        s.stream = counter[2] | (uint64_t) counter[3] << 32;
+        philox_refill(&s);
+
+        memcpy(out, s.buffer, 4*sizeof(uint32_t));
+}
@@ -0,0 +1,20 @@
+#ifndef RANDOM_STREAM_H
+#define RANDOM_STREAM_H
+
+/** Philox4x32-10 counter-based generator as a GSL generator type.  The
+ * output is a pure function of a 64-bit key (the master seed), a 64-bit
+ * stream number and the position in the stream, so that every replica
+ * draws from its own stream whatever the thread that runs it.  Blocks
+ * are generated RANDOM_STREAM_BATCH at a time into a buffer kept in the
+ * generator state. */
+#define RANDOM_STREAM_BATCH 16
+
+extern const gsl_rng_type *random_stream_philox;
+
+extern void random_stream_set(const gsl_rng *r, unsigned long seed,
+                              unsigned long stream);
+
+extern void random_stream_block(const uint32_t key[2],
+                                const uint32_t counter[4], uint32_t out[4]);
+
+#endif // !RANDOM_STREAM_H
@@ -1,13 +1,91 @@
 #include "molecular-simulator.h"
 
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
 
 const size_t save_energy_step = 1000;
 const size_t save_conformation_step = 5000;
 
+/* Sweeps of every replica between two exchange attempts. */
+static const size_t sweeps_per_iteration = 5000;
+
+/* Sweeps a replica runs before its thread looks for other work. */
+static const size_t sweeps_per_slice = 250;
+
+/* Least shortening of the blocks worth moving replicas between threads. */
+static const double rebalance_gain = 0.05;
+
+/* Most replicas a tuned ladder may have. */
+static const size_t max_ladder_size = 256;
+
+/*
+ * Handshake between replicas k and k+1 in asynchronous mode.  Both
+ * counters only grow (they hold the last round plus one), so they need
+ * neither a lock nor a reset: the upper replica announces that it has
+ * stopped at the exchange point of a round, and the lower one, which
+ * decides the exchange, that it is done with the pair.  Each slot has
+ * a cache line of its own.
+ */
+struct exchange_slot {
+        size_t arrived;
+        size_t done;
+        char padding[CACHE_LINE_SIZE - 2*sizeof(size_t)];
+};
+
+/*
+ * Block of sweeps being run by the threads of run_blocks(), over the
+ * replicas of one or more jobs.  Between blocks it belongs to the
+ * thread running the exchanges; within one it is only touched in the
+ * replicas_schedule critical section.
+ */
+struct block {
+        struct replicas **jobs;
+        size_t num_jobs;
+        size_t num_replicas;    /* Over all the jobs. */
+        int num_threads;
+        struct simulation **replica;    /* Every replica of every job. */
+        size_t *job;            /* Job of each replica. */
+        double *cost;           /* Seconds per sweep of each, as last measured. */
+        int *home;              /* Thread that runs each. */
+        size_t num_sweeps;
+        size_t num_slices;
+        bool skip_first;        /* Do not save after the first sweep. */
+        size_t *next_slice;     /* Next slice of each replica to run. */
+        bool *busy;             /* Whether a thread is running each replica. */
+        size_t released;        /* Slices run to the end so far. */
+        double *spent;          /* Seconds each replica has run. */
+        size_t stolen;          /* Slices run away from their replica's thread. */
+        double start;
+};
+
 static bool options_are_invalid(const struct simulation_options *options);
-static void replicas_exchange(struct replicas *self, size_t k);
+static void replicas_exchange(struct replicas *self, size_t k, gsl_rng *rng);
+static void exchange_stage(struct replicas *self);
+static void attempt_exchange(struct replicas *self, size_t i, size_t j,
+                             double energy[], size_t source[]);
+static void permute_conformations(struct replicas *self,
+                                  const size_t source[]);
+static bool run_asynchronously(struct replicas *self, size_t num_iters);
+static void run_replica(struct replicas *self, size_t k, size_t num_iters);
+static void wait_for(const size_t *counter, size_t value);
+static void run_blocks(struct replicas *jobs[], size_t num_jobs,
+                       const struct threading *threading, size_t num_blocks,
+                       size_t num_sweeps, bool exchange, bool skip_first);
+static void start_block(struct block *b);
+static void work_on_block(struct block *b, int thread);
+static void finish_block(struct block *b);
+static void assign_replicas(struct block *b);
+static size_t pick_replica(const struct block *b, int thread, bool *finished);
+static int thread_num(void);
 static void save_energy(const struct replicas *self);
 static void save_conformation(const struct replicas *self);
+static void save_replica_energy(const struct simulation *s);
+static void save_replica_conformation(const struct simulation *s);
+static struct replicas *replicas_resize(struct replicas *self,
+                                        const double temperatures[], size_t n);
+static int compare_samples(const void *a, const void *b);
 
 /* XXX Replicas should be responsible for allocating and freeing the
  * protein structure.  */
@@ -31,23 +109,93 @@ struct replicas *new_replicas(struct protein *protein,
                 free(r);
                 return NULL;
         }
-        r->a = options->a;
+        r->go.family = options->family;
+        r->go.a = options->a;
+        r->go.table = options->table;
         r->num_replicas = options->num_replicas;
-        r->exchanges = calloc(r->num_replicas, sizeof(size_t));
-        r->total = calloc(r->num_replicas, sizeof(size_t));
+        /* Keep the exchange statistics away from any cache line that
+         * the worker threads write to. */
+        r->exchanges = cache_aligned_alloc(r->num_replicas*sizeof(size_t));
+        r->total = cache_aligned_alloc(r->num_replicas*sizeof(size_t));
         if (r->exchanges == NULL || r->total == NULL) {
                 delete_replicas(r);
                 return NULL;
         }
-        if ((r->log = fopen("replicas.log", "a")) == NULL)
+        memset(r->exchanges, 0, r->num_replicas*sizeof(size_t));
+        memset(r->total, 0, r->num_replicas*sizeof(size_t));
+        const size_t num_pairs = r->num_replicas*r->num_replicas;
+        r->pair_exchanges = calloc(num_pairs, sizeof(size_t));
+        r->pair_total = calloc(num_pairs, sizeof(size_t));
+        if (r->pair_exchanges == NULL || r->pair_total == NULL) {
                 delete_replicas(r);
-        for (size_t k = 0; k < r->num_replicas; k++) {
-                r->replica[k] = new_simulation(r->native_map, r->a,
-                                               options->temperatures[k], r->rng);
-                if (r->replica[k] == NULL) {
-                        delete_replicas(r);
-                        return NULL;
-                }
+                return NULL;
+        }
+        r->exchange_rounds = options->exchange_rounds > 0 ? options->exchange_rounds : 1;
+        r->sweep_cost = calloc(r->num_replicas, sizeof(double));
+        r->home = malloc(r->num_replicas*sizeof(int));
+        if (r->sweep_cost == NULL || r->home == NULL) {
+                delete_replicas(r);
+                return NULL;
+        }
+        for (size_t k = 0; k < r->num_replicas; k++)
+                r->home[k] = -1;
+        r->any_pair = options->any_pair;
+        r->asynchronous = options->asynchronous;
+        r->round = 0;
+        r->slots = cache_aligned_alloc(r->num_replicas*sizeof(struct exchange_slot));
+        if (r->slots == NULL) {
+                delete_replicas(r);
+                return NULL;
+        }
+        memset(r->slots, 0, r->num_replicas*sizeof(struct exchange_slot));
+        if (options->directory != NULL
+            && (r->directory = strdup(options->directory)) == NULL) {
+                delete_replicas(r);
+                return NULL;
+        }
+        char log[PATH_MAX];
+        snprintf(log, sizeof(log), "%s/replicas.log",
+                 r->directory != NULL ? r->directory : ".");
+        if ((r->log = fopen(log, "a")) == NULL) {
+                delete_replicas(r);
+                return NULL;
+        }
+
+        r->num_threads = options->num_threads;
+        r->seed = options->seed;
+        r->next_stream = options->stream_offset + r->num_replicas + 1;
+        r->huge_pages = options->huge_pages;
+        r->binding = options->binding;
+        r->threading = threading_plan(r->num_threads, r->num_replicas);
+        r->threading.binding = r->binding;
+        threading_apply(&r->threading);
+        fprintf(r->log, "threading: %d replica thread(s), one replica "
+                "each at a time, pinned to %s.\n", r->threading.replica_threads,
+                threading_binding_name(r->binding));
+        fprintf(r->log, "seed: %lu.\n", options->seed);
+
+        /*
+         * Each replica is created by the thread that will first run it
+         * (see assign_replicas()), pinned already, so that its arena is
+         * first touched from the right NUMA node.
+         */
+        bool failed = false;
+        size_t k;
+#pragma omp parallel for private(k) schedule(static) reduction(||:failed) \
+        num_threads(r->threading.replica_threads)
+        for (k = 0; k < r->num_replicas; k++) {
+                threading_pin(&r->threading, thread_num());
+                r->replica[k] = new_simulation(r->native_map, &r->go,
+                                               options->temperatures[k],
+                                               options->seed,
+                                               options->stream_offset + k + 1,
+                                               r->directory, options->huge_pages);
+                if (r->replica[k] == NULL)
+                        failed = true;
+        }
+        if (failed) {
+                delete_replicas(r);
+                return NULL;
         }
 
         return r;
@@ -57,7 +205,9 @@ bool options_are_invalid(const struct simulation_options *options)
 {
         return (options == NULL
                 || options->rng == NULL || options->num_replicas == 0
-                || options->d_max <= 0.0 || options->a <= 0.0);
+                || options->d_max <= 0.0
+                || (options->family != GO_LENNARD_JONES && options->a <= 0.0)
+                || (options->family == GO_TABULATED && options->table == NULL));
 }
 
 
@@ -71,6 +221,12 @@ void delete_replicas(struct replicas *self)
                 free(self->exchanges);
         if (self->total != NULL)
                 free(self->total);
+        free(self->pair_exchanges);
+        free(self->pair_total);
+        free(self->sweep_cost);
+        free(self->home);
+        if (self->slots != NULL)
+                free(self->slots);
         if (self->native_map != NULL)
                 delete_contact_map(self->native_map);
         /* XXX: If new_replica fails, protein will be deallocated. */
@@ -78,33 +234,43 @@ void delete_replicas(struct replicas *self)
                 delete_protein(self->protein);
         if (self->log != NULL)
                 fclose(self->log);
+        free(self->directory);
         free(self);
 }
 
 void save_energy(const struct replicas *self)
 {
-        for (size_t k = 0; k < self->num_replicas; k++) {
-                const struct simulation *s = self->replica[k];
-                fprintf(s->U, "%f\n", s->energy);
-                fflush(s->U);
-        }
+        for (size_t k = 0; k < self->num_replicas; k++)
+                save_replica_energy(self->replica[k]);
 }
 
 void save_conformation(const struct replicas *self)
 {
-        for (size_t k = 0; k < self->num_replicas; k++) {
-                const struct simulation *s = self->replica[k];
-                protein_write_xyz(s->protein, s->X);
-        }
+        for (size_t k = 0; k < self->num_replicas; k++)
+                save_replica_conformation(self->replica[k]);
+}
+
+/* Each replica has files of its own: its thread may write them. */
+void save_replica_energy(const struct simulation *s)
+{
+        fprintf(s->U, "%f\n", s->energy);
+        fflush(s->U);
+}
+
+void save_replica_conformation(const struct simulation *s)
+{
+        protein_write_xyz(s->protein, s->X);
+        fflush(s->X);
 }
 
 void replicas_first_iteration(struct replicas *self)
 {
         protein_scramble(self->protein, self->rng);
-        double energy = potential(self->protein, self->native_map, self->a);
+        double energy = potential(self->protein, self->native_map, &self->go);
 
         size_t k;
-#pragma omp parallel for private(k)
+#pragma omp parallel for private(k) schedule(static) \
+        num_threads(self->threading.replica_threads)
         for (k = 0; k < self->num_replicas; k++)
                 simulation_first_iteration(self->replica[k],
                                            self->protein, energy);
@@ -117,10 +283,11 @@ void replicas_resume(struct replicas *self, const struct protein *conf[])
 {
         /* Initialize every replica with the protein structure and energy. */
         size_t k;
-#pragma omp parallel for private(k)
+#pragma omp parallel for private(k) schedule(static) \
+        num_threads(self->threading.replica_threads)
         for (k = 0; k < self->num_replicas; k++) {
                 const struct protein *p = conf[k];
-                const double U = potential(p, self->native_map, self->a);
+                const double U = potential(p, self->native_map, &self->go);
                 simulation_first_iteration(self->replica[k], p, U);
         }
 }
@@ -129,61 +296,787 @@ void replicas_resume(struct replicas *self, const struct protein *conf[])
 
 void replicas_thermalize(struct replicas *self, size_t num_iters)
 {
-        const size_t iters_per_cycle = self->protein->num_atoms;
+        replicas_thermalize_batch(&self, 1, &self->threading, num_iters);
+}
 
-        fprintf(self->log, "performing %u thermalization steps.\n", num_iters);
-        
-        for (size_t s = 0; s < num_iters; s++) {
-                size_t k;
-#pragma omp parallel for private(k)
-                for (k = 0; k < self->num_replicas; k++)
-                        for (size_t c = 0; c < iters_per_cycle; c++)
-                                simulation_next_iteration(self->replica[k]);
+/** Thermalizes several sets of replicas, or jobs, at once on the
+ * threads of the given plan, which may move replicas of one job to
+ * threads left idle by another. */
+void replicas_thermalize_batch(struct replicas *jobs[], size_t num_jobs,
+                               const struct threading *threading,
+                               size_t num_iters)
+{
+        for (size_t j = 0; j < num_jobs; j++) {
+                struct replicas *self = jobs[j];
+
+                fprintf(self->log, "performing %zu thermalization steps.\n",
+                        num_iters);
 
-                if (s > 0 && s % save_energy_step == 0)
-                        save_energy(self);
-                if (s > 0 && s % save_conformation_step == 0)
-                        save_conformation(self);
+                /* The movements are tuned while thermalizing only. */
+                for (size_t k = 0; k < self->num_replicas; k++)
+                        move_controller_adapt(&self->replica[k]->moves);
         }
 
-        fprintf(self->log, "done with the thermalization steps.\n");
+        run_blocks(jobs, num_jobs, threading, 1, num_iters, false, true);
+
+        for (size_t j = 0; j < num_jobs; j++) {
+                struct replicas *self = jobs[j];
+
+                fprintf(self->log, "done with the thermalization steps.\n");
+
+                for (size_t k = 0; k < self->num_replicas; k++) {
+                        struct simulation *r = self->replica[k];
+
+                        move_controller_freeze(&r->moves);
+                        fprintf(self->log, "movements of replica %zu (T = %g):\n",
+                                k, r->temperature);
+                        move_controller_print(&r->moves, self->log);
+                }
+        }
 }
 
-void replicas_next_iteration(struct replicas *self)
+/** Tunes the temperature ladder.  Every replica runs num_sweeps sweeps
+ * while its energies are recorded, and the replicas are then moved to
+ * the ladder between the same extreme temperatures that those energies
+ * predict to have the same acceptance between all neighbours (see
+ * ladder.c).  If target_acceptance is positive the number of replicas
+ * changes too, so that the acceptance predicted is at least that.
+ * Returns the replicas, which may have moved, or NULL on failure, in
+ * which case they have been deleted.  The exchange statistics start
+ * over. */
+struct replicas *replicas_tune_ladder(struct replicas *self, size_t num_sweeps,
+                                      double target_acceptance)
 {
+        assert(self != NULL && target_acceptance < 1.0);
+
+        const size_t n = self->num_replicas;
+        const size_t num_atoms = self->protein->num_atoms;
+        struct ladder_sample samples[n];
+
+        if (n < 2)
+                return self;
+
+        for (size_t k = 0; k < n; k++)
+                ladder_sample_init(&samples[k], self->replica[k]->temperature);
+
         size_t k;
+#pragma omp parallel for private(k) schedule(static) \
+        num_threads(self->threading.replica_threads)
+        for (k = 0; k < n; k++) {
+                struct simulation *r = self->replica[k];
+
+                for (size_t s = 0; s < num_sweeps; s++) {
+                        for (size_t c = 0; c < num_atoms; c++)
+                                simulation_next_iteration(r);
+                        ladder_sample_add(&samples[k], r->energy);
+                }
+        }
+
+        qsort(samples, n, sizeof(samples[0]), compare_samples);
+
+        double temperatures[max_ladder_size];
+        double acceptance = target_acceptance;
+        size_t m = n;
+        if (target_acceptance > 0.0) {
+                m = ladder_place(samples, n, target_acceptance,
+                                 temperatures, max_ladder_size);
+                if (m == 0)
+                        fprintf(self->log, "more than %zu replicas needed for "
+                                "an acceptance of %g: keeping %zu.\n",
+                                max_ladder_size, target_acceptance, n);
+        }
+        if (m == 0 || target_acceptance <= 0.0) {
+                m = n;
+                acceptance = ladder_equalize(samples, n, temperatures, n);
+        }
+        for (size_t j = 0; j + 1 < m; j++)
+                acceptance = GSL_MIN(acceptance,
+                                     ladder_acceptance(samples, n, temperatures[j],
+                                                       temperatures[j + 1]));
+
+        fprintf(self->log, "tuned ladder (predicted acceptance %g):", acceptance);
+        for (size_t j = 0; j < m; j++)
+                fprintf(self->log, " %g", temperatures[j]);
+        fprintf(self->log, "\n");
+
+        struct replicas *r = replicas_resize(self, temperatures, m);
+        if (r != NULL)
+                r->predicted_acceptance = acceptance;
+
+        return r;
+}
+
+int compare_samples(const void *a, const void *b)
+{
+        const double t1 = ((const struct ladder_sample *) a)->temperature;
+        const double t2 = ((const struct ladder_sample *) b)->temperature;
+
+        return (t1 > t2) - (t1 < t2);
+}
+
+/*
+ * Moves the replicas to n temperatures.  Each new temperature is taken
+ * by the replica that was closest to it, if no other has taken it yet,
+ * or else by a new replica starting from a copy of its conformation
+ * and movements.  The replicas left over are deleted.
+ */
+struct replicas *replicas_resize(struct replicas *self,
+                                 const double temperatures[], size_t n)
+{
+        const size_t old_n = self->num_replicas;
+        struct replicas *r = calloc(1, sizeof(struct replicas)
+                                    + n*sizeof(struct simulation *));
+        size_t *exchanges = cache_aligned_alloc(n*sizeof(size_t));
+        size_t *total = cache_aligned_alloc(n*sizeof(size_t));
+        struct exchange_slot *slots = cache_aligned_alloc(n*sizeof(struct exchange_slot));
+        size_t *pair_exchanges = calloc(n*n, sizeof(size_t));
+        size_t *pair_total = calloc(n*n, sizeof(size_t));
+        double *sweep_cost = calloc(n, sizeof(double));
+        int *home = malloc(n*sizeof(int));
+        bool taken[old_n], fresh[n];
+        size_t nearest[n];
+
+        if (r == NULL || exchanges == NULL || total == NULL || slots == NULL
+            || pair_exchanges == NULL || pair_total == NULL || sweep_cost == NULL
+            || home == NULL)
+                goto failed;
+
+        memset(taken, 0, sizeof(taken));
+        for (size_t k = 0; k < n; k++) {
+                size_t j = 0;
+                for (size_t i = 1; i < old_n; i++)
+                        if (fabs(self->replica[i]->temperature - temperatures[k])
+                            < fabs(self->replica[j]->temperature - temperatures[k]))
+                                j = i;
+
+                nearest[k] = j;
+                sweep_cost[k] = self->sweep_cost[j];
+                fresh[k] = taken[j];
+                if (!taken[j]) {
+                        taken[j] = true;
+                        r->replica[k] = self->replica[j];
+                }
+        }
+
+        struct threading plan = threading_plan(self->num_threads, n);
+        plan.binding = self->binding;
+        threading_apply(&plan);
+        threading_assign(sweep_cost, n, plan.replica_threads, home);
+
+        /*
+         * As in new_replicas(), each new replica is created by the
+         * thread assign_replicas() will run it on, pinned already, so
+         * that its arena is first touched from the right NUMA node.
+         */
+        bool created = true;
+        int t;
+#pragma omp parallel for private(t) schedule(static, 1) reduction(&&:created) \
+        num_threads(plan.replica_threads)
+        for (t = 0; t < plan.replica_threads; t++) {
+                threading_pin(&plan, thread_num());
+                for (size_t k = 0; k < n; k++) {
+                        if (!fresh[k] || home[k] != t)
+                                continue;
+
+                        const struct simulation *parent = self->replica[nearest[k]];
+                        struct simulation *s;
+                        s = new_simulation(self->native_map, &self->go,
+                                           temperatures[k], self->seed,
+                                           self->next_stream + k,
+                                           self->directory, self->huge_pages);
+                        if (s == NULL) {
+                                created = false;
+                                continue;
+                        }
+                        simulation_first_iteration(s, parent->protein, parent->energy);
+                        s->moves = parent->moves;
+                        r->replica[k] = s;
+                }
+        }
+        if (!created)
+                goto failed;
+
+        /* Past this point nothing can fail but reopening files. */
+        *r = *self;
+        r->num_replicas = n;
+        r->next_stream = self->next_stream + n;
+        r->exchanges = exchanges;
+        r->total = total;
+        r->slots = slots;
+        r->pair_exchanges = pair_exchanges;
+        r->pair_total = pair_total;
+        r->sweep_cost = sweep_cost;
+        r->home = home;
+        r->threading = plan;
+        memset(exchanges, 0, n*sizeof(size_t));
+        memset(total, 0, n*sizeof(size_t));
+        memset(slots, 0, n*sizeof(struct exchange_slot));
+        r->round = 0;
+
+        int status = 0;
+        for (size_t k = 0; k < n; k++) {
+                struct simulation *s = r->replica[k];
+                s->go = &r->go;
+                if (simulation_set_temperature(s, temperatures[k]) == -1)
+                        status = -1;
+        }
+        for (size_t j = 0; j < old_n; j++)
+                if (!taken[j])
+                        delete_simulation(self->replica[j]);
+
+        free(self->exchanges);
+        free(self->total);
+        free(self->slots);
+        free(self->pair_exchanges);
+        free(self->pair_total);
+        free(self->sweep_cost);
+        free(self->home);
+        free(self);
+
+        if (status == -1) {
+                delete_replicas(r);
+                return NULL;
+        }
+
+        return r;
+
+failed:
+        if (r != NULL) {
+                for (size_t k = 0; k < n; k++) {
+                        struct simulation *s = r->replica[k];
+                        bool old = false;
+                        for (size_t j = 0; j < old_n; j++)
+                                old = old || s == self->replica[j];
+                        if (s != NULL && !old)
+                                delete_simulation(s);
+                }
+                free(r);
+        }
+        free(exchanges);
+        free(total);
+        free(slots);
+        free(pair_exchanges);
+        free(pair_total);
+        free(sweep_cost);
+        free(home);
+        delete_replicas(self);
+
+        return NULL;
+}
+
+void replicas_next_iteration(struct replicas *self)
+{
+        run_blocks(&self, 1, &self->threading, 1, sweeps_per_iteration, true, false);
+}
+
+/*
+ * Exchange stage between two blocks of sweeps.  An exchange only needs
+ * the energies, so the rounds are played on them and on which
+ * conformation is at each temperature, and the conformations are moved
+ * once at the end.  Each round attempts either every other pair of
+ * neighbours, starting from a random parity and alternating, or as many
+ * pairs of any two temperatures, drawn at random; either way the
+ * permutations are sampled with their equilibrium weights.
+ */
+void exchange_stage(struct replicas *self)
+{
+        const size_t n = self->num_replicas;
+        double energy[n];
+        size_t source[n];
+
+        for (size_t t = 0; t < n; t++) {
+                energy[t] = self->replica[t]->energy;
+                source[t] = t;
+        }
+
+        fprintf(self->log, "attempting to exchange replicas.\n");
+        if (self->any_pair) {
+                for (size_t round = 0; round < self->exchange_rounds; round++)
+                        for (size_t a = 0; a + 1 < n; a++) {
+                                const size_t i = gsl_rng_uniform_int(self->rng, n);
+                                size_t j = gsl_rng_uniform_int(self->rng, n - 1);
+                                if (j >= i)
+                                        j++;
+                                attempt_exchange(self, GSL_MIN(i, j),
+                                                 GSL_MAX(i, j), energy, source);
+                        }
+        } else {
+                const size_t parity = gsl_rng_uniform_int(self->rng, 2);
+                for (size_t round = 0; round < self->exchange_rounds; round++)
+                        for (size_t k = (parity + round) % 2; k + 1 < n; k += 2)
+                                attempt_exchange(self, k, k + 1, energy, source);
+        }
+
+        permute_conformations(self, source);
+        for (size_t t = 0; t < n; t++)
+                self->replica[t]->energy = energy[t];
+        fprintf(self->log, "done with replica exchange.\n");
+}
+
+/*
+ * Metropolis exchange of the conformations at temperatures i < j, of
+ * the given energies; source tells where each came from.
+ */
+void attempt_exchange(struct replicas *self, size_t i, size_t j,
+                      double energy[], size_t source[])
+{
+        const size_t n = self->num_replicas;
+        const double DU = energy[j] - energy[i];
+        const double DB = 1.0/self->replica[j]->temperature
+                - 1.0/self->replica[i]->temperature;
+        const bool accepted = gsl_rng_uniform(self->rng) < exp(DB*DU);
+
+        if (accepted) {
+                fprintf(self->log, "swapping replicas %zu and %zu.\n", i, j);
+                const double U = energy[i];
+                energy[i] = energy[j];
+                energy[j] = U;
+                const size_t s = source[i];
+                source[i] = source[j];
+                source[j] = s;
+                ++self->pair_exchanges[i*n + j];
+        }
+        ++self->pair_total[i*n + j];
+
+        if (j == i + 1) {
+                self->exchanges[i] += accepted;
+                ++self->total[i];
+        }
+}
+
+/*
+ * Gives replica t the conformation replica source[t] had, with at most
+ * one swap per replica.  Swapping the coordinates rather than the
+ * pointers keeps every conformation in its replica's arena.
+ */
+void permute_conformations(struct replicas *self, const size_t source[])
+{
+        const size_t n = self->num_replicas;
+        size_t holder[n], where[n];
 
-        const size_t num_iters = 5000;
+        /* holder[t]: conformation now at t; where[c]: where c is now. */
+        for (size_t t = 0; t < n; t++)
+                holder[t] = where[t] = t;
 
-        if (self->num_replicas > 1) {
-                fprintf(self->log, "attempting to exchange replicas.\n");
-                for (k = gsl_rng_uniform_int(self->rng, 2);
-                     k <= self->num_replicas - 2;
-                     k += 2)
+        for (size_t t = 0; t < n; t++) {
+                const size_t p = where[source[t]];
+                if (p == t)
+                        continue;
+
+                protein_swap(self->replica[t]->protein, self->replica[p]->protein);
+                where[holder[t]] = p;
+                where[holder[p]] = t;
+                holder[p] = holder[t];
+                holder[t] = source[t];
+        }
+}
+
+/** Runs the sweeps of an iteration on every replica, without attempting
+ * any exchange. */
+void replicas_sweep(struct replicas *self)
+{
+        run_blocks(&self, 1, &self->threading, 1, sweeps_per_iteration,
+                   false, false);
+}
+
+/*
+ * Runs num_blocks blocks of num_sweeps sweeps of every replica of the
+ * jobs, each after an exchange stage of every job if exchange, in a
+ * single parallel region with the threads of the plan: they are pinned
+ * once and only wait for each other around the exchange stages, which
+ * one of them runs.  Within a block the sweeps are cut into slices.
+ * Each thread runs the slices of its own replicas (see
+ * assign_replicas()) and then takes slices of the replicas with most
+ * work left that no thread is running, whatever their job.  A replica
+ * never runs on two threads at once, so its trajectory does not depend
+ * on the schedule.  Energies and conformations are saved by the index
+ * of the sweep in the block, but not after the first one if skip_first.
+ */
+void run_blocks(struct replicas *jobs[], size_t num_jobs,
+                const struct threading *threading, size_t num_blocks,
+                size_t num_sweeps, bool exchange, bool skip_first)
+{
+        size_t n = 0;
+        for (size_t j = 0; j < num_jobs; j++)
+                n += jobs[j]->num_replicas;
+
+        struct simulation *replica[n];
+        size_t job[n], next_slice[n];
+        double cost[n], spent[n];
+        int home[n];
+        bool busy[n];
+        struct block b = {
+                .jobs = jobs, .num_jobs = num_jobs, .num_replicas = n,
+                .num_threads = threading->replica_threads,
+                .replica = replica, .job = job, .cost = cost, .home = home,
+                .num_sweeps = num_sweeps,
+                .num_slices = (num_sweeps + sweeps_per_slice - 1)/sweeps_per_slice,
+                .skip_first = skip_first,
+                .next_slice = next_slice, .busy = busy, .spent = spent
+        };
+
+        for (size_t j = 0, g = 0; j < num_jobs; j++)
+                for (size_t k = 0; k < jobs[j]->num_replicas; k++, g++) {
+                        replica[g] = jobs[j]->replica[k];
+                        job[g] = j;
+                }
+
+#pragma omp parallel num_threads(b.num_threads)
+        {
+                const int thread = thread_num();
+
+                threading_pin(threading, thread);
+
+                for (size_t i = 0; i < num_blocks; i++) {
+#pragma omp single
+                        {
+                                for (size_t j = 0; exchange && j < num_jobs; j++)
+                                        if (jobs[j]->num_replicas > 1)
+                                                exchange_stage(jobs[j]);
+                                start_block(&b);
+                        }
+                        work_on_block(&b, thread);
+#pragma omp barrier
+#pragma omp single
+                        finish_block(&b);
+                }
+        }
+}
+
+void start_block(struct block *b)
+{
+        for (size_t j = 0, g = 0; j < b->num_jobs; j++)
+                for (size_t k = 0; k < b->jobs[j]->num_replicas; k++, g++) {
+                        b->cost[g] = b->jobs[j]->sweep_cost[k];
+                        b->home[g] = b->jobs[j]->home[k];
+                }
+
+        assign_replicas(b);
+
+        for (size_t j = 0, g = 0; j < b->num_jobs; j++)
+                for (size_t k = 0; k < b->jobs[j]->num_replicas; k++, g++)
+                        b->jobs[j]->home[k] = b->home[g];
+
+        for (size_t g = 0; g < b->num_replicas; g++) {
+                b->next_slice[g] = 0;
+                b->busy[g] = false;
+                b->spent[g] = 0.0;
+        }
+        b->stolen = 0;
+        b->released = 0;
+        b->start = wall_time();
+}
+
+void work_on_block(struct block *b, int thread)
+{
+        const size_t n = b->num_replicas;
+
+        while (true) {
+                size_t g, slice = 0, released = 0;
+                bool finished;
+
+#pragma omp critical(replicas_schedule)
+                {
+                        g = pick_replica(b, thread, &finished);
+                        if (g < n) {
+                                b->busy[g] = true;
+                                slice = b->next_slice[g]++;
+                        } else {
+                                released = b->released;
+                        }
+                }
+                if (g == n) {
+                        if (finished)
+                                return;
+                        /* Only busy replicas have slices left: wait off
+                         * the lock until one of them is free again. */
+                        wait_for(&b->released, released + 1);
+                        continue;
+                }
+
+                struct simulation *r = b->replica[g];
+                const size_t num_atoms = b->jobs[b->job[g]]->protein->num_atoms;
+                const size_t end = GSL_MIN((slice + 1)*sweeps_per_slice,
+                                           b->num_sweeps);
+                const double t = wall_time();
+
+                for (size_t s = slice*sweeps_per_slice; s < end; s++) {
+                        for (size_t c = 0; c < num_atoms; c++)
+                                simulation_next_iteration(r);
+
+                        if (b->skip_first && s == 0)
+                                continue;
+                        if (s % save_energy_step == 0)
+                                save_replica_energy(r);
+                        if (s % save_conformation_step == 0)
+                                save_replica_conformation(r);
+                }
+
+#pragma omp critical(replicas_schedule)
                 {
-                        replicas_exchange(self, k);
+                        b->spent[g] += wall_time() - t;
+                        b->busy[g] = false;
+                        __atomic_store_n(&b->released, b->released + 1,
+                                         __ATOMIC_RELEASE);
+                        if (b->home[g] != thread)
+                                ++b->stolen;
                 }
-                fprintf(self->log, "done with replica exchange.\n");
         }
+}
+
+void finish_block(struct block *b)
+{
+        const size_t n = b->num_replicas;
+        const double elapsed = wall_time() - b->start;
+        double work = 0.0, longest = 0.0;
+
+        for (size_t j = 0, g = 0; j < b->num_jobs; j++)
+                for (size_t k = 0; k < b->jobs[j]->num_replicas; k++, g++)
+                        b->jobs[j]->sweep_cost[k] = b->spent[g]/(double) b->num_sweeps;
+
+        for (size_t g = 0; g < n; g++) {
+                work += b->spent[g];
+                longest = GSL_MAX(longest, b->spent[g]);
+        }
+
+        for (size_t j = 0; j < b->num_jobs; j++) {
+                FILE *log = b->jobs[j]->log;
+
+                fprintf(log, "%zu sweeps: %.3g s on %d thread(s), "
+                        "%zu of %zu slices stolen; static schedule %.3g s, "
+                        "bound %.3g s", b->num_sweeps, elapsed, b->num_threads,
+                        b->stolen, n*b->num_slices,
+                        threading_static_makespan(b->spent, n, b->num_threads),
+                        GSL_MAX(work/b->num_threads, longest));
+                if (b->num_jobs > 1)
+                        fprintf(log, " (%zu jobs, %zu replicas)", b->num_jobs, n);
+                fprintf(log, ".\n");
+                fflush(log);
+        }
+}
 
-        for (size_t s = 0; s < num_iters; s++) {
-#pragma omp parallel for private(k)
-                for (k = 0; k < self->num_replicas; k++)
-                        for (size_t c = 0; c < self->protein->num_atoms; c++)
-                                simulation_next_iteration(self->replica[k]);
+/*
+ * Keeps every replica on the thread it has been running on, and so on
+ * its core and in its caches, unless assigning them afresh longest
+ * first (see threading_assign()) is predicted to shorten the blocks by
+ * more than rebalance_gain.
+ */
+void assign_replicas(struct block *b)
+{
+        const size_t n = b->num_replicas;
+        int home[n];
+        bool assigned = true;
 
-                if (s % save_energy_step == 0)
-                        save_energy(self);
-                if (s % save_conformation_step == 0)
-                        save_conformation(self);
+        const double best = threading_assign(b->cost, n, b->num_threads, home);
+        for (size_t g = 0; g < n; g++)
+                assigned = assigned && b->home[g] >= 0
+                        && b->home[g] < b->num_threads;
 
-                fflush(self->log);
+        if (assigned) {
+                const double current = threading_makespan(b->cost, n,
+                                                          b->num_threads, b->home);
+                if (best >= (1.0 - rebalance_gain)*current)
+                        return;
+                for (size_t j = 0; j < b->num_jobs; j++)
+                        fprintf(b->jobs[j]->log, "moving replicas between threads: "
+                                "%.3g instead of %.3g s per sweep.\n", best, current);
         }
+
+        memcpy(b->home, home, n*sizeof(int));
+}
+
+/*
+ * Replica with most work left that no thread is running, preferring
+ * those of thread; num_replicas if there is none, and then finished
+ * tells whether there is no work left at all.
+ */
+size_t pick_replica(const struct block *b, int thread, bool *finished)
+{
+        const size_t n = b->num_replicas;
+        size_t own = n, other = n;
+        double own_work = 0.0, other_work = 0.0;
+
+        *finished = true;
+        for (size_t g = 0; g < n; g++) {
+                if (b->next_slice[g] == b->num_slices)
+                        continue;
+                *finished = false;
+                if (b->busy[g])
+                        continue;
+
+                const double cost = b->cost[g] > 0.0 ? b->cost[g] : 1.0;
+                const double work = (double) (b->num_slices - b->next_slice[g])*cost;
+                if (b->home[g] == thread && (own == n || work > own_work)) {
+                        own = g;
+                        own_work = work;
+                }
+                if (other == n || work > other_work) {
+                        other = g;
+                        other_work = work;
+                }
+        }
+
+        return own < n ? own : other;
+}
+
+int thread_num(void)
+{
+#ifdef _OPENMP
+        return omp_get_thread_num();
+#else
+        return 0;
+#endif
+}
+
+/** Runs the replicas as a group of a run spread over several processes
+ * (see coordinator.h): after every iteration the energies go to the
+ * coordinator through c and the temperatures come back, until it says
+ * to stop.  Returns 0 then, -1 if the coordinator is lost. */
+int replicas_run_remote(struct replicas *self, struct channel *c)
+{
+        const size_t n = self->num_replicas;
+        double message[n + 1];
+
+        for (;;) {
+                for (size_t k = 0; k < n; k++)
+                        message[k] = self->replica[k]->energy;
+                if (channel_send(c, message, n) == -1)
+                        return -1;
+
+                const long received = channel_receive(c, message, n + 1);
+                if (received >= 1 && message[0] == 0.0)
+                        return 0;
+                if (received != (long) n + 1)
+                        return -1;
+
+                for (size_t k = 0; k < n; k++)
+                        if (simulation_set_temperature(self->replica[k],
+                                                       message[k + 1]) == -1)
+                                return -1;
+
+                replicas_sweep(self);
+        }
+}
+
+/** Runs num_iters iterations, as that many calls to
+ * replicas_next_iteration() would.  In asynchronous mode every replica
+ * runs on a thread of its own and only ever waits for the neighbour it
+ * is exchanging with, instead of for all the others after every sweep.
+ * The pairs attempted alternate between even and odd iterations, and
+ * each exchange is decided by the lower replica with its own random
+ * stream, so the sample does not depend on timing.  Without a thread
+ * per replica the iterations are run synchronously. */
+void replicas_run(struct replicas *self, size_t num_iters)
+{
+        assert(self != NULL);
+
+        if (self->asynchronous && run_asynchronously(self, num_iters))
+                return;
+
+        run_blocks(&self, 1, &self->threading, num_iters,
+                   sweeps_per_iteration, true, false);
+}
+
+/** Runs num_iters iterations of several sets of replicas, or jobs, at
+ * once on the threads of the given plan.  Scheduling is fair in that
+ * every job is given an iteration at a time: one exchange stage and
+ * one block of sweeps, whose slices go to whichever thread is idle.
+ * The jobs are exchanged synchronously. */
+void replicas_run_batch(struct replicas *jobs[], size_t num_jobs,
+                        const struct threading *threading, size_t num_iters)
+{
+        assert(jobs != NULL && num_jobs > 0 && threading != NULL);
+
+        run_blocks(jobs, num_jobs, threading, num_iters,
+                   sweeps_per_iteration, true, false);
+}
+
+bool run_asynchronously(struct replicas *self, size_t num_iters)
+{
+#ifdef _OPENMP
+        const int num_threads = (int) self->num_replicas;
+        bool ran = true;
+
+        if (self->threading.replica_threads < num_threads) {
+                fprintf(self->log, "fewer threads than replicas: "
+                        "exchanging synchronously.\n");
+                return false;
+        }
+
+#pragma omp parallel num_threads(num_threads)
+        {
+                if (omp_get_num_threads() == num_threads) {
+                        threading_pin(&self->threading, omp_get_thread_num());
+                        run_replica(self, (size_t) omp_get_thread_num(),
+                                    num_iters);
+                } else {
+#pragma omp single
+                        ran = false;
+                }
+        }
+
+        if (ran)
+                self->round += num_iters;
+
+        return ran;
+#else
+        (void) self, (void) num_iters;
+
+        return false;
+#endif
+}
+
+/*
+ * Body of the thread of replica k.  On even rounds replica k pairs with
+ * k+1 if k is even, on odd rounds if k is odd; the upper replica of
+ * each pair stops until the lower one has decided the exchange.
+ */
+void run_replica(struct replicas *self, size_t k, size_t num_iters)
+{
+        struct simulation *r = self->replica[k];
+        const size_t num_atoms = self->protein->num_atoms;
+
+        for (size_t i = 0; i < num_iters; i++) {
+                const size_t round = self->round + i;
+
+                if (k % 2 == round % 2 && k + 1 < self->num_replicas) {
+                        struct exchange_slot *slot = &self->slots[k];
+
+                        wait_for(&slot->arrived, round + 1);
+                        replicas_exchange(self, k, r->rng);
+                        __atomic_store_n(&slot->done, round + 1, __ATOMIC_RELEASE);
+                } else if (k % 2 != round % 2 && k > 0) {
+                        struct exchange_slot *slot = &self->slots[k - 1];
+
+                        __atomic_store_n(&slot->arrived, round + 1, __ATOMIC_RELEASE);
+                        wait_for(&slot->done, round + 1);
+                }
+
+                for (size_t s = 0; s < sweeps_per_iteration; s++) {
+                        for (size_t c = 0; c < num_atoms; c++)
+                                simulation_next_iteration(r);
+
+                        if (s % save_energy_step == 0)
+                                save_replica_energy(r);
+                        if (s % save_conformation_step == 0)
+                                save_replica_conformation(r);
+                }
+        }
+}
+
+/* Waits until the counter written by another thread reaches value,
+ * which may take as long as a whole block of sweeps. */
+void wait_for(const size_t *counter, size_t value)
+{
+        struct backoff b = { 0 };
+
+        while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < value)
+                backoff_pause(&b);
 }
 
 
 
-void replicas_exchange(struct replicas *self, size_t k)
+void replicas_exchange(struct replicas *self, size_t k, gsl_rng *rng)
 {
         assert(self->num_replicas >= 2);
 
@@ -196,18 +1089,20 @@ void replicas_exchange(struct replicas *self, size_t k)
         const double DU = U2 - U1;
         const double DB = 1.0/T2 - 1.0/T1;
         const double p = exp(DB*DU);
-        const double r = gsl_rng_uniform(self->rng);
+        const double r = gsl_rng_uniform(rng);
         if (r < p) {
                 fprintf(self->log, "swapping replicas %u and %u.\n", k, k+1);
-                struct protein *x = s1->protein;
-                s1->protein = s2->protein;
+                /* Swap the coordinates rather than the pointers so that
+                 * every conformation stays in its replica's arena. */
+                protein_swap(s1->protein, s2->protein);
                 s1->energy = U2;
-                s2->protein = x;
                 s2->energy = U1;
                 ++self->exchanges[k];
+                ++self->pair_exchanges[k*self->num_replicas + k + 1];
         }
 
         ++self->total[k];
+        ++self->pair_total[k*self->num_replicas + k + 1];
 }
 
 
@@ -227,6 +1122,50 @@ void replicas_get_exchange_ratios(const struct replicas *self,
                 ratios[r] = (double) self->exchanges[r]/self->total[r];
 }
 
+/** Acceptance of the exchanges between temperatures i and j, or NaN
+ * if none has been attempted. */
+double replicas_get_acceptance(const struct replicas *self, size_t i, size_t j)
+{
+        assert(i < self->num_replicas && j < self->num_replicas);
+
+        if (i > j)
+                return replicas_get_acceptance(self, j, i);
+
+        const size_t k = i*self->num_replicas + j;
+        if (self->pair_total[k] == 0)
+                return GSL_NAN;
+
+        return (double) self->pair_exchanges[k]/(double) self->pair_total[k];
+}
+
+/** Prints the acceptance of every pair of temperatures as a matrix, a
+ * row per temperature, with dashes for the pairs never attempted. */
+void replicas_print_acceptance_matrix(const struct replicas *self,
+                                      FILE *stream)
+{
+        const size_t n = self->num_replicas;
+
+        fprintf(stream, "acceptance of exchanges between temperatures:\n");
+        fprintf(stream, "%6s", "");
+        for (size_t j = 0; j < n; j++)
+                fprintf(stream, " %5.3f", self->replica[j]->temperature);
+        fprintf(stream, "\n");
+
+        for (size_t i = 0; i < n; i++) {
+                fprintf(stream, "%5.3f:", self->replica[i]->temperature);
+                for (size_t j = 0; j < n; j++) {
+                        const double a = i == j ? GSL_NAN
+                                : replicas_get_acceptance(self, i, j);
+                        if (isnan(a))
+                                fprintf(stream, " %5s", "-");
+                        else
+                                fprintf(stream, " %5.3f", a);
+                }
+                fprintf(stream, "\n");
+        }
+        fflush(stream);
+}
+
 void replicas_print_info(const struct replicas *self, FILE *stream)
 {
         double ratios[self->num_replicas - 1];
@@ -2,6 +2,9 @@
 #define REPLICAS_H
 
 struct contact_map;
+struct channel;
+
+struct exchange_slot;
 
 /** Replica data structure.  This provides context for the replica
  * exchange simulation. */
@@ -9,20 +12,48 @@ struct replicas {
         gsl_rng *rng;		        /**< Random number generator. */
         struct protein *protein;	/**< Protein to be simulated. */
         struct contact_map *native_map; /**< Native contacts. */
-        double a;                       /**< Tolerance for distances between amino acids. */
+        struct go_potential go;         /**< Form of the potential. */
         size_t num_replicas;            /**< Number of replicas. */
-        size_t *exchanges;              /**< Number of exchanges per pair of replicas. */
-        size_t *total;                  /**< Number of attempted exchanges per pair of replicas. */
+        size_t *exchanges;              /**< Number of exchanges per pair of replicas (written by the thread deciding them). */
+        size_t *total;                  /**< Number of attempted exchanges per pair of replicas (written by the thread deciding them). */
+        size_t *pair_exchanges;         /**< Exchanges between temperatures i < j, at [i*num_replicas + j]. */
+        size_t *pair_total;             /**< Attempts between temperatures i < j, likewise. */
+        size_t exchange_rounds;         /**< Rounds of exchange attempts per iteration (synchronous mode). */
+        bool any_pair;                  /**< Attempt pairs of any two temperatures. */
+        double *sweep_cost;             /**< Seconds per sweep of each replica, as last measured. */
+        double predicted_acceptance;    /**< Lowest neighbour acceptance the last tuned ladder was predicted to have. */
+        int *home;                      /**< Thread that runs each replica. */
+        bool asynchronous;              /**< Exchange without global barriers (see replicas_run()). */
+        size_t round;                   /**< Iterations run asynchronously so far. */
+        struct exchange_slot *slots;    /**< Handshake of each pair of neighbours. */
         FILE *log;                      /**< Log file. */
+        struct threading threading;     /**< Threads running the replicas. */
+        enum threading_binding binding; /**< Where its threads are pinned. */
+        size_t num_threads;             /**< Threads the split was made for. */
+        unsigned long seed;             /**< Master seed of the random streams. */
+        size_t next_stream;             /**< First stream not given to a replica yet. */
+        bool huge_pages;                /**< Whether replicas use huge pages. */
+        char *directory;                /**< Directory of its files, the working one if NULL. */
         struct simulation *replica[];   /**< Array of replicas. */
 };
 
 /** Auxiliary options for new_replicas. */
 struct simulation_options {
         gsl_rng *rng;
+        unsigned long seed;     /**< Master seed of the replicas' random streams. */
+        size_t stream_offset;   /**< Replica k uses stream stream_offset + k + 1. */
         double d_max, a;
+        enum go_potential_family family;        /**< Square well by default. */
+        const struct go_spline *table;          /**< Wells of the tabulated family. */
         size_t num_replicas;
         double *temperatures;
+        bool huge_pages;        /**< Back each replica's arena with huge pages. */
+        bool asynchronous;      /**< Exchange between neighbours without global barriers. */
+        size_t exchange_rounds; /**< Rounds of exchange attempts per iteration, 1 if zero. */
+        bool any_pair;          /**< Attempt pairs of any two temperatures, not only neighbours. */
+        enum threading_binding binding; /**< Where to pin the threads, nowhere by default. */
+        size_t num_threads;     /**< Threads to use, all cores if zero. */
+        const char *directory;  /**< Directory of the files, the working one if NULL. */
 };
 
 
@@ -36,10 +67,26 @@ extern void replicas_resume(struct replicas *self,
                             const struct protein *config[]);
 extern void replicas_first_iteration(struct replicas *self);
 extern void replicas_next_iteration(struct replicas *self);
+extern void replicas_run(struct replicas *self, size_t num_iters);
+extern void replicas_thermalize_batch(struct replicas *jobs[], size_t num_jobs,
+                                      const struct threading *threading,
+                                      size_t num_iters);
+extern void replicas_run_batch(struct replicas *jobs[], size_t num_jobs,
+                               const struct threading *threading,
+                               size_t num_iters);
+extern void replicas_sweep(struct replicas *self);
+extern int replicas_run_remote(struct replicas *self, struct channel *c);
+extern struct replicas *replicas_tune_ladder(struct replicas *self,
+                                             size_t num_sweeps,
+                                             double target_acceptance);
 
 extern size_t replicas_total_exchanges(const struct replicas *self);
 extern void replicas_get_exchange_ratios(const struct replicas *self,
                                          double ratios[]);
+extern double replicas_get_acceptance(const struct replicas *self,
+                                      size_t i, size_t j);
+extern void replicas_print_acceptance_matrix(const struct replicas *self,
+                                             FILE *stream);
 extern void replicas_print_info(const struct replicas *self, FILE *stream);
 
 #endif // !REPLICAS_H
@@ -4,37 +4,60 @@
 const char U_file_template[] = "U--t-%02.05f--dmax-%02.05f--a-%02.05f.dat";
 const char X_file_template[] = "X--t-%02.05f--dmax-%02.05f--a-%02.05f.xyz";
 
+/* Number of steps after which the energy, otherwise updated with
+ * incremental differences, is recomputed from scratch to bound the
+ * accumulated round-off. */
+const size_t energy_refresh_step = 100000;
+
 
 static int open_log_files(struct simulation *s);
+static gsl_rng *arena_rng_alloc(struct arena *arena, const gsl_rng_type *T);
 
 
+/** Creates a replica.  It should be called from the thread that is
+ * going to run the replica so that its memory is placed on the right
+ * NUMA node.  Its random numbers are the given stream of the generator
+ * keyed by seed, so replicas must be given distinct streams.  Its files
+ * go to directory, which must outlive it, or to the working directory
+ * if that is NULL. */
 struct simulation *new_simulation(const struct contact_map *native_map,
-                                  double a, double temperature, gsl_rng *rng)
+                                  const struct go_potential *go,
+                                  double temperature, unsigned long seed,
+                                  size_t stream, const char *directory,
+                                  bool huge_pages)
 {
-        if (native_map == NULL || a <= 0.0 || rng == NULL)
+        if (native_map == NULL || go == NULL)
                 return NULL;
 
-        struct simulation *s = calloc(1, sizeof(struct simulation));
-        if (s == NULL)
+        const size_t arena_size = cache_line_round_up(sizeof(struct simulation))
+                + cache_line_round_up(sizeof(gsl_rng))
+                + cache_line_round_up(random_stream_philox->size)
+                + cache_line_round_up(protein_size(contact_map_get_num_atoms(native_map)));
+
+        struct arena *arena = new_arena(arena_size, huge_pages);
+        if (arena == NULL)
                 return NULL;
 
+        struct simulation *s = arena_alloc(arena, sizeof(struct simulation));
+        assert(s != NULL);
+
+        s->arena = arena;
+
         s->next_atom = 0;
         s->native_map = native_map;
 
-        s->a = a;
+        s->go = go;
 
         s->energy = GSL_POSINF;
 
         s->temperature = temperature;
+        s->directory = directory;
 
-        /* s->rng = rng; */
-        s->rng = gsl_rng_alloc(gsl_rng_mt19937);
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-        printf("Seeding the random number generator with %ld\n", (long) tv.tv_usec);
-        gsl_rng_set(s->rng, tv.tv_usec);
+        s->rng = arena_rng_alloc(arena, random_stream_philox);
+        random_stream_set(s->rng, seed, stream);
 
         s->accepted = s->total = 0;
+        move_controller_init(&s->moves);
 
         if (open_log_files(s) == -1) {
                 delete_simulation(s);
@@ -44,14 +67,32 @@ struct simulation *new_simulation(const struct contact_map *native_map,
         return s;
 }
 
+/* Places a GSL random number generator and its state in an arena. */
+gsl_rng *arena_rng_alloc(struct arena *arena, const gsl_rng_type *T)
+{
+        gsl_rng *r = arena_alloc(arena, sizeof(gsl_rng));
+        assert(r != NULL);
+
+        r->type = T;
+        r->state = arena_alloc(arena, T->size);
+        assert(r->state != NULL);
+
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        return r;
+}
+
 int open_log_files(struct simulation *s)
 {
-        char name1[PATH_MAX], name2[PATH_MAX];
+        const char *directory = s->directory != NULL ? s->directory : ".";
+        char file[128], name1[PATH_MAX], name2[PATH_MAX];
 
-        sprintf(name1, X_file_template, s->temperature,
-                contact_map_get_d_max(s->native_map), s->a);
-        sprintf(name2, U_file_template, s->temperature,
-                contact_map_get_d_max(s->native_map), s->a);
+        sprintf(file, X_file_template, s->temperature,
+                contact_map_get_d_max(s->native_map), s->go->a);
+        snprintf(name1, sizeof(name1), "%s/%s", directory, file);
+        sprintf(file, U_file_template, s->temperature,
+                contact_map_get_d_max(s->native_map), s->go->a);
+        snprintf(name2, sizeof(name2), "%s/%s", directory, file);
 
         s->X = fopen(name1, "a");
         s->U = fopen(name2, "a");
@@ -59,7 +100,7 @@ int open_log_files(struct simulation *s)
         return (s->X != NULL && s->U != NULL) ? 0 : -1;
 }
 
-
+
 
 void delete_simulation(struct simulation *self)
 {
@@ -69,12 +110,30 @@ void delete_simulation(struct simulation *self)
                 fclose(self->U);
         if (self->X != NULL)
                 fclose(self->X);
-        if (self->protein != NULL)
-                delete_protein(self->protein);
-        if (self->rng != NULL)
-                gsl_rng_free(self->rng);
 
-        free(self);
+        /* The protein and the random number generator live in the arena. */
+        delete_arena(self->arena);
+}
+
+
+/** Moves the replica to another temperature.  Its energies and
+ * conformations are appended to the files of that temperature from
+ * then on.  Returns -1 if they cannot be opened. */
+int simulation_set_temperature(struct simulation *self, double temperature)
+{
+        assert(self != NULL);
+
+        if (temperature == self->temperature)
+                return 0;
+
+        if (self->U != NULL)
+                fclose(self->U);
+        if (self->X != NULL)
+                fclose(self->X);
+
+        self->temperature = temperature;
+
+        return open_log_files(self);
 }
 
 
@@ -93,14 +152,26 @@ void simulation_first_iteration(struct simulation *self,
 
         ++self->total;
 
-        self->protein = protein_dup(protein);
+        if (self->protein == NULL)
+                self->protein = protein_dup_in(protein, self->arena);
+        else
+                protein_copy(self->protein, protein);
+        assert(self->protein != NULL);
         self->energy = energy;
 }
 
 static inline double
 compute_potential_energy(const struct protein *x, const struct simulation *s)
 {
-        return potential(x, s->native_map, s->a);
+        return potential(x, s->native_map, s->go);
+}
+
+static inline double
+compute_potential_energy_difference(const struct protein *x,
+                                    const struct simulation *s,
+                                    double bound, bool *overlapping)
+{
+        return potential_delta_checked(x, s->native_map, s->go, bound, overlapping);
 }
 
 
@@ -111,41 +182,69 @@ void simulation_next_iteration(struct simulation *self)
 
         ++self->total;
 
-        struct protein *current = self->protein;
-        struct protein *candidate = protein_dup(current);
-        assert(candidate != NULL); /* XXX Add proper error checking here. */
-        bool changed = protein_do_natural_movement(candidate, self->rng, self->next_atom);
-        self->next_atom = (self->next_atom + 1) % self->protein->num_atoms;
-
+        /*
+         * The movement is applied in place.  If it is rejected, the
+         * atoms it touched are restored from the undo journal.
+         */
+        struct protein *p = self->protein;
+        const size_t k = self->next_atom;
+        const enum protein_movements m = move_controller_choose(&self->moves, self->rng,
+                                                                k, p->num_atoms);
+        bool changed = protein_propose_movement(p, self->rng, m, k,
+                                                self->moves.amplitude[m]);
+        self->next_atom = (self->next_atom + 1) % p->num_atoms;
+
+        /*
+         * The Metropolis criterion r < exp(-DU/T) is decided before the
+         * energy difference is known: it becomes DU < -T log(r), which
+         * lets the evaluation of DU stop as soon as it cannot get below
+         * that threshold.
+         */
+        const double r = gsl_rng_uniform(self->rng);
+        const double threshold = -self->temperature*log(r);
+
+        /*
+         * Movements of a single atom are checked for overlaps while
+         * their energy difference is computed.  Like those that the
+         * movement itself found overlapping, they leave the protein as
+         * it was.
+         */
         const double U1 = self->energy;
-        const double U2 = changed ? compute_potential_energy(candidate, self) : U1;
-        const double DU = U2 - U1;
+        bool overlapping = false;
+        double DU = changed ? compute_potential_energy_difference(p, self, threshold,
+                                                                  &overlapping)
+                            : 0.0;
+        if (overlapping) {
+                protein_undo(p);
+                DU = 0.0;
+        }
+        const double U2 = U1 + DU;
 
-        struct protein *chosen;
+        const bool accepted = DU <= 0.0 || DU < threshold;
 
-        if (DU <= 0.0)
-                chosen = candidate;
-        else {
-                const double r = gsl_rng_uniform(self->rng);
-                const double p = exp(-DU/self->temperature);
-                chosen = r < p ? candidate : current;
-        }
+        if (self->moves.adapting)
+                move_controller_record(&self->moves, m, k, p->num_atoms,
+                                       accepted && changed && !overlapping,
+                                       protein_displacement(p));
 
-        if (chosen == candidate) {
+        if (accepted) {
                 ++self->accepted;
-                delete_protein(self->protein);
-                self->protein = candidate;
+                protein_forget(p);
                 self->energy = U2;
         } else {
-                delete_protein(candidate);
+                protein_undo(p);
         }
+
+        if (self->total % energy_refresh_step == 0)
+                self->energy = compute_potential_energy(p, self);
 }
 
 void simulation_print_info(const struct simulation *self, FILE *stream)
 {
         assert(self != NULL);
 
-        fprintf(stream, "simulation (T = %02.2f, a = %2.1f, d_max = %2.1f)\n",
-                self->temperature, self->a,
+        fprintf(stream, "simulation (T = %02.2f, %s, a = %2.1f, d_max = %2.1f)\n",
+                self->temperature, go_potential_family_name(self->go->family),
+                self->go->a,
                 contact_map_get_d_max(self->native_map));
 }
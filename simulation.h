@@ -2,28 +2,44 @@
 #define SIMULATION_H
 
 struct contact_map;
+struct go_potential;
+struct arena;
 
 /*** Individual replica.  This structure characterizes the simulation
- * process to be performed by an individual replica. */
+ * process to be performed by an individual replica.  The structure, its
+ * conformation and its random number generator are allocated from an
+ * arena owned by the replica, so that the state written on every step
+ * shares neither pages nor cache lines with other replicas. */
 struct simulation {
+        /* State updated on every step. */
         struct protein *protein;                /**< Protein to be simulated. */
         size_t next_atom;			/**< Index of the next atom to be changed by a movement. */
-        const struct contact_map *native_map;   /**< Native contacts. */
-        double a;       		        /**< Tolerance parameter for the potential. */
         double energy;				/**< Current potential energy. */
-        double temperature;                     /**< Temperature. */
-        gsl_rng *rng;                           /**< Random number generator. */
         size_t accepted;                        /**< Number of accepted movements. */
         size_t total;                           /**< Number of attempted movements. */
+        gsl_rng *rng;                           /**< Random number generator. */
+        struct move_controller moves;           /**< Movements to propose. */
+
+        /* Parameters, read-only while sampling. */
+        const struct contact_map *native_map;   /**< Native contacts. */
+        const struct go_potential *go;          /**< Form of the potential. */
+        double temperature;                     /**< Temperature. */
         FILE *U;                                /**< Storage file containing energy values. */
         FILE *X;                                /**< Storage file containing spatial conformations. */
+        const char *directory;                  /**< Directory of both files, the working one if NULL. */
+        struct arena *arena;                    /**< Memory owned by this replica. */
 };
 
 
 extern struct simulation *new_simulation(const struct contact_map *native_map,
-                                         double a, double temperature,
-                                         gsl_rng *rng);
+                                         const struct go_potential *go,
+                                         double temperature,
+                                         unsigned long seed, size_t stream,
+                                         const char *directory,
+                                         bool huge_pages);
 extern void delete_simulation(struct simulation *self);
+extern int simulation_set_temperature(struct simulation *self,
+                                      double temperature);
 
 extern void simulation_first_iteration(struct simulation *self,
                                       const struct protein *protein, double energy);
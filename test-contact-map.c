@@ -7,6 +7,13 @@ static bool plot_results = false;
 
 static void test_initialization_and_finalization(void);
 static void test_potential_energy(void);
+static void test_precision(void);
+static void test_potential_delta(void);
+static void test_kernels(void);
+static void test_families(void);
+static void test_table_file(void);
+static void test_bounded_delta(void);
+static void test_checked_delta(void);
 
 
 int main(int argc, char *argv[])
@@ -26,6 +33,13 @@ int main(int argc, char *argv[])
 
         test_initialization_and_finalization();
         test_potential_energy();
+        test_precision();
+        test_potential_delta();
+        test_kernels();
+        test_families();
+        test_table_file();
+        test_bounded_delta();
+        test_checked_delta();
 
         exit(EXIT_SUCCESS);
 }
@@ -77,8 +91,9 @@ void test_potential_energy(void)
         struct contact_map *c2 = new_contact_map(p2, d_max);
         assert(c1 != NULL && c2 != NULL);
 
-        double p_1pgb = potential(p1, c1, 0.9);
-        double p_2gb1 = potential(p2, c2, 0.9);
+        const struct go_potential g = { .family = GO_SQUARE_WELL, .a = 0.9 };
+        double p_1pgb = potential(p1, c1, &g);
+        double p_2gb1 = potential(p2, c2, &g);
 
         printf("potential(1pgb) = %g\n", p_1pgb);
         printf("potential(2gb1) = %g\n", p_2gb1);
@@ -91,3 +106,361 @@ void test_potential_energy(void)
         delete_protein(p1);
         delete_protein(p2);
 }
+
+
+/* Double precision evaluation of the potential, used as a reference for
+ * builds that store coordinates in single precision. */
+static double reference_potential(const struct protein *p,
+                                  const struct contact_map *c, double a)
+{
+        const size_t N = p->num_atoms;
+        double U = 0.0;
+
+        for (size_t i = 0; i < N; i++) {
+                for (size_t j = i+2; j < N; j++) {
+                        const double d_nat = contact_map_get_distance(c, i, j);
+                        if (d_nat == 0.0)
+                                continue;
+
+                        double d = 0.0;
+                        for (size_t k = 0; k < 3; k++)
+                                d += gsl_pow_2((double) p->atom[j][k] - (double) p->atom[i][k]);
+                        const double r = protein_signum(p, i, j)*sqrt(d);
+
+                        if (fabs(r - d_nat) < a)
+                                U += -1.0 + gsl_pow_2((r - d_nat)/a);
+                }
+        }
+
+        return U;
+}
+
+void test_precision(void)
+{
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        struct protein *(*constructor[])(void) = {
+                new_protein_1pgb, new_protein_2gb1
+        };
+
+        for (size_t n = 0; n < 2; n++) {
+                struct protein *p = constructor[n]();
+                struct contact_map *c = new_contact_map(p, 10.0);
+                assert(p != NULL && c != NULL);
+
+                for (size_t k = 0; k < 10; k++) {
+                        /* Perturb the native structure a little. */
+                        for (size_t i = 0; i < p->num_atoms; i++)
+                                protein_do_natural_movement(p, r, i);
+
+                        const struct go_potential g = { .a = 2.0 };
+                        const double U = potential(p, c, &g);
+                        const double U_ref = reference_potential(p, c, 2.0);
+
+                        assert(fabs(U - U_ref) < 1e-3);
+                }
+
+                delete_contact_map(c);
+                delete_protein(p);
+        }
+
+        gsl_rng_free(r);
+}
+
+/* Incremental and full evaluations must agree for the form g. */
+static void check_potential_delta(const struct go_potential *g)
+{
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        struct protein *p = new_protein_2gb1();
+        struct contact_map *c = new_contact_map(p, 10.0);
+        assert(p != NULL && c != NULL);
+
+        const size_t N = p->num_atoms;
+        const double tol = 1e4*REAL_EPSILON;
+        double U = potential(p, c, g);
+
+        for (size_t i = 0; i < 5000; i++) {
+                enum protein_movements mov = i % PROTEIN_NUM_MOVEMENTS;
+                size_t k = 1 + gsl_rng_uniform_int(r, N - 3);
+
+                if (!protein_do_movement(p, r, mov, k))
+                        continue;
+
+                const double DU = potential_delta(p, c, g);
+                const double U_new = potential(p, c, g);
+
+                /* Lennard-Jones energies can be large: compare relatively. */
+                const double scale = 1.0 + fabs(U) + fabs(DU);
+                assert(fabs(U + DU - U_new) < tol*scale);
+
+                /* Undo every other movement. */
+                if (i % 2 == 0) {
+                        protein_undo(p);
+                        assert(fabs(potential(p, c, g) - U) < tol*scale);
+                } else {
+                        U = U_new;
+                }
+        }
+
+        delete_contact_map(c);
+        delete_protein(p);
+        gsl_rng_free(r);
+}
+
+void test_potential_delta(void)
+{
+        const double x[] = {-6.0, -4.0, -2.0, -1.0, 0.0, 1.0, 2.0, 4.0, 6.0};
+        const double y[] = { 0.0, -0.1, -0.6, -0.9, -1.0, -0.9, -0.6, -0.1, 0.0};
+        struct go_spline *table = new_go_spline(9, x, y);
+        assert(table != NULL);
+
+        const struct go_potential g[] = {
+                { .family = GO_SQUARE_WELL, .a = 2.0 },
+                { .family = GO_LENNARD_JONES },
+                { .family = GO_GAUSSIAN, .a = 2.0 },
+                { .family = GO_TABULATED, .table = table },
+        };
+
+        for (size_t n = 0; n < sizeof(g)/sizeof(g[0]); n++)
+                check_potential_delta(&g[n]);
+
+        delete_go_spline(table);
+}
+
+/* Every kernel supported by the processor must agree with the scalar
+ * one, both on full evaluations and on energy differences. */
+void test_kernels(void)
+{
+        const char *names[] = {"avx2", "avx512"};
+        const struct potential_kernels *selected = potential_kernels;
+
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+
+        struct protein *p = new_protein_1pgb();
+        struct contact_map *c = new_contact_map(p, 10.0);
+        assert(p != NULL && c != NULL);
+
+        const size_t N = p->num_atoms;
+        const struct go_potential g = { .family = GO_SQUARE_WELL, .a = 2.0 };
+        const double tol = 1e4*REAL_EPSILON;
+
+        for (size_t n = 0; n < 2; n++) {
+                if (potential_kernels_select(names[n]) != 0) {
+                        printf("kernels %s not supported\n", names[n]);
+                        continue;
+                }
+
+                gsl_rng_set(r, gsl_rng_default_seed);
+
+                for (size_t i = 0; i < 2000; i++) {
+                        enum protein_movements mov = i % PROTEIN_NUM_MOVEMENTS;
+                        size_t k = 1 + gsl_rng_uniform_int(r, N - 3);
+
+                        if (!protein_do_movement(p, r, mov, k))
+                                continue;
+
+                        const double U = potential(p, c, &g);
+                        const double DU = potential_delta(p, c, &g);
+
+                        potential_kernels_select("scalar");
+                        assert(fabs(U - potential(p, c, &g)) < tol);
+                        assert(fabs(DU - potential_delta(p, c, &g)) < tol);
+                        potential_kernels_select(names[n]);
+
+                        protein_forget(p);
+                }
+        }
+
+        potential_kernels = selected;
+
+        delete_contact_map(c);
+        delete_protein(p);
+        gsl_rng_free(r);
+}
+
+/* Every family has its minimum, -1 per contact, at the native
+ * conformation. */
+void test_families(void)
+{
+        const double x[] = {-2.0, -1.0, 0.0, 1.0, 2.0};
+        const double y[] = { 0.0, -0.75, -1.0, -0.75, 0.0};
+        struct go_spline *table = new_go_spline(5, x, y);
+        assert(table != NULL);
+        assert(fabs(go_spline_eval(table, 0.0) + 1.0) < 1e-12);
+        assert(fabs(go_spline_eval(table, 1.0) + 0.75) < 1e-12);
+        assert(go_spline_eval(table, 2.5) == 0.0);
+
+        const struct go_potential g[] = {
+                { .family = GO_SQUARE_WELL, .a = 0.9 },
+                { .family = GO_LENNARD_JONES },
+                { .family = GO_GAUSSIAN, .a = 0.9 },
+                { .family = GO_TABULATED, .table = table },
+        };
+
+        struct protein *p = new_protein_1pgb();
+        struct contact_map *c = new_contact_map(p, 10.0);
+        assert(p != NULL && c != NULL);
+
+        for (size_t n = 0; n < sizeof(g)/sizeof(g[0]); n++) {
+                const double U = potential(p, c, &g[n]);
+                printf("potential(1pgb, %s) = %g\n",
+                       go_potential_family_name(g[n].family), U);
+                assert(fabs(U + 366.0) < 1e3*REAL_EPSILON);
+        }
+
+        delete_contact_map(c);
+        delete_protein(p);
+        delete_go_spline(table);
+}
+
+/* Tables are read whole, or not at all with the line at fault. */
+void test_table_file(void)
+{
+        const char *name = "/tmp/go-replicants-table.dat";
+        const char *contents[] = {
+                "# dr U\n-1.0 0.0\n\n0.0 -1.0\n1.0 0.0\n",
+                "# dr U\n-1.0 0.0\n0.0 -1.0 x\n1.0 0.0\n",
+                "# dr U\n-1.0 0.0\n0.0 -1.0\n0.0 0.0\n"
+        };
+        const size_t expected[] = { 0, 3, 4 };
+
+        for (size_t k = 0; k < 3; k++) {
+                FILE *f = fopen(name, "w");
+                assert(f != NULL);
+                fputs(contents[k], f);
+                fclose(f);
+
+                size_t line_number;
+                struct go_spline *table = go_spline_read_file(name, &line_number);
+                assert((table != NULL) == (expected[k] == 0));
+                assert(line_number == expected[k]);
+                if (table != NULL) {
+                        assert(table->n == 3);
+                        assert(fabs(go_spline_eval(table, 0.0) + 1.0) < 1e-12);
+                }
+                delete_go_spline(table);
+        }
+
+        remove(name);
+}
+
+/* A bounded difference is exact below the bound and not below it
+ * otherwise. */
+void test_bounded_delta(void)
+{
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        const double x[] = {-2.0, -1.0, 0.0, 1.0, 2.0};
+        const double y[] = { 0.0, -0.75, -1.0, -0.75, 0.0};
+        struct go_spline *table = new_go_spline(5, x, y);
+        assert(table != NULL && table->min <= -1.0 && table->max >= 0.0);
+
+        const struct go_potential g[] = {
+                { .family = GO_SQUARE_WELL, .a = 2.0 },
+                { .family = GO_LENNARD_JONES },
+                { .family = GO_GAUSSIAN, .a = 2.0 },
+                { .family = GO_TABULATED, .table = table },
+        };
+
+        struct protein *p = new_protein_2gb1();
+        struct contact_map *c = new_contact_map(p, 10.0);
+        assert(p != NULL && c != NULL);
+
+        const size_t N = p->num_atoms;
+
+        for (size_t n = 0; n < sizeof(g)/sizeof(g[0]); n++) {
+                for (size_t i = 0; i < 2000; i++) {
+                        enum protein_movements mov = i % PROTEIN_NUM_MOVEMENTS;
+                        size_t k = 1 + gsl_rng_uniform_int(r, N - 3);
+
+                        if (!protein_do_movement(p, r, mov, k))
+                                continue;
+
+                        const double DU = potential_delta(p, c, &g[n]);
+                        const double bound = 10.0*(gsl_rng_uniform(r) - 0.5);
+                        const double DU_b = potential_delta_bounded(p, c, &g[n], bound);
+
+                        if (DU < bound)
+                                assert(DU_b == DU);
+                        else
+                                assert(DU_b >= bound);
+
+                        protein_undo(p);
+                }
+        }
+
+        delete_contact_map(c);
+        delete_protein(p);
+        delete_go_spline(table);
+        gsl_rng_free(r);
+}
+
+void test_checked_delta(void)
+{
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        const double x[] = {-2.0, -1.0, 0.0, 1.0, 2.0};
+        const double y[] = { 0.0, -0.75, -1.0, -0.75, 0.0};
+        struct go_spline *table = new_go_spline(5, x, y);
+        assert(table != NULL);
+
+        const struct go_potential g[] = {
+                { .family = GO_SQUARE_WELL, .a = 2.0 },
+                { .family = GO_LENNARD_JONES },
+                { .family = GO_GAUSSIAN, .a = 2.0 },
+                { .family = GO_TABULATED, .table = table },
+        };
+
+        struct protein *p = new_protein_1pgb();
+        struct contact_map *c = new_contact_map(p, 10.0);
+        assert(p != NULL && c != NULL);
+
+        const size_t N = p->num_atoms;
+        const double tol = 1e3*REAL_EPSILON;
+        size_t num_overlapping = 0;
+
+        for (size_t n = 0; n < sizeof(g)/sizeof(g[0]); n++) {
+                for (size_t i = 0; i < 4000; i++) {
+                        if (!protein_propose_natural_movement(p, r, i % N))
+                                continue;
+
+                        const size_t start = p->journal.start, end = p->journal.end;
+                        bool overlapping;
+                        const double DU = potential_delta_checked(p, c, &g[n], GSL_POSINF,
+                                                                  &overlapping);
+
+                        if (end - start == 1) {
+                                assert(overlapping == protein_is_overlapping(p, start, end));
+                                num_overlapping += overlapping;
+                        } else {
+                                assert(!overlapping);
+                        }
+
+                        if (!overlapping) {
+                                const double DU_ref = potential_delta(p, c, &g[n]);
+                                assert(fabs(DU - DU_ref) < tol*(1.0 + fabs(DU_ref)));
+                        }
+
+                        if (overlapping || i % 2 == 0)
+                                protein_undo(p);
+                        else
+                                protein_forget(p);
+                }
+        }
+        assert(num_overlapping > 0);
+
+        delete_contact_map(c);
+        delete_protein(p);
+        delete_go_spline(table);
+        gsl_rng_free(r);
+}
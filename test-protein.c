@@ -6,8 +6,16 @@ static bool plot_results = false;
 
 static void test_initialization_and_finalization(void);
 static void test_triple_scalar_product(void);
+static void test_rotation_kernels(void);
 static void test_movements(void);
 static void test_movements2(void);
+static void test_undo(void);
+static void test_torsions(void);
+static void test_cell_list(void);
+static void test_chain_tree(void);
+static void test_move_controller(void);
+static void test_local_movements(void);
+static void test_arena(void);
 
 
 int main(int argc, char __attribute__((unused)) *argv[])
@@ -27,8 +35,16 @@ int main(int argc, char __attribute__((unused)) *argv[])
 
         /* test_initialization_and_finalization(); */
         /* test_triple_scalar_product(); */
+        test_rotation_kernels();
         /* test_movements(); */
         test_movements2();
+        test_undo();
+        test_torsions();
+        test_cell_list();
+        test_chain_tree();
+        test_move_controller();
+        test_local_movements();
+        test_arena();
 
         exit(EXIT_SUCCESS);
 }
@@ -51,9 +67,9 @@ void test_initialization_and_finalization(void)
         /* print_matrix(stdout, m->atoms); */
 
         for (size_t i = 0; i < m->num_atoms; i++) {
-                assert(gsl_vector_get(m->atom[i], 0) == atoms_1pgb[i][0]);
-                assert(gsl_vector_get(m->atom[i], 1) == atoms_1pgb[i][1]);
-                assert(gsl_vector_get(m->atom[i], 2) == atoms_1pgb[i][2]);
+                assert(m->atom[i][0] == (real) atoms_1pgb[i][0]);
+                assert(m->atom[i][1] == (real) atoms_1pgb[i][1]);
+                assert(m->atom[i][2] == (real) atoms_1pgb[i][2]);
         }
 
         printf("%g\n", protein_distance(m, 0, 0));
@@ -89,13 +105,16 @@ void test_triple_scalar_product(void)
         struct protein *m = new_protein_1pgb();
         assert(m != NULL);
 
-        gsl_vector *u = m->atom[0], *v = m->atom[1], *w = m->atom[2];
+        double u[3], v[3], w[3];
+        vec3_from_real(u, m->atom[0]);
+        vec3_from_real(v, m->atom[1]);
+        vec3_from_real(w, m->atom[2]);
 
-        print_vector(stdout, u);
-        print_vector(stdout, v);
-        print_vector(stdout, w);
+        print_point(stdout, m->atom[0]);
+        print_point(stdout, m->atom[1]);
+        print_point(stdout, m->atom[2]);
 
-        double tsp = triple_scalar_product(u, v, w);
+        double tsp = vec3_triple(u, v, w);
         printf("<u, v x w> = %g\n", tsp);
         assert(gsl_fcmp(tsp, -111.89, 1e-4) == 0);
 
@@ -104,6 +123,57 @@ void test_triple_scalar_product(void)
         delete_protein(m);
 }
 
+/*
+ * The rotations of vec3.h are orthonormal and agree with each other.
+ */
+void test_rotation_kernels(void)
+{
+        gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+        assert(rng != NULL);
+
+        for (size_t n = 0; n < 1000; n++) {
+                double q[4], u[3], v[3], R[3][3], r[3], s[3];
+
+                for (size_t i = 0; i < 3; i++) {
+                        u[i] = gsl_ran_gaussian(rng, 1.0);
+                        v[i] = gsl_ran_gaussian(rng, 1.0);
+                }
+                const double theta = M_PI*(2.0*gsl_rng_uniform(rng) - 1.0);
+
+                /* The same rotation as a quaternion and as a matrix
+                 * (see mat3_from_quaternion() for the sign). */
+                mat3_rotation(R, u, theta);
+                vec3_normalize(u);
+                q[0] = cos(theta/2.0);
+                for (size_t i = 0; i < 3; i++)
+                        q[i+1] = -sin(theta/2.0)*u[i];
+
+                mat3_apply(r, false, (const double (*)[3]) R, v);
+                quaternion_apply(s, q, v);
+                for (size_t i = 0; i < 3; i++)
+                        assert(fabs(r[i] - s[i]) < 1e-12);
+
+                double Q[3][3];
+                mat3_from_quaternion(Q, q);
+                for (size_t i = 0; i < 3; i++) {
+                        for (size_t j = 0; j < 3; j++) {
+                                double RRt = 0.0;
+                                for (size_t l = 0; l < 3; l++)
+                                        RRt += R[i][l]*R[j][l];
+                                assert(fabs(RRt - (i == j)) < 1e-12);
+                                assert(fabs(Q[i][j] - R[i][j]) < 1e-12);
+                        }
+                }
+
+                /* The axis is left in place. */
+                mat3_apply(r, true, (const double (*)[3]) R, u);
+                for (size_t i = 0; i < 3; i++)
+                        assert(fabs(r[i] - u[i]) < 1e-12);
+        }
+
+        gsl_rng_free(rng);
+}
+
 
 
 void test_movements(void)
@@ -197,3 +267,385 @@ void test_movements2(void)
 
         gsl_rng_free(r);
 }
+
+
+
+void test_undo(void)
+{
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        struct protein *n = new_protein_2gb1();
+        struct protein *m = protein_dup(n);
+        assert(m != NULL);
+
+        const size_t N = n->num_atoms;
+        const size_t size = N*sizeof(n->atom[0]);
+
+        for (size_t i = 0; i < 1000; i++) {
+                enum protein_movements mov = i % PROTEIN_NUM_MOVEMENTS;
+                size_t k = 1 + gsl_rng_uniform_int(r, N - 3);
+
+                if (protein_do_movement(n, r, mov, k)) {
+                        assert(memcmp(n->atom, m->atom, size) != 0);
+                        protein_undo(n);
+                }
+
+                /* Rejected or undone movements leave the protein intact. */
+                assert(memcmp(n->atom, m->atom, size) == 0);
+                assert(memcmp(n->torsion, m->torsion, N*sizeof(real)) == 0);
+        }
+
+        delete_protein(m);
+        delete_protein(n);
+        gsl_rng_free(r);
+}
+
+/* The cached torsions must follow the conformation through accepted
+ * and undone movements. */
+void test_torsions(void)
+{
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        struct protein *p = new_protein_1pgb();
+        assert(p != NULL);
+
+        const size_t N = p->num_atoms;
+        const double tol = 1e5*REAL_EPSILON;
+
+        for (size_t n = 0; n < 2000; n++) {
+                enum protein_movements mov = n % PROTEIN_NUM_MOVEMENTS;
+                size_t k = 1 + gsl_rng_uniform_int(r, N - 3);
+
+                if (protein_do_movement(p, r, mov, k) && n % 3 == 0)
+                        protein_undo(p);
+                else
+                        protein_forget(p);
+
+                for (size_t i = 0; i + 3 < N; i++) {
+                        const double t = protein_signum(p, i, i+3)*protein_distance(p, i, i+3);
+                        assert(fabs(p->torsion[i] - t) < tol);
+                }
+        }
+
+        delete_protein(p);
+        gsl_rng_free(r);
+}
+
+static bool brute_force_overlaps(const real (*x)[3], size_t n, size_t i, double d)
+{
+        for (size_t j = 0; j < n; j++) {
+                if (j + 1 >= i && j <= i + 1)
+                        continue;
+
+                const real dx = x[j][0] - x[i][0];
+                const real dy = x[j][1] - x[i][1];
+                const real dz = x[j][2] - x[i][2];
+
+                if (dx*dx + dy*dy + dz*dz < (real) (d*d))
+                        return true;
+        }
+
+        return false;
+}
+
+void test_cell_list(void)
+{
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        /* A dense cloud, including negative coordinates, moved around
+         * a few points at a time. */
+        const size_t n = 500;
+        const double d = protein_bead_diameter;
+        real (*x)[3] = malloc(n*sizeof(x[0]));
+        char *base = cache_aligned_alloc(cell_list_size(n));
+        struct cell_list cells;
+
+        assert(x != NULL && base != NULL);
+        cell_list_bind(&cells, n, d, base);
+
+        for (size_t i = 0; i < n; i++)
+                for (size_t j = 0; j < 3; j++)
+                        x[i][j] = (real) (60.0*gsl_rng_uniform(r) - 30.0);
+        cell_list_build(&cells, (const real (*)[3]) x, n);
+
+        for (size_t k = 0; k < 200; k++) {
+                const size_t start = gsl_rng_uniform_int(r, n);
+                const size_t end = start + 1 + gsl_rng_uniform_int(r, GSL_MIN(n - start, 20));
+
+                for (size_t i = start; i < end; i++)
+                        for (size_t j = 0; j < 3; j++)
+                                x[i][j] += (real) (10.0*gsl_rng_uniform(r) - 5.0);
+                cell_list_update(&cells, (const real (*)[3]) x, start, end);
+
+                for (size_t i = 0; i < n; i++)
+                        assert(cell_list_overlaps(&cells, (const real (*)[3]) x, i)
+                               == brute_force_overlaps((const real (*)[3]) x, n, i, d));
+        }
+
+        free(base);
+        free(x);
+
+        /* The index of a protein follows its movements, undos, copies
+         * and swaps. */
+        struct protein *p = new_protein_1pgb();
+        struct protein *q = protein_dup(p);
+        assert(p != NULL && q != NULL);
+        protein_scramble(q, r);
+
+        const size_t N = p->num_atoms;
+        for (size_t k = 0; k < 2000; k++) {
+                enum protein_movements mov = k % PROTEIN_NUM_MOVEMENTS;
+                size_t m = 1 + gsl_rng_uniform_int(r, N - 3);
+
+                if (protein_do_movement(p, r, mov, m) && k % 3 == 0)
+                        protein_undo(p);
+                else
+                        protein_forget(p);
+
+                if (k % 500 == 0)
+                        protein_swap(p, q);
+                else if (k % 500 == 250)
+                        protein_copy(q, p);
+
+                for (size_t i = 0; i < N; i++) {
+                        /* Drop each atom onto another one. */
+                        const size_t j = (i + 2) % N;
+
+                        protein_save_atoms(p, i, i + 1);
+                        memcpy(p->atom[i], p->atom[j], sizeof(p->atom[i]));
+                        p->atom[i][0] += (real) 0.5;
+                        protein_update(p);
+                        assert(protein_is_overlapping(p, i, i + 1)
+                               == brute_force_overlaps((const real (*)[3]) p->atom, N, i, d));
+                        protein_undo(p);
+                        assert(protein_is_not_overlapping(p, 0, N));
+                }
+        }
+
+        delete_protein(q);
+        delete_protein(p);
+        gsl_rng_free(r);
+}
+
+void test_chain_tree(void)
+{
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        /* A random walk, which overlaps itself often, whose tails are
+         * rotated around random pivots. */
+        const size_t n = 300;
+        const double d = protein_bead_diameter;
+        real (*x)[3] = calloc(n, sizeof(x[0]));
+        char *base = cache_aligned_alloc(chain_tree_size(n));
+        struct chain_tree tree;
+
+        assert(x != NULL && base != NULL);
+        chain_tree_bind(&tree, n, base);
+
+        for (size_t i = 1; i < n; i++) {
+                double u[3], s = 0.0;
+                for (size_t j = 0; j < 3; j++) {
+                        u[j] = 2.0*gsl_rng_uniform(r) - 1.0;
+                        s += u[j]*u[j];
+                }
+                for (size_t j = 0; j < 3; j++)
+                        x[i][j] = x[i-1][j] + (real) (3.8*u[j]/sqrt(s));
+        }
+        chain_tree_build(&tree, (const real (*)[3]) x);
+
+        for (size_t m = 0; m < 300; m++) {
+                const size_t k = 1 + gsl_rng_uniform_int(r, n - 1);
+                double R[3][3];
+
+                make_random_rotation_matrix(R, r);
+                for (size_t i = k; i < n; i++)
+                        rotate(false, (const double (*)[3]) R, x[k-1], x[i]);
+                chain_tree_update(&tree, (const real (*)[3]) x, k, n);
+
+                /* Every sphere holds its segment... */
+                for (size_t a = 1; a < 2*tree.num_leaves; a++) {
+                        for (size_t i = tree.lo[a]; i < tree.hi[a]; i++) {
+                                const real *c = x[tree.anchor[a]];
+                                const double s = gsl_pow_2(x[i][0] - c[0])
+                                        + gsl_pow_2(x[i][1] - c[1])
+                                        + gsl_pow_2(x[i][2] - c[2]);
+                                assert(sqrt(s) <= tree.radius[a] + 1e-3);
+                        }
+                }
+
+                /* ...and no overlap is missed. */
+                for (size_t s = 1; s < n; s += 7) {
+                        bool overlap = false;
+
+                        for (size_t i = 0; i < s && !overlap; i++) {
+                                for (size_t j = s; j < n && !overlap; j++) {
+                                        const real dx = x[j][0] - x[i][0];
+                                        const real dy = x[j][1] - x[i][1];
+                                        const real dz = x[j][2] - x[i][2];
+
+                                        overlap = j != i + 1
+                                                && dx*dx + dy*dy + dz*dz < (real) (d*d);
+                                }
+                        }
+
+                        assert(chain_tree_split_overlaps(&tree, (const real (*)[3]) x, s, d)
+                               == overlap);
+                }
+        }
+
+        free(base);
+        free(x);
+        gsl_rng_free(r);
+}
+
+void test_move_controller(void)
+{
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        /* Bounded rotations are rotations, by no more than the bound. */
+        for (size_t n = 0; n < 1000; n++) {
+                const double max_angle = 0.5;
+                double q[4], R[3][3];
+
+                make_bounded_rotation_quaternion(q, r, max_angle);
+                assert(fabs(vec3_dot(q + 1, q + 1) + q[0]*q[0] - 1.0) < 1e-12);
+                mat3_from_quaternion(R, q);
+                for (size_t i = 0; i < 3; i++) {
+                        for (size_t j = 0; j < 3; j++) {
+                                double s = 0.0;
+                                for (size_t k = 0; k < 3; k++)
+                                        s += R[i][k]*R[j][k];
+                                assert(fabs(s - (i == j)) < 1e-12);
+                        }
+                }
+                assert(R[0][0] + R[1][1] + R[2][2] >= 1.0 + 2.0*cos(max_angle) - 1e-12);
+        }
+
+        const size_t N = 56;
+        struct move_controller c;
+        move_controller_init(&c);
+
+        /* Ends get end movements and the rest the interior ones. */
+        for (size_t k = 0; k < N; k++) {
+                const enum protein_movements m = move_controller_choose(&c, r, k, N);
+
+                if (k == 0)
+                        assert(m == PROTEIN_END_MOVE_FIRST);
+                else if (k == N - 1)
+                        assert(m == PROTEIN_END_MOVE_LAST);
+                else
+                        assert(m != PROTEIN_END_MOVE_FIRST && m != PROTEIN_END_MOVE_LAST
+                               && m != PROTEIN_PIVOT_MOVE);
+        }
+
+        /* Nothing changes unless adapting. */
+        for (size_t n = 0; n < 10000; n++)
+                move_controller_record(&c, PROTEIN_SPIKE_MOVE, 1, N, false, 0.0);
+        assert(c.amplitude[PROTEIN_SPIKE_MOVE] == M_PI);
+
+        /* Rejected movements shrink, accepted ones grow back, and the
+         * mix follows the displacement per unit of work. */
+        move_controller_adapt(&c);
+        for (size_t n = 0; n < 10000; n++) {
+                move_controller_record(&c, PROTEIN_SPIKE_MOVE, 1, N, true, 1.0);
+                move_controller_record(&c, PROTEIN_SHIFT_MOVE, 1, N, false, 0.0);
+                move_controller_record(&c, PROTEIN_PIVOT_MOVE, N - 2, N, n % 2 == 0, 1.0);
+        }
+        assert(c.amplitude[PROTEIN_SPIKE_MOVE] == M_PI);
+        assert(c.amplitude[PROTEIN_SHIFT_MOVE] < 0.1);
+        assert(c.amplitude[PROTEIN_PIVOT_MOVE] == M_PI);
+        assert(c.weight[PROTEIN_SPIKE_MOVE] > c.weight[PROTEIN_PIVOT_MOVE]);
+        assert(c.weight[PROTEIN_PIVOT_MOVE] > c.weight[PROTEIN_SHIFT_MOVE]);
+        assert(c.weight[PROTEIN_SHIFT_MOVE] > 0.0);
+        assert(fabs(c.weight[PROTEIN_SPIKE_MOVE] + c.weight[PROTEIN_SHIFT_MOVE]
+                    + c.weight[PROTEIN_PIVOT_MOVE] + c.weight[PROTEIN_CRANKSHAFT_MOVE]
+                    + c.weight[PROTEIN_SEGMENT_MOVE] - 1.0) < 1e-12);
+
+        /* Frozen, it stays as it is. */
+        struct move_controller frozen = c;
+        move_controller_freeze(&c);
+        frozen.adapting = false;
+        for (size_t n = 0; n < 10000; n++)
+                move_controller_record(&c, PROTEIN_SHIFT_MOVE, 1, N, true, 1.0);
+        assert(memcmp(&c, &frozen, sizeof(c)) == 0);
+
+        gsl_rng_free(r);
+}
+
+void test_local_movements(void)
+{
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_env_setup();
+        gsl_rng_set(r, gsl_rng_default_seed);
+
+        struct protein *p = new_protein_1pgb();
+        struct protein *q = protein_dup(p);
+        assert(p != NULL && q != NULL);
+
+        const size_t N = p->num_atoms;
+        size_t num_moved[2] = {0, 0};
+
+        for (size_t n = 0; n < 4000; n++) {
+                const bool crankshaft = n % 2 == 0;
+                const size_t k = 1 + gsl_rng_uniform_int(r, N - 2);
+                const bool moved = crankshaft ? protein_do_crankshaft_move(p, r, k)
+                                              : protein_do_segment_move(p, r, k);
+
+                if (!moved) {
+                        assert(memcmp(p->atom, q->atom, N*sizeof(p->atom[0])) == 0);
+                        continue;
+                }
+                num_moved[crankshaft]++;
+
+                /* Only the segment moves, and the bonds keep their length. */
+                const size_t start = p->journal.start, end = p->journal.end;
+                assert(start == k && end < N);
+                if (crankshaft)
+                        assert(end - start == GSL_MIN(2, N - 1 - k));
+                else
+                        assert(end - start >= GSL_MIN(3, N - 1 - k) && end - start <= 8);
+                for (size_t i = 0; i < N; i++)
+                        if (i < start || i >= end)
+                                assert(memcmp(p->atom[i], q->atom[i], sizeof(p->atom[i])) == 0);
+                for (size_t i = start - 1; i < end; i++)
+                        assert(fabs(protein_distance(p, i, i+1)
+                                    - protein_distance(q, i, i+1)) < 1e3*REAL_EPSILON);
+                assert(protein_is_not_overlapping(p, 0, N));
+
+                protein_forget(p);
+                protein_copy(q, p);
+        }
+        assert(num_moved[0] > 0 && num_moved[1] > 0);
+
+        delete_protein(q);
+        delete_protein(p);
+        gsl_rng_free(r);
+}
+
+/* Arenas on huge pages start and end on them. */
+void test_arena(void)
+{
+        const size_t huge_page_size = 2*1024*1024;
+
+        for (size_t n = 0; n < 2; n++) {
+                struct arena *a = new_arena(n == 0 ? 100000 : 3*huge_page_size + 1, true);
+                assert(a != NULL);
+                assert((uintptr_t) a->base % huge_page_size == 0);
+                assert(a->size % huge_page_size == 0 && a->size > (n == 0 ? 0 : 3*huge_page_size));
+
+                char *block = arena_alloc(a, 1000);
+                assert(block == a->base);
+                memset(block, 1, 1000);
+                delete_arena(a);
+        }
+}
@@ -1,12 +1,38 @@
+#define _GNU_SOURCE             /* For sched_getaffinity(). */
 #undef NDEBUG
 #include "molecular-simulator.h"
 
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
 
 static void show_progress(struct replicas *r, size_t k);
+static void test_threading_plan(void);
+static void test_random_streams(void);
+static void test_asynchronous_exchange(void);
+static void test_temperature_ladder(void);
+static void test_ladder_tuning(void);
+static void test_exchange_rounds(void);
+static void test_distributed_exchange(void);
+static void test_failed_handshake(void);
+static void test_batch(void);
+static void run_group(const char *address, size_t group);
 
 
 int main(void)
 {
+        /* First: the groups are forked, and that is only safe before
+         * any OpenMP thread exists. */
+        test_distributed_exchange();
+        test_failed_handshake();
+        test_threading_plan();
+        test_random_streams();
+        test_asynchronous_exchange();
+        test_temperature_ladder();
+        test_ladder_tuning();
+        test_exchange_rounds();
+        test_batch();
 
         struct protein *p = new_protein_2gb1();
         assert(p != NULL);
@@ -21,11 +47,14 @@ int main(void)
         const size_t num_replicas = sizeof(temperatures)/sizeof(temperatures[0]);
         /* linspace(0.1, 0.9, num_replicas, temperatures); */
         struct simulation_options options = {
-                .rng = rng, .a = 0.5, .d_max = 10.0,
+                .rng = rng, .seed = gsl_rng_default_seed,
+                .a = 0.5, .d_max = 10.0,
                 .num_replicas = num_replicas, .temperatures = temperatures
         };
         struct replicas *r = new_replicas(p, &options);
+        assert(r != NULL);
 
+        replicas_first_iteration(r);
         replicas_thermalize(r, 1);
         /* while (replicas_have_not_converged(r)) { */
         for (size_t k = 1; k < 100; k++) {
@@ -34,7 +63,6 @@ int main(void)
                 ++k;
         }
 
-        delete_protein(p);
         delete_replicas(r);
         gsl_rng_free(rng);
         exit(EXIT_SUCCESS);
@@ -42,6 +70,429 @@ int main(void)
 
 
 
+void test_threading_plan(void)
+{
+        /* Never more threads than requested, nor than replicas. */
+        for (size_t R = 1; R <= 32; R++) {
+                struct threading t = threading_plan(8, R);
+                assert(t.replica_threads == (int) GSL_MIN(R, 8));
+        }
+
+        /* Longest first beats the static schedule on uneven costs. */
+        const double cost[] = { 5.0, 4.0, 3.0, 3.0, 3.0 };
+        int thread[5];
+        assert(threading_assign(cost, 5, 2, thread) == 10.0);
+        assert(threading_static_makespan(cost, 5, 2) == 12.0);
+        assert(thread[0] != thread[1]);
+
+        /* Without costs replicas stay where they were first touched. */
+        const double unknown[5] = { 0.0 };
+        threading_assign(unknown, 5, 2, thread);
+        assert(thread[0] == 0 && thread[2] == 0 && thread[3] == 1 && thread[4] == 1);
+        assert(threading_makespan(cost, 5, 2, thread) == 12.0);
+
+        /* Pinned to a CPU, and back to all of them. */
+        enum threading_binding binding;
+        assert(threading_binding_parse("spread", &binding) == 0);
+        assert(binding == THREADING_SPREAD);
+        assert(threading_binding_parse("numa", &binding) != 0);
+
+        cpu_set_t set;
+        assert(sched_getaffinity(0, sizeof(set), &set) == 0);
+        const int num_cpus = CPU_COUNT(&set);
+        struct threading pinned = { 1, THREADING_CORES };
+        threading_apply(&pinned);
+        threading_pin(&pinned, 0);
+        assert(sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1);
+        pinned.binding = THREADING_UNBOUND;
+        threading_apply(&pinned);
+        threading_pin(&pinned, 0);
+        assert(sched_getaffinity(0, sizeof(set), &set) == 0
+               && CPU_COUNT(&set) == num_cpus);
+}
+
+void test_random_streams(void)
+{
+        /* Known answers of the Random123 distribution. */
+        const uint32_t key[3][2] = {
+                { 0, 0 }, { 0xffffffff, 0xffffffff }, { 0xa4093822, 0x299f31d0 }
+        };
+        const uint32_t counter[3][4] = {
+                { 0, 0, 0, 0 },
+                { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff },
+                { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 }
+        };
+        const uint32_t expected[3][4] = {
+                { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+                { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+                { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 }
+        };
+        for (size_t i = 0; i < 3; i++) {
+                uint32_t out[4];
+                random_stream_block(key[i], counter[i], out);
+                assert(memcmp(out, expected[i], sizeof(out)) == 0);
+        }
+
+        /* Streams depend on the seed and the stream number only. */
+        gsl_rng *a = gsl_rng_alloc(random_stream_philox);
+        gsl_rng *b = gsl_rng_alloc(random_stream_philox);
+        assert(a != NULL && b != NULL);
+
+        random_stream_set(a, 42, 3);
+        random_stream_set(b, 42, 3);
+        double sum = 0.0;
+        const size_t n = 10*4*RANDOM_STREAM_BATCH + 5;
+        for (size_t i = 0; i < n; i++) {
+                const double u = gsl_rng_uniform(a);
+                assert(u == gsl_rng_uniform(b));
+                assert(0.0 <= u && u < 1.0);
+                sum += u;
+        }
+        assert(fabs(sum/(double) n - 0.5) < 0.05);
+
+        random_stream_set(a, 42, 3);
+        random_stream_set(b, 42, 4);
+        size_t same = 0;
+        for (size_t i = 0; i < n; i++)
+                same += gsl_rng_get(a) == gsl_rng_get(b);
+        assert(same < 2);
+
+        gsl_rng_free(a);
+        gsl_rng_free(b);
+}
+
+/*
+ * Asynchronous runs do not depend on the order in which the threads
+ * reach their exchange points.
+ */
+void test_asynchronous_exchange(void)
+{
+        double temperatures[] = { 0.2, 0.25, 0.3 };
+        double energy[2][3];
+        size_t exchanges[2];
+
+        for (size_t run = 0; run < 2; run++) {
+                gsl_rng *rng = gsl_rng_alloc(random_stream_philox);
+                assert(rng != NULL);
+
+                struct simulation_options options = {
+                        .rng = rng, .seed = 7, .a = 0.5, .d_max = 10.0,
+                        .num_replicas = 3, .temperatures = temperatures,
+                        .asynchronous = true,
+                        .num_threads = 3
+                };
+                struct replicas *r = new_replicas(new_protein_1pgb(), &options);
+                assert(r != NULL);
+
+                replicas_first_iteration(r);
+                replicas_run(r, 2);
+#ifdef _OPENMP
+                assert(r->round == 2);
+#endif
+                for (size_t k = 0; k < 3; k++)
+                        energy[run][k] = r->replica[k]->energy;
+                exchanges[run] = replicas_total_exchanges(r);
+
+                delete_replicas(r);
+                gsl_rng_free(rng);
+        }
+
+        assert(memcmp(energy[0], energy[1], sizeof(energy[0])) == 0);
+        assert(exchanges[0] == exchanges[1]);
+}
+
+/*
+ * With a constant heat capacity the ladder of equal acceptance is
+ * geometric.
+ */
+void test_temperature_ladder(void)
+{
+        const double C = 50.0, t_min = 0.1, t_max = 1.0;
+        const size_t num_samples = 200, n = 8;
+        struct ladder_sample samples[num_samples];
+
+        for (size_t i = 0; i < num_samples; i++) {
+                const double t = t_min + (t_max - t_min)*(double) i/(double) (num_samples - 1);
+                ladder_sample_init(&samples[i], t);
+                samples[i].count = 2;
+                samples[i].mean = C*t;
+                samples[i].m2 = C*t*t;
+        }
+
+        double t[n];
+        const double acceptance = ladder_equalize(samples, num_samples, t, n);
+        assert(acceptance > 0.0 && acceptance < 1.0);
+        assert(t[0] == t_min && t[n - 1] == t_max);
+        for (size_t k = 0; k < n; k++)
+                assert(gsl_fcmp(t[k], t_min*pow(t_max/t_min, (double) k/(double) (n - 1)),
+                                1e-2) == 0);
+        for (size_t k = 0; k + 1 < n; k++)
+                assert(gsl_fcmp(ladder_acceptance(samples, num_samples, t[k], t[k + 1]),
+                                acceptance, 1e-3) == 0);
+
+        /* A higher target needs more temperatures. */
+        double u[64];
+        const size_t m = ladder_place(samples, num_samples, 0.5, u, 64);
+        assert(m > 2 && m < 64 && u[0] == t_min && u[m - 1] == t_max);
+        for (size_t k = 0; k + 1 < m; k++)
+                assert(ladder_acceptance(samples, num_samples, u[k], u[k + 1]) >= 0.5 - 1e-9);
+        assert(ladder_place(samples, num_samples, 0.5, u, m - 1) == 0);
+}
+
+/*
+ * Tuning keeps the extreme temperatures and the energies of the
+ * replicas consistent with their conformations.
+ */
+void test_ladder_tuning(void)
+{
+        double temperatures[] = { 0.2, 0.3, 0.8 };
+        gsl_rng *rng = gsl_rng_alloc(random_stream_philox);
+        assert(rng != NULL);
+
+        struct simulation_options options = {
+                .rng = rng, .seed = 11, .a = 0.5, .d_max = 10.0,
+                .num_replicas = 3, .temperatures = temperatures
+        };
+        struct replicas *r = new_replicas(new_protein_1pgb(), &options);
+        assert(r != NULL);
+        replicas_first_iteration(r);
+
+        /* Without a target the number of replicas stays. */
+        for (size_t pass = 0; pass < 3; pass++) {
+                const size_t n = r->num_replicas;
+                r = replicas_tune_ladder(r, 200, pass == 1 ? 0.4 : 0.0);
+                assert(r != NULL);
+                if (pass == 1)
+                        assert(r->num_replicas >= 2
+                               && r->predicted_acceptance >= 0.4 - 1e-9);
+                else
+                        assert(r->num_replicas == n);
+
+                assert(r->replica[0]->temperature == 0.2);
+                assert(r->replica[r->num_replicas - 1]->temperature == 0.8);
+                for (size_t k = 0; k < r->num_replicas; k++) {
+                        const struct simulation *s = r->replica[k];
+                        assert(k == 0 || s->temperature > r->replica[k - 1]->temperature);
+                        assert(s->go == &r->go);
+                        assert(fabs(s->energy - potential(s->protein, r->native_map,
+                                                          &r->go)) < 1e-3);
+                }
+        }
+        replicas_run(r, 1);
+
+        delete_replicas(r);
+        gsl_rng_free(rng);
+}
+
+/*
+ * Many rounds of exchanges between any two temperatures move every
+ * conformation along with its energy, and are all accounted for.
+ */
+void test_exchange_rounds(void)
+{
+        double temperatures[] = { 0.2, 0.4, 0.6, 0.8 };
+        const size_t n = 4, rounds = 20;
+        gsl_rng *rng = gsl_rng_alloc(random_stream_philox);
+        assert(rng != NULL);
+
+        struct simulation_options options = {
+                .rng = rng, .seed = 7, .a = 0.5, .d_max = 10.0,
+                .num_replicas = n, .temperatures = temperatures,
+                .exchange_rounds = rounds, .any_pair = true
+        };
+        struct replicas *r = new_replicas(new_protein_1pgb(), &options);
+        assert(r != NULL);
+
+        replicas_first_iteration(r);
+        replicas_next_iteration(r);
+        replicas_next_iteration(r);
+
+        size_t attempts = 0;
+        for (size_t i = 0; i < n; i++) {
+                const struct simulation *s = r->replica[i];
+                const double U = potential(s->protein, r->native_map, &r->go);
+                assert(fabs(U - s->energy) < 1e-3);
+
+                for (size_t j = i + 1; j < n; j++) {
+                        attempts += r->pair_total[i*n + j];
+                        assert(replicas_get_acceptance(r, i, j)
+                               == replicas_get_acceptance(r, j, i));
+                }
+                if (i + 1 < n)
+                        assert(r->total[i] == r->pair_total[i*n + i + 1]);
+        }
+        assert(attempts == 2*rounds*(n - 1));
+
+        delete_replicas(r);
+        gsl_rng_free(rng);
+}
+
+/*
+ * Jobs run in a batch, on one pool of threads, follow the trajectories
+ * they follow when run alone, and keep their files apart.
+ */
+void test_batch(void)
+{
+        double temperatures[2][3] = { { 0.2, 0.4 }, { 0.3, 0.5, 0.7 } };
+        const size_t num_replicas[2] = { 2, 3 };
+        const char *directory[2] = { "batch-a", "batch-b" };
+        double energy[2][2][3];
+
+        for (size_t run = 0; run < 2; run++) {
+                struct replicas *jobs[2];
+                gsl_rng *rng[2];
+
+                for (size_t j = 0; j < 2; j++) {
+                        assert(mkdir(directory[j], 0777) == 0 || errno == EEXIST);
+                        rng[j] = gsl_rng_alloc(random_stream_philox);
+                        assert(rng[j] != NULL);
+
+                        struct simulation_options options = {
+                                .rng = rng[j], .seed = 5 + j, .a = 0.5, .d_max = 10.0,
+                                .num_replicas = num_replicas[j],
+                                .temperatures = temperatures[j],
+                                .stream_offset = (j + 1) << 32,
+                                .directory = directory[j],
+                                .num_threads = 3
+                        };
+                        jobs[j] = new_replicas(new_protein_1pgb(), &options);
+                        assert(jobs[j] != NULL);
+                        replicas_first_iteration(jobs[j]);
+                }
+
+                if (run == 0) {
+                        for (size_t j = 0; j < 2; j++) {
+                                threading_apply(&jobs[j]->threading);
+                                replicas_thermalize(jobs[j], 1000);
+                                replicas_run(jobs[j], 2);
+                        }
+                } else {
+                        const struct threading plan = threading_plan(3, 5);
+                        threading_apply(&plan);
+                        replicas_thermalize_batch(jobs, 2, &plan, 1000);
+                        replicas_run_batch(jobs, 2, &plan, 2);
+                }
+
+                for (size_t j = 0; j < 2; j++) {
+                        for (size_t k = 0; k < num_replicas[j]; k++)
+                                energy[run][j][k] = jobs[j]->replica[k]->energy;
+                        delete_replicas(jobs[j]);
+                        gsl_rng_free(rng[j]);
+                }
+        }
+
+        for (size_t j = 0; j < 2; j++)
+                assert(memcmp(energy[0][j], energy[1][j],
+                              num_replicas[j]*sizeof(double)) == 0);
+
+        assert(access("batch-a/replicas.log", F_OK) == 0);
+        assert(access("batch-b/U--t-0.70000--dmax-10.00000--a-0.50000.dat", F_OK) == 0);
+        assert(access("batch-a/U--t-0.70000--dmax-10.00000--a-0.50000.dat", F_OK) != 0);
+}
+
+/*
+ * Two processes with a replica each and a coordinator in a third make
+ * the same exchanges over a socket as through shared memory.
+ */
+void test_distributed_exchange(void)
+{
+        const char *addresses[] = {
+                "unix:/tmp/go-replicants-test.sock", "shm:/go-replicants-test"
+        };
+        const double temperatures[] = { 0.2, 0.3 };
+        size_t holder[2][2], exchanges[2];
+
+        for (size_t run = 0; run < 2; run++) {
+                pid_t pid[2];
+
+                for (size_t g = 0; g < 2; g++) {
+                        pid[g] = fork();
+                        assert(pid[g] != -1);
+                        if (pid[g] == 0)
+                                run_group(addresses[run], g);
+                }
+
+                struct coordinator *c = new_coordinator(addresses[run], 2,
+                                                        temperatures, 2, 7);
+                assert(c != NULL);
+                assert(coordinator_run(c, 2) == 0);
+                assert(coordinator_stop(c) == 0);
+                assert(c->round == 2 && c->total[0] == 1);
+                memcpy(holder[run], c->holder, sizeof(holder[run]));
+                exchanges[run] = c->exchanges[0];
+                delete_coordinator(c);
+
+                for (size_t g = 0; g < 2; g++) {
+                        int status;
+                        assert(waitpid(pid[g], &status, 0) == pid[g]);
+                        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+                }
+        }
+
+        assert(memcmp(holder[0], holder[1], sizeof(holder[0])) == 0);
+        assert(exchanges[0] == exchanges[1]);
+        assert(holder[0][0] == (exchanges[0] == 0 ? 0 : 1));
+}
+
+/*
+ * A group with more replicas than the ladder has temperatures is turned
+ * away, and the coordinator gives up instead of waiting for it.
+ */
+void test_failed_handshake(void)
+{
+        const char *addresses[] = {
+                "unix:/tmp/go-replicants-test.sock", "shm:/go-replicants-test"
+        };
+        const double temperatures[] = { 0.2, 0.3 };
+
+        for (size_t run = 0; run < 2; run++) {
+                const pid_t pid = fork();
+                assert(pid != -1);
+                if (pid == 0) {
+                        struct channel link;
+                        double t[3];
+                        _exit(coordinator_join(&link, addresses[run], 0, 3, t) == -1
+                              ? EXIT_SUCCESS : EXIT_FAILURE);
+                }
+
+                assert(new_coordinator(addresses[run], 1, temperatures, 2, 7) == NULL);
+
+                int status;
+                assert(waitpid(pid, &status, 0) == pid);
+                assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        }
+}
+
+/* Body of a forked group: never returns. */
+void run_group(const char *address, size_t group)
+{
+        struct channel link;
+        double temperature;
+
+        if (coordinator_join(&link, address, group, 1, &temperature) == -1
+            || temperature != (group == 0 ? 0.2 : 0.3))
+                _exit(EXIT_FAILURE);
+
+        gsl_rng *rng = gsl_rng_alloc(random_stream_philox);
+        struct simulation_options options = {
+                .rng = rng, .seed = 7, .stream_offset = (group + 1) << 32,
+                .a = 0.5, .d_max = 10.0,
+                .num_replicas = 1, .temperatures = &temperature,
+                .num_threads = 1
+        };
+        struct replicas *r = new_replicas(new_protein_1pgb(), &options);
+        if (r == NULL)
+                _exit(EXIT_FAILURE);
+
+        replicas_first_iteration(r);
+        const int status = replicas_run_remote(r, &link);
+
+        channel_close(&link);
+        delete_replicas(r);
+        gsl_rng_free(rng);
+        _exit(status == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
 void show_progress(struct replicas *r, size_t k)
 {
         if (k != 1 && k % 100 != 0)
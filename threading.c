@@ -0,0 +1,323 @@
+#define _GNU_SOURCE             /* For sched_setaffinity(). */
+#include "molecular-simulator.h"
+
+#include <sched.h>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+
+/* Most CPUs threads are pinned to. */
+#define THREADING_MAX_CPUS 1024
+
+static const char *binding_names[] = {
+        [THREADING_UNBOUND] = "none",
+        [THREADING_CORES] = "cores",
+        [THREADING_SPREAD] = "spread"
+};
+
+/* Place of a CPU in the machine, and its sort keys for a binding. */
+struct cpu_place {
+        int cpu, package, core;
+        int sibling;            /* Hardware threads of its core before it. */
+        int rank;               /* Cores of its package before its own. */
+};
+
+/*
+ * CPUs the process may run on, in the order the replica threads are
+ * pinned to them, as set by threading_apply().  Every plan applied
+ * gets a generation, so that threads know to pin themselves again.
+ */
+static int cpu_order[THREADING_MAX_CPUS];
+static size_t num_cpus;
+static int plan_generation;
+static __thread int pinned_generation, pinned_thread = -1;
+
+static size_t order_cpus(enum threading_binding binding, int order[]);
+static int read_topology(int cpu, const char *name);
+static int compare_cores(const void *a, const void *b);
+static int compare_spread(const void *a, const void *b);
+
+
+/** Sets binding from its name.  Returns -1 if the name is unknown. */
+int threading_binding_parse(const char *name, enum threading_binding *binding)
+{
+        for (size_t k = 0; k < sizeof(binding_names)/sizeof(binding_names[0]); k++) {
+                if (strcmp(name, binding_names[k]) == 0) {
+                        *binding = (enum threading_binding) k;
+                        return 0;
+                }
+        }
+
+        return -1;
+}
+
+const char *threading_binding_name(enum threading_binding binding)
+{
+        return binding_names[binding];
+}
+
+size_t threading_num_cores(void)
+{
+#ifdef _OPENMP
+        return (size_t) omp_get_num_procs();
+#else
+        const long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (size_t) n : 1;
+#endif
+}
+
+/** Gives num_threads (all the cores if zero) to the replicas, one
+ * each.  Threads beyond one per replica would have nothing to do, so
+ * they are left out. */
+struct threading threading_plan(size_t num_threads, size_t num_replicas)
+{
+        struct threading t = { 1, THREADING_UNBOUND };
+
+        if (num_threads == 0)
+                num_threads = threading_num_cores();
+        t.replica_threads = (int) GSL_MIN(num_replicas, num_threads);
+
+        return t;
+}
+
+/** Configures the OpenMP runtime for the plan, so that the result does
+ * not depend on OMP_NESTED and friends: a replica thread never starts
+ * threads of its own. */
+void threading_apply(const struct threading *self)
+{
+#ifdef _OPENMP
+        omp_set_dynamic(0);
+        omp_set_max_active_levels(1);
+#endif
+        num_cpus = order_cpus(self->binding, cpu_order);
+        ++plan_generation;
+}
+
+/** Pins the calling thread, the given one of those running replicas,
+ * to a CPU of its own as the plan says.  Does nothing if it is pinned
+ * already, so it is cheap enough to call at the start of every
+ * parallel region. */
+void threading_pin(const struct threading *self, int thread)
+{
+#ifdef CPU_SET
+        if (num_cpus == 0
+            || (pinned_generation == plan_generation && pinned_thread == thread))
+                return;
+        if (self->binding == THREADING_UNBOUND && pinned_thread == -1)
+                return;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((size_t) cpu_order[(size_t) thread % num_cpus], &set);
+
+        /* Unbound after bound: back to every CPU allowed. */
+        if (self->binding == THREADING_UNBOUND)
+                for (size_t i = 0; i < num_cpus; i++)
+                        CPU_SET((size_t) cpu_order[i], &set);
+
+        sched_setaffinity(0, sizeof(set), &set);
+        pinned_generation = plan_generation;
+        pinned_thread = self->binding == THREADING_UNBOUND ? -1 : thread;
+#else
+        (void) self, (void) thread;
+#endif
+}
+
+/*
+ * Orders the CPUs the process was started on for binding: one hardware
+ * thread of every core before the second of any, and then either the
+ * cores of a package before the next, or the first core of every
+ * package before the second of any.  Without a topology in sysfs every
+ * CPU counts as a core of a single package.
+ */
+size_t order_cpus(enum threading_binding binding, int order[])
+{
+#ifdef CPU_SET
+        /* Threads may be pinned by now: ask once, before any is. */
+        static cpu_set_t allowed;
+        static bool known = false;
+        if (!known) {
+                if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+                        return 0;
+                known = true;
+        }
+
+        struct cpu_place place[THREADING_MAX_CPUS];
+        size_t n = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE && n < THREADING_MAX_CPUS; cpu++) {
+                if (!CPU_ISSET((size_t) cpu, &allowed))
+                        continue;
+                const int package = read_topology(cpu, "physical_package_id");
+                const int core = read_topology(cpu, "core_id");
+                place[n] = (struct cpu_place) {
+                        .cpu = cpu,
+                        .package = package < 0 ? 0 : package,
+                        .core = core < 0 ? cpu : core
+                };
+                n++;
+        }
+
+        for (size_t i = 0; i < n; i++)
+                for (size_t j = 0; j < i; j++)
+                        if (place[j].package == place[i].package
+                            && place[j].core == place[i].core)
+                                place[i].sibling++;
+        for (size_t i = 0; i < n; i++)
+                for (size_t j = 0; j < n; j++)
+                        if (place[j].package == place[i].package
+                            && place[j].sibling == 0 && place[j].core < place[i].core)
+                                place[i].rank++;
+
+        qsort(place, n, sizeof(place[0]),
+              binding == THREADING_SPREAD ? compare_spread : compare_cores);
+        for (size_t i = 0; i < n; i++)
+                order[i] = place[i].cpu;
+
+        return n;
+#else
+        (void) binding, (void) order;
+
+        return 0;
+#endif
+}
+
+/* An entry of /sys/devices/system/cpu/cpuN/topology, or -1. */
+int read_topology(int cpu, const char *name)
+{
+        char path[PATH_MAX];
+        int value = -1;
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+                return -1;
+        if (fscanf(f, "%d", &value) != 1)
+                value = -1;
+        fclose(f);
+
+        return value;
+}
+
+int compare_cores(const void *a, const void *b)
+{
+        const struct cpu_place *p = a, *q = b;
+
+        if (p->sibling != q->sibling)
+                return p->sibling - q->sibling;
+        if (p->package != q->package)
+                return p->package - q->package;
+        if (p->core != q->core)
+                return p->core - q->core;
+        return p->cpu - q->cpu;
+}
+
+int compare_spread(const void *a, const void *b)
+{
+        const struct cpu_place *p = a, *q = b;
+
+        if (p->sibling != q->sibling)
+                return p->sibling - q->sibling;
+        if (p->rank != q->rank)
+                return p->rank - q->rank;
+        if (p->package != q->package)
+                return p->package - q->package;
+        return p->cpu - q->cpu;
+}
+
+
+
+/** Assigns n tasks of the given costs to num_threads threads, longest
+ * first, each to the thread with the least work so far (LPT, within
+ * 4/3 of the best makespan).  Tasks of unknown (zero) cost count as
+ * the mean of the known ones; if none is known the assignment is that
+ * of the static schedule, which is where the replicas were first
+ * touched.  Returns the makespan predicted. */
+double threading_assign(const double cost[], size_t n, int num_threads,
+                        int thread[])
+{
+        assert(num_threads >= 1);
+
+        const size_t T = (size_t) num_threads;
+        double known = 0.0, load[num_threads], c[n];
+        size_t num_known = 0, order[n];
+
+        for (size_t k = 0; k < n; k++)
+                if (cost[k] > 0.0) {
+                        known += cost[k];
+                        ++num_known;
+                }
+
+        if (num_known == 0) {
+                for (size_t t = 0, k = 0; t < T; t++)
+                        for (size_t end = k + n/T + (t < n%T); k < end; k++)
+                                thread[k] = (int) t;
+                return (double) (n/T + (n%T > 0));
+        }
+
+        for (size_t k = 0; k < n; k++) {
+                c[k] = cost[k] > 0.0 ? cost[k] : known/(double) num_known;
+                order[k] = k;
+        }
+
+        /* Insertion sort by decreasing cost: n is a few hundred at most. */
+        for (size_t i = 1; i < n; i++)
+                for (size_t j = i; j > 0 && c[order[j]] > c[order[j - 1]]; j--) {
+                        const size_t o = order[j];
+                        order[j] = order[j - 1];
+                        order[j - 1] = o;
+                }
+
+        for (int t = 0; t < num_threads; t++)
+                load[t] = 0.0;
+
+        double makespan = 0.0;
+        for (size_t i = 0; i < n; i++) {
+                int t = 0;
+                for (int u = 1; u < num_threads; u++)
+                        if (load[u] < load[t])
+                                t = u;
+                thread[order[i]] = t;
+                load[t] += c[order[i]];
+                makespan = GSL_MAX(makespan, load[t]);
+        }
+
+        return makespan;
+}
+
+/** Makespan of n tasks of the given costs as assigned to threads. */
+double threading_makespan(const double cost[], size_t n, int num_threads,
+                          const int thread[])
+{
+        double load[num_threads], makespan = 0.0;
+
+        for (int t = 0; t < num_threads; t++)
+                load[t] = 0.0;
+        for (size_t k = 0; k < n; k++) {
+                assert(thread[k] >= 0 && thread[k] < num_threads);
+                load[thread[k]] += cost[k];
+                makespan = GSL_MAX(makespan, load[thread[k]]);
+        }
+
+        return makespan;
+}
+
+/** Makespan of n tasks of the given costs under OpenMP's static
+ * schedule: contiguous runs, the first n % num_threads threads taking
+ * one task more. */
+double threading_static_makespan(const double cost[], size_t n,
+                                 int num_threads)
+{
+        const size_t T = (size_t) num_threads, q = n/T, r = n%T;
+        double makespan = 0.0;
+
+        for (size_t t = 0, k = 0; t < T && k < n; t++) {
+                double load = 0.0;
+                for (size_t end = k + q + (t < r); k < end; k++)
+                        load += cost[k];
+                makespan = GSL_MAX(makespan, load);
+        }
+
+        return makespan;
+}
@@ -0,0 +1,38 @@
+#ifndef THREADING_H
+#define THREADING_H
+
+/** Where the threads running replicas are pinned. */
+enum threading_binding {
+        THREADING_UNBOUND = 0,          /**< Wherever the kernel puts them. */
+        THREADING_CORES,                /**< A core each, filling a socket before the next. */
+        THREADING_SPREAD                /**< A core each, round robin over the sockets. */
+};
+
+/** Threading plan: never more threads than it was made for.  Only
+ * whole replicas are run in parallel, a thread each at most: a step
+ * only evaluates the energy difference of the atoms it moved, far too
+ * little work to split between threads. */
+struct threading {
+        int replica_threads;    /**< Threads running replicas concurrently. */
+        enum threading_binding binding; /**< Unbound unless set after planning. */
+};
+
+
+extern int threading_binding_parse(const char *name,
+                                   enum threading_binding *binding);
+extern const char *threading_binding_name(enum threading_binding binding);
+
+extern size_t threading_num_cores(void);
+
+extern struct threading threading_plan(size_t num_threads, size_t num_replicas);
+extern void threading_apply(const struct threading *self);
+extern void threading_pin(const struct threading *self, int thread);
+
+extern double threading_assign(const double cost[], size_t n,
+                               int num_threads, int thread[]);
+extern double threading_makespan(const double cost[], size_t n,
+                                 int num_threads, const int thread[]);
+extern double threading_static_makespan(const double cost[], size_t n,
+                                        int num_threads);
+
+#endif // !THREADING_H
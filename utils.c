@@ -1,8 +1,16 @@
 #include "molecular-simulator.h"
 
+#include <sched.h>
+
 
 static const char *prog_name;
 
+/* A backoff yields this many times, and then sleeps from the first
+ * interval, doubling up to the last. */
+static const size_t backoff_yields = 1000;
+static const long backoff_first_ns = 1000L;
+static const long backoff_last_ns = 1000000L;
+
 
 void set_prog_name(const char *name)
 {
@@ -16,6 +24,56 @@ const char *get_prog_name(void)
 }
 
 
+/** Allocates a block of memory starting at a cache line boundary.  The
+ * result must be released with free. */
+void *cache_aligned_alloc(size_t size)
+{
+        void *ptr;
+
+        if (posix_memalign(&ptr, CACHE_LINE_SIZE, cache_line_round_up(size)) != 0)
+                return NULL;
+
+        return ptr;
+}
+
+/** Seconds on a monotonic clock, for measuring intervals. */
+double wall_time(void)
+{
+        struct timespec t;
+
+        clock_gettime(CLOCK_MONOTONIC, &t);
+
+        return (double) t.tv_sec + 1e-9*(double) t.tv_nsec;
+}
+
+/** Whether the pauses of the backoff have turned into sleeps. */
+bool backoff_is_sleeping(const struct backoff *self)
+{
+        return self->pauses >= backoff_yields;
+}
+
+/** Pauses before the waiting caller looks again.  Returns the seconds
+ * slept, zero if it only yielded. */
+double backoff_pause(struct backoff *self)
+{
+        if (self->pauses++ < backoff_yields) {
+                sched_yield();
+                return 0.0;
+        }
+
+        if (self->delay == 0)
+                self->delay = backoff_first_ns;
+
+        const struct timespec ts = { 0, self->delay };
+        nanosleep(&ts, NULL);
+
+        const double slept = 1e-9*(double) self->delay;
+        self->delay = GSL_MIN(2*self->delay, backoff_last_ns);
+
+        return slept;
+}
+
+
 void die(const char *message)
 {
         fprintf(stderr, "%s: %s\n", prog_name, message);
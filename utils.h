@@ -23,6 +23,36 @@
                 gsl_matrix_view_array((double *) stack_allocated_matrix_array_##name, m, n); \
         gsl_matrix *name = &stack_allocated_matrix_view_##name.matrix
 
+/*
+ * Floating point type used for atomic coordinates and pairwise
+ * energies.  Building with -DSINGLE_PRECISION halves the memory
+ * footprint of a conformation (and doubles the SIMD width of the
+ * distance computations); totals are still accumulated in double.
+ */
+#ifdef SINGLE_PRECISION
+typedef float real;
+# define REAL_EPSILON FLT_EPSILON
+#else
+typedef double real;
+# define REAL_EPSILON DBL_EPSILON
+#endif
+
+static inline real real_sqrt(real x)
+{
+#ifdef SINGLE_PRECISION
+        return sqrtf(x);
+#else
+        return sqrt(x);
+#endif
+}
+
+/* Size in bytes of a cache line on the machines we care about. */
+#define CACHE_LINE_SIZE 64
+
+/* Rounds size up to the next multiple of the cache line size. */
+#define cache_line_round_up(size)                                       \
+        (((size) + CACHE_LINE_SIZE - 1) & ~((size_t) CACHE_LINE_SIZE - 1))
+
 #if DEBUG_LEVEL > 0
 # define dprintf(...)                           \
 do {                                            \
@@ -36,6 +66,23 @@ do {                                            \
 extern void set_prog_name(const char *name);
 extern const char *get_prog_name(void);
 
+/*
+ * Waiting for a counter another thread or process writes: the first
+ * pauses only yield, in case it is about to be written, and the later
+ * ones sleep for ever longer, so that a long wait leaves the core to
+ * others.  Starts zeroed.
+ */
+struct backoff {
+        size_t pauses;
+        long delay;             /* Nanoseconds of the next sleep. */
+};
+
+extern void *cache_aligned_alloc(size_t size);
+extern double wall_time(void);
+
+extern bool backoff_is_sleeping(const struct backoff *self);
+extern double backoff_pause(struct backoff *self);
+
 extern void die(const char *message) __attribute__((noreturn));
 extern void die_errno(const char *func_name) __attribute__((noreturn));
 extern void die_printf(const char *format, ...) __attribute__((format(printf, 1, 2), noreturn));
@@ -0,0 +1,109 @@
+#ifndef VEC3_H
+#define VEC3_H
+
+/*
+ * Fixed-size geometry in double precision: 3-vectors, 3x3 matrices
+ * (row-major) and unit quaternions (scalar part first), as plain arrays
+ * on the stack.  Everything is inlined so that a movement costs a few
+ * dozen floating point operations and no calls.
+ */
+
+static inline void vec3_from_real(double r[3], const real p[3])
+{
+        r[0] = p[0], r[1] = p[1], r[2] = p[2];
+}
+
+static inline double vec3_dot(const double u[3], const double v[3])
+{
+        return u[0]*v[0] + u[1]*v[1] + u[2]*v[2];
+}
+
+static inline void vec3_cross(double r[3], const double u[3], const double v[3])
+{
+        const double x = u[1]*v[2] - u[2]*v[1];
+        const double y = u[2]*v[0] - u[0]*v[2];
+        const double z = u[0]*v[1] - u[1]*v[0];
+
+        r[0] = x, r[1] = y, r[2] = z;
+}
+
+/** <u, v x w> */
+static inline double vec3_triple(const double u[3], const double v[3],
+                                 const double w[3])
+{
+        double vxw[3];
+
+        vec3_cross(vxw, v, w);
+
+        return vec3_dot(u, vxw);
+}
+
+static inline void vec3_normalize(double u[3])
+{
+        const double s = 1.0/sqrt(vec3_dot(u, u));
+
+        u[0] *= s, u[1] *= s, u[2] *= s;
+}
+
+/** r = R v, or R^T v if transpose is true. */
+static inline void mat3_apply(double r[3], bool transpose,
+                              const double R[3][3], const double v[3])
+{
+        double w[3];
+
+        for (size_t i = 0; i < 3; i++)
+                w[i] = transpose
+                        ? R[0][i]*v[0] + R[1][i]*v[1] + R[2][i]*v[2]
+                        : R[i][0]*v[0] + R[i][1]*v[1] + R[i][2]*v[2];
+
+        r[0] = w[0], r[1] = w[1], r[2] = w[2];
+}
+
+/** Rotation by theta radians about the axis u, which need not be
+ * normalized (Rodrigues' formula). */
+static inline void mat3_rotation(double R[3][3], const double u[3], double theta)
+{
+        const double norm = sqrt(vec3_dot(u, u));
+        const double x = u[0]/norm, y = u[1]/norm, z = u[2]/norm;
+        const double c = cos(theta), s = sin(theta), t = 1.0 - c;
+
+        R[0][0] = t*x*x + c;    R[0][1] = t*x*y - s*z;  R[0][2] = t*x*z + s*y;
+        R[1][0] = t*x*y + s*z;  R[1][1] = t*y*y + c;    R[1][2] = t*y*z - s*x;
+        R[2][0] = t*x*z - s*y;  R[2][1] = t*y*z + s*x;  R[2][2] = t*z*z + c;
+}
+
+/** Rotation matrix of the unit quaternion q = (cos t/2, sin t/2 u), in
+ * the frame-rotating convention: it turns vectors by -t about u. */
+static inline void mat3_from_quaternion(double R[3][3], const double q[4])
+{
+        const double a = q[0], b = q[1], c = q[2], d = q[3];
+
+        R[0][0] = a*a + b*b - c*c - d*d;
+        R[0][1] = 2.0*(b*c + a*d);
+        R[0][2] = 2.0*(b*d - a*c);
+
+        R[1][0] = 2.0*(b*c - a*d);
+        R[1][1] = a*a - b*b + c*c - d*d;
+        R[1][2] = 2.0*(c*d + a*b);
+
+        R[2][0] = 2.0*(b*d + a*c);
+        R[2][1] = 2.0*(c*d - a*b);
+        R[2][2] = a*a - b*b - c*c + d*d;
+}
+
+/** r = the rotation of v by the unit quaternion q, as applied by the
+ * matrix of mat3_from_quaternion(), without forming the matrix. */
+static inline void quaternion_apply(double r[3], const double q[4],
+                                    const double v[3])
+{
+        /* v - 2a (u x v) + 2 u x (u x v), u being the vector part. */
+        const double u[3] = { q[1], q[2], q[3] };
+        double t[3], s[3];
+
+        vec3_cross(t, u, v);
+        vec3_cross(s, u, t);
+        for (size_t i = 0; i < 3; i++)
+                r[i] = v[i] - 2.0*q[0]*t[i] + 2.0*s[i];
+}
+
+#endif // !VEC3_H